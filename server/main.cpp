@@ -0,0 +1,95 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+/*
+    Handling the viewers of an application, that has been started with
+    QVNC_GL_PUBLISH. The application only grabs its frames into shared memory,
+    while client handling and encoding happen here - with a lower priority
+    and optionally in a cgroup, that limits CPU and memory.
+
+        vnceglfs-server [--port 5900] [--nice 10] [--cgroup <dir>] <path>
+ */
+
+#include <VncNamespace.h>
+
+#include <qguiapplication.h>
+#include <qcommandlineparser.h>
+#include <qfile.h>
+#include <qdebug.h>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+static bool joinCGroup( const QString& dir )
+{
+    /*
+        The cgroup has to be created in advance - f.e. by a systemd slice -
+        with write access to cgroup.procs.
+     */
+    QFile file( dir + QStringLiteral( "/cgroup.procs" ) );
+    if ( !file.open( QIODevice::WriteOnly ) )
+        return false;
+
+    return file.write( QByteArray::number( qint64( ::getpid() ) ) ) > 0;
+}
+
+int main( int argc, char* argv[] )
+{
+    // no need for a display, and EGLFS would compete with the application
+    if ( !qEnvironmentVariableIsSet( "QT_QPA_PLATFORM" ) )
+        qputenv( "QT_QPA_PLATFORM", "offscreen" );
+
+    QGuiApplication app( argc, argv );
+    app.setApplicationName( QStringLiteral( "vnceglfs-server" ) );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        QStringLiteral( "VNC server for the frames published by a Qt/Quick application" ) );
+    parser.addHelpOption();
+
+    QCommandLineOption portOption( QStringLiteral( "port" ),
+        QStringLiteral( "Port for the viewers, default: first unused port >= $QVNC_GL_PORT" ),
+        QStringLiteral( "port" ), QStringLiteral( "-1" ) );
+
+    QCommandLineOption niceOption( QStringLiteral( "nice" ),
+        QStringLiteral( "Scheduling priority ( nice value ), default: 10" ),
+        QStringLiteral( "value" ), QStringLiteral( "10" ) );
+
+    QCommandLineOption cgroupOption( QStringLiteral( "cgroup" ),
+        QStringLiteral( "cgroup directory, where to move the process" ),
+        QStringLiteral( "dir" ) );
+
+    parser.addOption( portOption );
+    parser.addOption( niceOption );
+    parser.addOption( cgroupOption );
+
+    parser.addPositionalArgument( QStringLiteral( "path" ),
+        QStringLiteral( "Unix domain socket, where the application publishes its frames" ) );
+
+    parser.process( app );
+
+    const auto args = parser.positionalArguments();
+    if ( args.count() != 1 )
+        parser.showHelp( 1 );
+
+    if ( parser.isSet( cgroupOption ) )
+    {
+        const auto dir = parser.value( cgroupOption );
+        if ( !joinCGroup( dir ) )
+            qWarning() << "Can't move the process into the cgroup" << dir;
+    }
+
+    const int niceValue = parser.value( niceOption ).toInt();
+    if ( ::setpriority( PRIO_PROCESS, 0, niceValue ) != 0 )
+        qWarning() << "Can't set the priority to" << niceValue;
+
+    if ( !Vnc::startRemoteServer( args.first(), parser.value( portOption ).toInt() ) )
+    {
+        qWarning() << "Can't start the VNC server";
+        return 1;
+    }
+
+    return app.exec();
+}
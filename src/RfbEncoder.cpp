@@ -6,19 +6,32 @@
 #include "RfbEncoder.h"
 
 #include <qimage.h>
+#include <qvector.h>
 #include <qbuffer.h>
 #include <qimagewriter.h>
 #include <qelapsedtimer.h>
+#include <qglobalstatic.h>
 #include <qloggingcategory.h>
 
+#ifdef VNC_LIBJPEG
+#include <cstring>
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
 Q_LOGGING_CATEGORY( logEncoding, "vnceglfs.encode", QtCriticalMsg )
 
+// export QT_LOGGING_RULES="vnceglfs.encode.info=true"
+
 class RfbEncoder::Encoder
 {
   public:
     virtual ~Encoder() = default;
 
-    virtual void encode( const QImage&, int compression ) = 0;
+    virtual bool encode( const QImage&, int compression ) = 0;
+    virtual bool encode( const RfbYuvImage&, int ) { return false; }
+
     virtual const QByteArray& encodedData() const = 0;
     virtual void release() = 0;
 };
@@ -33,13 +46,24 @@ namespace
             m_imageWriter.setFormat( "jpeg" );
         }
 
-        void encode( const QImage& image, int quality ) override
+        using RfbEncoder::Encoder::encode;
+
+        bool encode( const QImage& image, int quality ) override
         {
             QBuffer buffer( &m_encodedData );
 
             m_imageWriter.setDevice( &buffer );
             m_imageWriter.setQuality( quality );
-            m_imageWriter.write( image );
+
+            if ( !m_imageWriter.write( image ) )
+            {
+                qCWarning( logEncoding ) << "QImageWriter:" << m_imageWriter.errorString();
+
+                m_encodedData.resize( 0 );
+                return false;
+            }
+
+            return true;
         }
 
         const QByteArray& encodedData() const override
@@ -56,32 +80,484 @@ namespace
         QImageWriter m_imageWriter;
         QByteArray m_encodedData;
     };
+
+#ifdef VNC_LIBJPEG
+
+    /*
+        Using libjpeg directly allows to pass in YCbCr planes, that
+        have been converted and subsampled on the GPU ( raw data input ).
+     */
+    class EncoderLibJpeg : public RfbEncoder::Encoder
+    {
+      public:
+        EncoderLibJpeg()
+        {
+            m_compress.err = jpeg_std_error( &m_error.manager );
+            m_error.manager.error_exit = &EncoderLibJpeg::errorExit;
+
+            jpeg_create_compress( &m_compress );
+
+            m_destination.init_destination = &EncoderLibJpeg::initDestination;
+            m_destination.empty_output_buffer = &EncoderLibJpeg::emptyOutputBuffer;
+            m_destination.term_destination = &EncoderLibJpeg::termDestination;
+
+            m_compress.dest = &m_destination;
+            m_compress.client_data = &m_encodedData;
+        }
+
+        ~EncoderLibJpeg() override
+        {
+            jpeg_destroy_compress( &m_compress );
+        }
+
+        bool encode( const QImage& image, int quality ) override
+        {
+            const auto rgb = image.convertToFormat( QImage::Format_RGB888 );
+
+            m_rows.resize( rgb.height() );
+            for ( int i = 0; i < rgb.height(); i++ )
+                m_rows[i] = const_cast< JSAMPROW >( rgb.constScanLine( i ) );
+
+            if ( !compress( rgb.width(), rgb.height(), quality, false ) )
+            {
+                m_encodedData.resize( 0 );
+                return false;
+            }
+
+            return true;
+        }
+
+        bool encode( const RfbYuvImage& image, int quality ) override
+        {
+            const int w = image.size.width();
+            const int h = image.size.height();
+
+            if ( ( w % 8 ) || ( h % 2 ) )
+                return false;
+
+            /*
+                libjpeg reads complete blocks of 8x8 samples: the
+                planes are padded by repeating the last column/row.
+             */
+            m_rows.resize( 0 );
+
+            addRows( image.y, w, h, m_padded[0] );
+            addRows( image.cb, w / 2, h / 2, m_padded[1] );
+            addRows( image.cr, w / 2, h / 2, m_padded[2] );
+
+            if ( !compress( w, h, quality, true ) )
+            {
+                m_encodedData.resize( 0 );
+                return false;
+            }
+
+            return true;
+        }
+
+        const QByteArray& encodedData() const override
+        {
+            return m_encodedData;
+        }
+
+        void release() override
+        {
+            m_encodedData.resize( 0 );
+        }
+
+      private:
+        bool compress( int width, int height, int quality, bool raw )
+        {
+            if ( setjmp( m_error.jump ) )
+            {
+                jpeg_abort_compress( &m_compress );
+                return false;
+            }
+
+            m_compress.image_width = width;
+            m_compress.image_height = height;
+            m_compress.input_components = 3;
+            m_compress.in_color_space = raw ? JCS_YCbCr : JCS_RGB;
+
+            jpeg_set_defaults( &m_compress );
+            jpeg_set_quality( &m_compress, quality, TRUE );
+
+            m_compress.dct_method = JDCT_IFAST;
+
+            if ( raw )
+            {
+                m_compress.raw_data_in = TRUE;
+
+                m_compress.comp_info[0].h_samp_factor = 2;
+                m_compress.comp_info[0].v_samp_factor = 2;
+
+                for ( int i = 1; i < 3; i++ )
+                {
+                    m_compress.comp_info[i].h_samp_factor = 1;
+                    m_compress.comp_info[i].v_samp_factor = 1;
+                }
+            }
+
+            jpeg_start_compress( &m_compress, TRUE );
+
+            if ( raw )
+            {
+                const int chromaHeight = height / 2;
+
+                JSAMPROW y[16];
+                JSAMPROW cb[8];
+                JSAMPROW cr[8];
+
+                JSAMPARRAY planes[] = { y, cb, cr };
+
+                for ( int row = 0; row < height; row += 16 )
+                {
+                    for ( int i = 0; i < 16; i++ )
+                        y[i] = m_rows[ qMin( row + i, height - 1 ) ];
+
+                    for ( int i = 0; i < 8; i++ )
+                    {
+                        const int line = qMin( row / 2 + i, chromaHeight - 1 );
+
+                        cb[i] = m_rows[ height + line ];
+                        cr[i] = m_rows[ height + chromaHeight + line ];
+                    }
+
+                    jpeg_write_raw_data( &m_compress, planes, 16 );
+                }
+            }
+            else
+            {
+                jpeg_write_scanlines( &m_compress, m_rows.data(), height );
+            }
+
+            jpeg_finish_compress( &m_compress );
+
+            return true;
+        }
+
+        void addRows( const QByteArray& plane,
+            int width, int height, QByteArray& padded )
+        {
+            const int paddedWidth = ( width + 7 ) / 8 * 8;
+
+            if ( paddedWidth == width )
+            {
+                const auto data = reinterpret_cast< const uchar* >( plane.constData() );
+
+                for ( int i = 0; i < height; i++ )
+                    m_rows += const_cast< JSAMPROW >( data + i * width );
+
+                return;
+            }
+
+            padded.resize( paddedWidth * height );
+            auto data = reinterpret_cast< uchar* >( padded.data() );
+
+            for ( int i = 0; i < height; i++ )
+            {
+                auto line = data + i * paddedWidth;
+
+                memcpy( line, plane.constData() + i * width, width );
+                memset( line + width, line[ width - 1 ], paddedWidth - width );
+
+                m_rows += line;
+            }
+        }
+
+        static void errorExit( j_common_ptr info )
+        {
+            auto error = reinterpret_cast< Error* >( info->err );
+
+            char message[ JMSG_LENGTH_MAX ];
+            ( *info->err->format_message )( info, message );
+
+            qCWarning( logEncoding ) << "libjpeg:" << message;
+
+            longjmp( error->jump, 1 );
+        }
+
+        static void initDestination( j_compress_ptr compress )
+        {
+            auto data = static_cast< QByteArray* >( compress->client_data );
+
+            if ( data->capacity() < 4096 )
+                data->reserve( 4096 );
+
+            data->resize( data->capacity() );
+
+            compress->dest->next_output_byte = reinterpret_cast< JOCTET* >( data->data() );
+            compress->dest->free_in_buffer = data->size();
+        }
+
+        static boolean emptyOutputBuffer( j_compress_ptr compress )
+        {
+            auto data = static_cast< QByteArray* >( compress->client_data );
+
+            const int size = data->size();
+            data->resize( 2 * size );
+
+            compress->dest->next_output_byte = reinterpret_cast< JOCTET* >( data->data() + size );
+            compress->dest->free_in_buffer = data->size() - size;
+
+            return TRUE;
+        }
+
+        static void termDestination( j_compress_ptr compress )
+        {
+            auto data = static_cast< QByteArray* >( compress->client_data );
+            data->resize( data->size() - int( compress->dest->free_in_buffer ) );
+        }
+
+        struct Error
+        {
+            jpeg_error_mgr manager;
+            jmp_buf jump;
+        };
+
+        jpeg_compress_struct m_compress;
+        jpeg_destination_mgr m_destination;
+        Error m_error;
+
+        QVector< JSAMPROW > m_rows;
+        QByteArray m_padded[3];
+
+        QByteArray m_encodedData;
+    };
+
+#endif
+
+    template< typename T >
+    RfbEncoder::Encoder* createEncoder()
+    {
+        return new T();
+    }
+
+    class Backend
+    {
+      public:
+        enum Input
+        {
+            RgbInput = 1 << 0, // QImage
+            YuvInput = 1 << 1  // RfbYuvImage
+        };
+
+        const char* name;
+
+        int inputs;
+
+        /*
+            The pixel formats of the viewer, that can be served: JPEG
+            decodes to true color, what needs more than 8 bits per pixel
+         */
+        int minBitsPerPixel;
+
+        // instances can be used in different threads at the same time
+        bool reentrant;
+
+        RfbEncoder::Encoder* ( *create )();
+    };
+
+    // all backends produce baseline JPEG, what is what Tight expects
+    const Backend backends[] =
+    {
+#ifdef VNC_LIBJPEG
+        { "libjpeg", Backend::RgbInput | Backend::YuvInput, 16, true,
+            &createEncoder< EncoderLibJpeg > },
+#endif
+        { "QImageWriter", Backend::RgbInput, 16, true, &createEncoder< EncoderQt > }
+    };
+
+    const int backendCount = sizeof( backends ) / sizeof( backends[0] );
+
+    QImage calibrationImage()
+    {
+        /*
+            Gradients with some noise for photo like content, and
+            areas with sharp edges like texts. Always the same
+            pseudo random numbers to get comparable results.
+         */
+        QImage image( 256, 256, QImage::Format_RGB32 );
+
+        quint32 seed = 1;
+
+        for ( int y = 0; y < image.height(); y++ )
+        {
+            auto line = reinterpret_cast< QRgb* >( image.scanLine( y ) );
+
+            for ( int x = 0; x < image.width(); x++ )
+            {
+                seed = seed * 1103515245 + 12345;
+                const int noise = ( seed >> 16 ) & 0x1f;
+
+                if ( ( x / 32 + y / 16 ) % 4 == 0 )
+                {
+                    const int value = ( ( x % 4 ) && ( y % 3 ) ) ? 255 : 0;
+                    line[x] = qRgb( value, value, value );
+                }
+                else
+                {
+                    line[x] = qRgb( qMin( x + noise, 255 ),
+                        qMin( y + noise, 255 ), ( x + y ) / 2 );
+                }
+            }
+        }
+
+        return image;
+    }
+
+    inline bool isJpeg( const QByteArray& data )
+    {
+        // SOI and EOI markers
+        return data.size() > 4
+            && uchar( data[0] ) == 0xff && uchar( data[1] ) == 0xd8
+            && uchar( data[ data.size() - 2 ] ) == 0xff
+            && uchar( data[ data.size() - 1 ] ) == 0xd9;
+    }
+
+    /*
+        Which backend is the best one depends on the device: f.e. a
+        libjpeg-turbo without SIMD support for the CPU is slower than
+        the plugin of Qt, that might have been built with a different one.
+        So each backend encodes a synthetic frame once and the fastest one
+        wins, as long as its output is not significantly larger.
+     */
+    class Calibration
+    {
+      public:
+        Calibration()
+        {
+            const auto image = calibrationImage();
+
+            qint64 times[ backendCount ];
+            int sizes[ backendCount ];
+
+            int minSize = -1;
+
+            for ( int i = 0; i < backendCount; i++ )
+            {
+                const auto& backend = backends[i];
+
+                times[i] = -1;
+                sizes[i] = -1;
+
+                // each client is encoding in its own thread
+                if ( !backend.reentrant || !( backend.inputs & Backend::RgbInput ) )
+                    continue;
+
+                auto encoder = backend.create();
+
+                for ( int run = 0; run < 3; run++ )
+                {
+                    QElapsedTimer timer;
+                    timer.start();
+
+                    const bool ok = encoder->encode( image, 50 );
+
+                    const auto nsecs = timer.nsecsElapsed();
+
+                    if ( !ok || !isJpeg( encoder->encodedData() ) )
+                    {
+                        times[i] = -1;
+                        break;
+                    }
+
+                    if ( times[i] < 0 || nsecs < times[i] )
+                        times[i] = nsecs;
+
+                    sizes[i] = encoder->encodedData().size();
+                    encoder->release();
+                }
+
+                delete encoder;
+
+                if ( times[i] < 0 )
+                {
+                    qCWarning( logEncoding ) << "JPEG backend" << backend.name << "is broken";
+                    continue;
+                }
+
+                qCInfo( logEncoding ).nospace() << "JPEG backend " << backend.name
+                    << ": " << times[i] / 1000 << "us, " << sizes[i] << " bytes";
+
+                if ( minSize < 0 || sizes[i] < minSize )
+                    minSize = sizes[i];
+
+                if ( yuvBackend < 0 && ( backend.inputs & Backend::YuvInput ) )
+                    yuvBackend = i;
+            }
+
+            for ( int i = 0; i < backendCount; i++ )
+            {
+                if ( times[i] < 0 || sizes[i] > minSize * 6 / 5 )
+                    continue;
+
+                if ( rgbBackend < 0 || times[i] < times[ rgbBackend ] )
+                    rgbBackend = i;
+            }
+
+            if ( rgbBackend < 0 )
+            {
+                // nothing works: going with the last one, that needs no dependencies
+                rgbBackend = backendCount - 1;
+            }
+
+            qCInfo( logEncoding ) << "JPEG backend:" << backends[ rgbBackend ].name;
+        }
+
+        int rgbBackend = -1;
+        int yuvBackend = -1;
+    };
 }
 
+Q_GLOBAL_STATIC( Calibration, calibration )
+
 RfbEncoder::RfbEncoder()
 {
-    m_encoder = new EncoderQt();
+    // the calibration is done once, when the first encoder is created
+    m_encoder = backends[ calibration->rgbBackend ].create();
+    m_current = m_encoder;
+}
+
+bool RfbEncoder::hasYuvSupport()
+{
+    return calibration->yuvBackend >= 0;
+}
+
+bool RfbEncoder::isFormatSupported( int bitsPerPixel, bool trueColor, bool yuv )
+{
+    const auto index = yuv ? calibration->yuvBackend : calibration->rgbBackend;
+    if ( index < 0 )
+        return false;
+
+    return trueColor && ( bitsPerPixel >= backends[ index ].minBitsPerPixel );
 }
 
 RfbEncoder::~RfbEncoder()
 {
+    if ( m_yuvEncoder != m_encoder )
+        delete m_yuvEncoder;
+
     delete m_encoder;
 }
 
 
-void RfbEncoder::encode( const QImage& image, const QRect& rect )
+bool RfbEncoder::encode( const QImage& image, const QRect& rect )
 {
     QElapsedTimer timer;
 
     if ( logEncoding().isDebugEnabled() )
         timer.start();
 
+    m_current = m_encoder;
+
+    bool ok;
+
     if ( rect == QRect( 0, 0, image.width(), image.height() ) )
-        m_encoder->encode( image, m_quality );
+        ok = m_encoder->encode( image, m_quality );
     else
-        m_encoder->encode( image.copy( rect ), m_quality );
+        ok = m_encoder->encode( image.copy( rect ), m_quality );
 
-    if ( logEncoding().isDebugEnabled() )
+    if ( ok && logEncoding().isDebugEnabled() )
     {
         const auto ms = timer.elapsed();
 
@@ -95,14 +571,50 @@ void RfbEncoder::encode( const QImage& image, const QRect& rect )
             << "->" << m_encoder->encodedData().size()
             << "ms: elapsed" << ms;
     }
+
+    return ok;
+}
+
+bool RfbEncoder::encode( const RfbYuvImage& image )
+{
+    QElapsedTimer timer;
+
+    if ( logEncoding().isDebugEnabled() )
+        timer.start();
+
+    if ( m_yuvEncoder == nullptr )
+    {
+        const auto index = calibration->yuvBackend;
+        if ( index < 0 )
+            return false;
+
+        // the selected backend might not accept YCbCr
+        m_yuvEncoder = ( index == calibration->rgbBackend )
+            ? m_encoder : backends[ index ].create();
+    }
+
+    m_current = m_yuvEncoder;
+
+    const bool ok = m_yuvEncoder->encode( image, m_quality );
+
+    if ( ok && logEncoding().isDebugEnabled() )
+    {
+        qCDebug( logEncoding ) << "JPEG( YCbCr ):" << "quality:" << m_quality
+            << "w:" << image.size.width() << "h:" << image.size.height()
+            << "bytes:" << image.y.size() + image.cb.size() + image.cr.size()
+            << "->" << m_yuvEncoder->encodedData().size()
+            << "ms: elapsed" << timer.elapsed();
+    }
+
+    return ok;
 }
 
 const QByteArray& RfbEncoder::encodedData() const
 {
-    return m_encoder->encodedData();
+    return m_current->encodedData();
 }
 
 void RfbEncoder::release()
 {
-    m_encoder->release();
+    m_current->release();
 }
@@ -5,9 +5,28 @@
 
 #pragma once
 
+#include <qbytearray.h>
+#include <qsize.h>
+
 class QImage;
 class QRect;
-class QByteArray;
+
+/*
+    YCbCr 4:2:0 ( JFIF ) in 3 planes, what is the input of JPEG
+    without any conversion. The width is a multiple of 8,
+    the height a multiple of 2.
+ */
+class RfbYuvImage
+{
+  public:
+    bool isNull() const { return size.isEmpty(); }
+
+    QSize size;
+
+    QByteArray y;  // size.width() * size.height()
+    QByteArray cb; // size.width() / 2 * size.height() / 2
+    QByteArray cr; // size.width() / 2 * size.height() / 2
+};
 
 class RfbEncoder
 {
@@ -18,7 +37,16 @@ class RfbEncoder
     void setQuality( int compression );
     int quality() const;
 
-    void encode( const QImage&, const QRect& );
+    // false, when the backend fails
+    bool encode( const QImage&, const QRect& );
+
+    // false, when no backend accepts YCbCr input
+    bool encode( const RfbYuvImage& );
+    static bool hasYuvSupport();
+
+    // if the pixel format of a viewer can be served by the selected backend
+    static bool isFormatSupported( int bitsPerPixel, bool trueColor, bool yuv = false );
+
     const QByteArray& encodedData() const;
 
     void release();
@@ -26,7 +54,15 @@ class RfbEncoder
     class Encoder;
 
   private:
+    /*
+        The backends are registered in RfbEncoder.cpp. The one being used
+        is selected by a calibration, when the first encoder is created.
+     */
     Encoder* m_encoder;
+    Encoder* m_yuvEncoder = nullptr;
+
+    // the encoder of the last call
+    Encoder* m_current;
 
     int m_quality = 50;
 };
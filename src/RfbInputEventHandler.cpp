@@ -67,96 +67,71 @@ namespace Rfb
     );
 }
 
-void Rfb::handlePointerEvent( const QPointF& pos, quint8 buttonMask, QWindow* window )
+static Qt::MouseButtons mouseButtons( quint8 buttonMask )
 {
-    enum
-    {
-        ButtonLeft   = 1 << 0,
-        ButtonMiddle = 1 << 1,
-        ButtonRight  = 1 << 2,
+    Qt::MouseButtons buttons;
 
-        WheelUp      = 1 << 3,
-        WheelDown    = 1 << 4,
-        WheelLeft    = 1 << 5,
-        WheelRight   = 1 << 6,
+    if ( buttonMask & Rfb::ButtonLeft )
+        buttons |= Qt::LeftButton;
 
-        ButtonMask   = ( ButtonLeft | ButtonMiddle | ButtonRight ),
-        WheelMask    = ( WheelUp | WheelDown | WheelLeft | WheelRight )
-    };
+    if ( buttonMask & Rfb::ButtonMiddle )
+        buttons |= Qt::MiddleButton;
 
-    const auto keyboardModifiers = QGuiApplication::keyboardModifiers();
+    if ( buttonMask & Rfb::ButtonRight )
+        buttons |= Qt::RightButton;
 
-    if ( buttonMask & WheelMask )
-    {
-        QPoint delta;
+    return buttons;
+}
 
-        if ( buttonMask & WheelUp )
-        {
-            delta.setY( 1 );
-        }
-        else if ( buttonMask & WheelDown )
-        {
-            delta.setY( -1 );
-        }
+void Rfb::handleMouseEvent( const QPointF& pos, quint8 buttonMask,
+    quint8 oldButtonMask, Qt::KeyboardModifiers modifiers, QWindow* window )
+{
+    const auto buttons = mouseButtons( buttonMask );
+    auto oldButtons = mouseButtons( oldButtonMask );
 
-        if ( buttonMask & WheelLeft )
-        {
-            delta.setX( -1 );
-        }
-        else if ( buttonMask & WheelRight )
-        {
-            delta.setX( 1 );
-        }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
 
-        delta *= QWheelEvent::DefaultDeltasPerStep;
+    if ( buttons == oldButtons )
+    {
+        QWindowSystemInterface::handleMouseEvent( window, pos, pos,
+            buttons, Qt::NoButton, QEvent::MouseMove, modifiers );
 
-        QWindowSystemInterface::handleWheelEvent(
-            window, pos, pos, QPoint(), delta, keyboardModifiers );
+        return;
     }
-    else
-    {
-        Qt::MouseButtons buttons;
 
-        if ( buttonMask & ButtonLeft )
-            buttons |= Qt::LeftButton;
+    // viewers might modify several buttons with one message
 
-        if ( buttonMask & ButtonMiddle )
-            buttons |= Qt::MiddleButton;
+    const Qt::MouseButton candidates[] =
+        { Qt::LeftButton, Qt::MiddleButton, Qt::RightButton };
 
-        if ( buttonMask & ButtonRight )
-            buttons |= Qt::RightButton;
+    for ( const auto button : candidates )
+    {
+        if ( ( buttons & button ) == ( oldButtons & button ) )
+            continue;
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+        oldButtons ^= button;
 
-        // what to do, when having inputs from different clients ???
-        auto oldButtons = QGuiApplication::mouseButtons();
-        oldButtons &= ( Qt::LeftButton | Qt::MiddleButton | Qt::RightButton );
+        const auto eventType = ( buttons & button ) ?
+            QEvent::MouseButtonPress : QEvent::MouseButtonRelease;
 
-        QEvent::Type eventType;
-        Qt::MouseButton button;
+        QWindowSystemInterface::handleMouseEvent( window, pos, pos,
+            oldButtons, button, eventType, modifiers );
+    }
+#else
+    Q_UNUSED( oldButtons )
 
-        if ( buttons == oldButtons )
-        {
-            eventType = QEvent::MouseMove;
-            button = Qt::NoButton;
-        }
-        else
-        {
-            eventType = ( buttons > oldButtons ) ?
-                QEvent::MouseButtonPress : QEvent::MouseButtonRelease;
+    QWindowSystemInterface::handleMouseEvent(
+        window, pos, pos, buttons, modifiers );
+#endif
+}
 
-            const quint32 modified = buttons ^ oldButtons;
-            // Q_ASSERT( qPopulationCount( modified ) == 1 );
-            button = static_cast< Qt::MouseButton >( modified );
-        }
+void Rfb::handleWheelEvent( const QPointF& pos, const QPoint& steps,
+    Qt::KeyboardModifiers modifiers, QWindow* window )
+{
+    const auto delta = steps * QWheelEvent::DefaultDeltasPerStep;
 
-        QWindowSystemInterface::handleMouseEvent(
-            window, pos, pos, buttons, button, eventType, keyboardModifiers );
-#else
-        QWindowSystemInterface::handleMouseEvent(
-            window, pos, pos, buttons, keyboardModifiers );
-#endif
-    }
+    QWindowSystemInterface::handleWheelEvent(
+        window, pos, pos, QPoint(), delta, modifiers );
 }
 
 static QString keyText( quint32 qtkey, bool isLower, Qt::KeyboardModifiers modifiers )
@@ -208,7 +183,8 @@ static QString keyText( quint32 qtkey, bool isLower, Qt::KeyboardModifiers modif
     return QString();
 }
 
-void Rfb::handleKeyEvent( quint32 keysym, bool down, QWindow* window )
+Qt::KeyboardModifiers Rfb::handleKeyEvent( quint32 keysym, bool down,
+    Qt::KeyboardModifiers modifiers, QWindow* window )
 {
     // see https://cgit.freedesktop.org/xorg/proto/x11proto/tree/keysymdef.h
 
@@ -256,8 +232,6 @@ void Rfb::handleKeyEvent( quint32 keysym, bool down, QWindow* window )
 #endif
     if ( qtkey )
     {
-        auto modifiers = QGuiApplication::keyboardModifiers();
-
         // QFlags::setFlag is not available for Qt < 5.7
         auto setModifier = [&modifiers]( Qt::KeyboardModifier modifier, bool down )
             { if (down) modifiers |= modifier; else modifiers &= ~modifier; };
@@ -281,4 +255,6 @@ void Rfb::handleKeyEvent( quint32 keysym, bool down, QWindow* window )
         QWindowSystemInterface::handleKeyEvent( window,
             eventType, qtkey, modifiers, text );
     }
+
+    return modifiers;
 }
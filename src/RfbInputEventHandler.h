@@ -5,13 +5,39 @@
 
 #pragma once
 
-#include <qglobal.h>
+#include <qnamespace.h>
 
+class QPoint;
 class QPointF;
 class QWindow;
 
 namespace Rfb
 {
-    void handlePointerEvent( const QPointF&, quint8 buttonMask, QWindow* );
-    void handleKeyEvent( quint32 key, bool down, QWindow* );
+    // button mask of the PointerEvent message
+    enum PointerButton
+    {
+        ButtonLeft   = 1 << 0,
+        ButtonMiddle = 1 << 1,
+        ButtonRight  = 1 << 2,
+
+        WheelUp      = 1 << 3,
+        WheelDown    = 1 << 4,
+        WheelLeft    = 1 << 5,
+        WheelRight   = 1 << 6,
+
+        ButtonMask   = ( ButtonLeft | ButtonMiddle | ButtonRight ),
+        WheelMask    = ( WheelUp | WheelDown | WheelLeft | WheelRight )
+    };
+
+    // to be called from the GUI thread
+
+    void handleMouseEvent( const QPointF&, quint8 buttonMask,
+        quint8 oldButtonMask, Qt::KeyboardModifiers, QWindow* );
+
+    void handleWheelEvent( const QPointF&, const QPoint& steps,
+        Qt::KeyboardModifiers, QWindow* );
+
+    // returns the modifiers being in effect after the key event
+    Qt::KeyboardModifiers handleKeyEvent( quint32 key, bool down,
+        Qt::KeyboardModifiers, QWindow* );
 }
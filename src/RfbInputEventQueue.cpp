@@ -0,0 +1,213 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "RfbInputEventQueue.h"
+#include "RfbInputEventHandler.h"
+
+#include <qcoreapplication.h>
+#include <qguiapplication.h>
+#include <qevent.h>
+
+namespace
+{
+    using Event = RfbInputEventQueue::Event;
+
+    class BatchEvent final : public QEvent
+    {
+      public:
+        static QEvent::Type eventType()
+        {
+            static const auto type = static_cast< QEvent::Type >( QEvent::registerEventType() );
+            return type;
+        }
+
+        BatchEvent( const QVector< Event >& batch )
+            : QEvent( eventType() )
+            , events( batch )
+        {
+        }
+
+        const QVector< Event > events;
+    };
+
+    class Dispatcher final : public QObject
+    {
+      public:
+        Dispatcher()
+        {
+            moveToThread( QCoreApplication::instance()->thread() );
+        }
+
+      protected:
+        void customEvent( QEvent* event ) override
+        {
+            if ( event->type() == BatchEvent::eventType() )
+                deliver( static_cast< const BatchEvent* >( event )->events );
+        }
+
+      private:
+        void deliver( const QVector< Event >& events )
+        {
+            /*
+                Modifiers changed by the batch itself are not known to
+                QGuiApplication before the events have been processed.
+             */
+            auto modifiers = QGuiApplication::keyboardModifiers();
+
+            for ( const auto& event : events )
+            {
+                auto window = event.window.data();
+                if ( window == nullptr )
+                    continue;
+
+                switch( event.type )
+                {
+                    case Event::Mouse:
+                    {
+                        Rfb::handleMouseEvent( event.pos, event.buttonMask,
+                            event.oldButtonMask, modifiers, window );
+                        break;
+                    }
+                    case Event::Wheel:
+                    {
+                        Rfb::handleWheelEvent( event.pos,
+                            event.wheelSteps, modifiers, window );
+                        break;
+                    }
+                    case Event::Key:
+                    {
+                        modifiers = Rfb::handleKeyEvent(
+                            event.key, event.down, modifiers, window );
+                        break;
+                    }
+                }
+            }
+        }
+    };
+
+    Q_GLOBAL_STATIC( Dispatcher, dispatcher )
+
+    inline Event createEvent( Event::Type type, QWindow* window, const QPointF& pos )
+    {
+        Event event;
+
+        event.type = type;
+        event.window = window;
+        event.pos = pos;
+        event.buttonMask = event.oldButtonMask = 0;
+        event.key = 0;
+        event.down = false;
+
+        return event;
+    }
+}
+
+RfbInputEventQueue::RfbInputEventQueue()
+    : m_pos( -1.0, -1.0 )
+{
+}
+
+RfbInputEventQueue::~RfbInputEventQueue()
+{
+    flush();
+}
+
+void RfbInputEventQueue::addPointerEvent(
+    QWindow* window, const QPointF& pos, quint8 buttonMask )
+{
+    if ( buttonMask & Rfb::WheelMask )
+    {
+        QPoint steps;
+
+        if ( buttonMask & Rfb::WheelUp )
+            steps.setY( 1 );
+        else if ( buttonMask & Rfb::WheelDown )
+            steps.setY( -1 );
+
+        if ( buttonMask & Rfb::WheelLeft )
+            steps.setX( -1 );
+        else if ( buttonMask & Rfb::WheelRight )
+            steps.setX( 1 );
+
+        auto event = lastEvent( Event::Wheel, window );
+        if ( event && event->pos == pos )
+        {
+            event->wheelSteps += steps;
+        }
+        else
+        {
+            auto wheelEvent = createEvent( Event::Wheel, window, pos );
+            wheelEvent.wheelSteps = steps;
+
+            m_events += wheelEvent;
+        }
+    }
+
+    const quint8 buttons = buttonMask & Rfb::ButtonMask;
+
+    if ( buttons != m_buttonMask )
+    {
+        auto mouseEvent = createEvent( Event::Mouse, window, pos );
+        mouseEvent.buttonMask = buttons;
+        mouseEvent.oldButtonMask = m_buttonMask;
+
+        m_events += mouseEvent;
+    }
+    else
+    {
+        // f.e. the "release" of a wheel tick
+        if ( pos == m_pos && window == m_window )
+            return;
+
+        auto event = lastEvent( Event::Mouse, window );
+        if ( event && event->buttonMask == event->oldButtonMask )
+        {
+            // only the last position of consecutive moves is of interest
+            event->pos = pos;
+        }
+        else
+        {
+            auto moveEvent = createEvent( Event::Mouse, window, pos );
+            moveEvent.buttonMask = moveEvent.oldButtonMask = buttons;
+
+            m_events += moveEvent;
+        }
+    }
+
+    m_buttonMask = buttons;
+    m_pos = pos;
+    m_window = window;
+}
+
+void RfbInputEventQueue::addKeyEvent( QWindow* window, quint32 key, bool down )
+{
+    auto keyEvent = createEvent( Event::Key, window, QPointF() );
+    keyEvent.key = key;
+    keyEvent.down = down;
+
+    m_events += keyEvent;
+}
+
+void RfbInputEventQueue::flush()
+{
+    if ( m_events.isEmpty() )
+        return;
+
+    QCoreApplication::postEvent( dispatcher(), new BatchEvent( m_events ) );
+    m_events.clear();
+}
+
+RfbInputEventQueue::Event* RfbInputEventQueue::lastEvent(
+    Event::Type type, const QWindow* window )
+{
+    if ( !m_events.isEmpty() )
+    {
+        auto& event = m_events.last();
+        if ( event.type == type && event.window == window )
+            return &event;
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qpoint.h>
+#include <qpointer.h>
+#include <qvector.h>
+#include <qwindow.h>
+
+/*
+    Viewers send pointer events with the rate of the input device
+    of the client, what easily floods the GUI thread during a drag.
+
+    The events of a client are collected, while reading the messages
+    of the viewer. Consecutive moves and wheel ticks are merged, while
+    button transitions and key events are kept in order. The result
+    is delivered to the GUI thread as one batch.
+ */
+class RfbInputEventQueue
+{
+  public:
+    RfbInputEventQueue();
+    ~RfbInputEventQueue();
+
+    void addPointerEvent( QWindow*, const QPointF&, quint8 buttonMask );
+    void addKeyEvent( QWindow*, quint32 key, bool down );
+
+    // to be called from the client thread, when all messages have been read
+    void flush();
+
+    class Event
+    {
+      public:
+        enum Type
+        {
+            Mouse,
+            Wheel,
+            Key
+        };
+
+        Type type;
+        QPointer< QWindow > window;
+
+        QPointF pos;
+
+        quint8 buttonMask;
+        quint8 oldButtonMask;
+
+        QPoint wheelSteps;
+
+        quint32 key;
+        bool down;
+    };
+
+  private:
+    Event* lastEvent( Event::Type, const QWindow* );
+
+    QVector< Event > m_events;
+
+    // what has been sent last
+    quint8 m_buttonMask = 0;
+    QPointF m_pos;
+    const QWindow* m_window = nullptr;
+};
@@ -8,8 +8,12 @@
 #include "RfbEncoder.h"
 
 #include <qimage.h>
+#include <qregion.h>
 #include <qendian.h>
 #include <qdebug.h>
+#include <qvarlengtharray.h>
+
+#include <cstring>
 
 namespace
 {
@@ -115,6 +119,40 @@ namespace
             return m_trueColor;
         }
 
+        inline int tightPixelSize() const
+        {
+            /*
+                The Tight encoding sends 3 bytes ( R, G, B ), when
+                having 8 bits for each color in a 32 bit pixel
+             */
+            if ( m_bitsPerPixel == 32 && m_depth == 24 && m_redBits == 8
+                && m_greenBits == 8 && m_blueBits == 8 )
+            {
+                return 3;
+            }
+
+            return bytesPerPixel();
+        }
+
+        void convertTightBuffer( const QRgb* from, int count, char* to ) const
+        {
+            if ( tightPixelSize() == 3 )
+            {
+                auto out = reinterpret_cast< quint8* >( to );
+
+                for ( int i = 0; i < count; i++ )
+                {
+                    *out++ = qRed( from[i] );
+                    *out++ = qGreen( from[i] );
+                    *out++ = qBlue( from[i] );
+                }
+            }
+            else
+            {
+                convertBuffer( from, count, to );
+            }
+        }
+
       private:
         template< typename T >
         inline void convertPixels( const QRgb* rgbBuffer, int count, T* out ) const
@@ -170,11 +208,229 @@ namespace
     };
 }
 
+namespace
+{
+    /*
+        Screens of embedded devices usually consist of flat areas,
+        texts and a couple of images. Each of them compresses best
+        with a different method of the Tight encoding.
+     */
+
+    enum class TileType
+    {
+        Fill,
+        Palette,
+        Copy,
+        JPEG
+    };
+
+    class Tile
+    {
+      public:
+        TileType type;
+        QRect rect;
+        QVector< QRgb > colors;
+    };
+
+    const int tileSize = 64;
+
+    // Tight encoding limits the width of a rectangle
+    const int maxTightWidth = 2048;
+
+    const int maxPaletteSize = 16;
+
+    void copyPlane( const QByteArray& from, int fromWidth,
+        int x, int width, int height, QByteArray& to )
+    {
+        to.resize( width * height );
+
+        for ( int row = 0; row < height; row++ )
+        {
+            memcpy( to.data() + row * width,
+                from.constData() + row * fromWidth + x, size_t( width ) );
+        }
+    }
+
+    // a vertical strip of the planes, x and width being multiples of 8
+    RfbYuvImage yuvStrip( const RfbYuvImage& image, int x, int width )
+    {
+        const int w = image.size.width();
+        const int h = image.size.height();
+
+        if ( x == 0 && width == w )
+            return image;
+
+        RfbYuvImage strip;
+        strip.size = QSize( width, h );
+
+        copyPlane( image.y, w, x, width, h, strip.y );
+        copyPlane( image.cb, w / 2, x / 2, width / 2, h / 2, strip.cb );
+        copyPlane( image.cr, w / 2, x / 2, width / 2, h / 2, strip.cr );
+
+        return strip;
+    }
+
+    inline int colorDistance( QRgb rgb1, QRgb rgb2 )
+    {
+        const int dr = qAbs( qRed( rgb1 ) - qRed( rgb2 ) );
+        const int dg = qAbs( qGreen( rgb1 ) - qGreen( rgb2 ) );
+        const int db = qAbs( qBlue( rgb1 ) - qBlue( rgb2 ) );
+
+        return qMax( dr, qMax( dg, db ) );
+    }
+
+    Tile analyzeTile( const QImage& image, const QRect& rect, bool jpegAllowed )
+    {
+        /*
+            One pass over the pixels collecting:
+
+            - the colors as long as they fit into a palette
+            - the number of pixels being identical to their left neighbour
+            - the number of smooth and hard transitions between neighbours
+
+            Flat or sharp content ( texts, lines ) is encoded lossless,
+            while smooth gradients ( photos, videos ) go to JPEG.
+         */
+
+        Tile tile;
+        tile.rect = rect;
+        tile.colors.reserve( maxPaletteSize );
+
+        bool manyColors = false;
+        int flat = 0, smooth = 0, edges = 0;
+
+        for ( int y = rect.top(); y <= rect.bottom(); y++ )
+        {
+            auto line = reinterpret_cast< const QRgb* >( image.constScanLine( y ) ) + rect.x();
+
+            QRgb previous = 0;
+
+            for ( int x = 0; x < rect.width(); x++ )
+            {
+                const auto rgb = line[x] | 0xff000000;
+
+                if ( x > 0 )
+                {
+                    if ( rgb == previous )
+                    {
+                        flat++;
+                        continue;
+                    }
+
+                    const auto distance = colorDistance( rgb, previous );
+                    if ( distance <= 16 )
+                        smooth++;
+                    else if ( distance >= 96 )
+                        edges++;
+                }
+
+                if ( !manyColors && !tile.colors.contains( rgb ) )
+                {
+                    if ( tile.colors.count() < maxPaletteSize )
+                        tile.colors += rgb;
+                    else
+                        manyColors = true;
+                }
+
+                previous = rgb;
+            }
+        }
+
+        if ( !manyColors )
+        {
+            tile.type = ( tile.colors.count() == 1 ) ? TileType::Fill : TileType::Palette;
+        }
+        else
+        {
+            const int count = rect.width() * rect.height();
+
+            if ( jpegAllowed && ( 2 * flat < count ) && ( smooth > edges ) )
+                tile.type = TileType::JPEG;
+            else
+                tile.type = TileType::Copy;
+
+            tile.colors.clear();
+        }
+
+        return tile;
+    }
+
+    QVector< Tile > tightTiles( const QImage& image,
+        const QVector< QRect >& rects, bool jpegAllowed )
+    {
+        QVector< Tile > tiles;
+
+        for ( const auto& rect : rects )
+        {
+            for ( int y = rect.top(); y <= rect.bottom(); y += tileSize )
+            {
+                const int height = qMin( tileSize, rect.bottom() + 1 - y );
+
+                for ( int x = rect.left(); x <= rect.right(); x += tileSize )
+                {
+                    const int width = qMin( tileSize, rect.right() + 1 - x );
+
+                    auto tile = analyzeTile( image,
+                        QRect( x, y, width, height ), jpegAllowed );
+
+                    if ( x > rect.left() )
+                    {
+                        /*
+                            Joining neighbours of the same row: the header
+                            of a JPEG image is ~600 bytes, fills of the same
+                            color are one rectangle.
+                         */
+                        auto& last = tiles.last();
+
+                        const bool join = ( tile.type == last.type )
+                            && ( last.rect.width() + width <= maxTightWidth )
+                            && ( ( tile.type == TileType::JPEG )
+                                || ( tile.type == TileType::Fill && tile.colors == last.colors ) );
+
+                        if ( join )
+                        {
+                            last.rect.setRight( tile.rect.right() );
+                            continue;
+                        }
+                    }
+
+                    tiles += tile;
+                }
+            }
+        }
+
+        return tiles;
+    }
+
+    void sendCompactLength( quint32 length, RfbSocket* socket )
+    {
+        if ( length >= 16384 )
+        {
+            socket->sendUint8( ( length & 0x7f ) | ( 1 << 7 ) );
+            socket->sendUint8( ( ( length >> 7 ) & 0x7f ) | ( 1 << 7 ) );
+            socket->sendUint8( length >> 14 );
+        }
+        else if ( length >= 128 )
+        {
+            socket->sendUint8( ( length & 0x7f ) | ( 1 << 7 ) );
+            socket->sendUint8( length >> 7 );
+        }
+        else
+        {
+            socket->sendUint8( length );
+        }
+    }
+}
+
 class RfbPixelStreamer::PrivateData
 {
   public:
     RfbEncoder encoder;
     PixelFormat format;
+
+    // cursor image + mask in the format of the client
+    qint64 cursorKey = 0;
+    QByteArray cursorData;
 };
 
 RfbPixelStreamer::RfbPixelStreamer()
@@ -195,6 +451,7 @@ void RfbPixelStreamer::sendServerFormat( RfbSocket* socket )
 void RfbPixelStreamer::receiveClientFormat( RfbSocket* socket )
 {
     m_data->format.read( socket );
+    m_data->cursorKey = 0;
 
     if ( !m_data->format.isTrueColor() )
         qWarning("VNC: can only handle true color clients");
@@ -203,8 +460,10 @@ void RfbPixelStreamer::receiveClientFormat( RfbSocket* socket )
 void RfbPixelStreamer::sendImageData(
     const QImage& image, const QRect& rect, RfbSocket* socket )
 {
-    auto line = reinterpret_cast< const QRgb* >( image.constBits() );
-    line += rect.y() * rect.width() + rect.x();
+    auto line = reinterpret_cast< const QRgb* >( image.constScanLine( rect.y() ) );
+    line += rect.x();
+
+    const int stride = image.bytesPerLine() / sizeof( QRgb );
 
     const auto& format = m_data->format;
 
@@ -213,7 +472,7 @@ void RfbPixelStreamer::sendImageData(
         for ( int i = 0; i < rect.height(); ++i )
         {
             socket->sendScanLine32( line, rect.width() );
-            line += image.width();
+            line += stride;
         }
     }
     else
@@ -226,7 +485,7 @@ void RfbPixelStreamer::sendImageData(
             format.convertBuffer( line, rect.width(), buffer.data() );
             socket->sendScanLine8( buffer.constData(), buffer.size() );
 
-            line += image.width();
+            line += stride;
         }
     }
 }
@@ -250,94 +509,330 @@ void RfbPixelStreamer::sendImageRaw(
     socket->flush();
 }
 
-void RfbPixelStreamer::sendImageJPEG(
-    const QImage& image, const QVector< QRect >& rects, int qualityLevel, RfbSocket* socket )
+QRegion RfbPixelStreamer::sendImageTight( const QImage& image,
+    const QVector< QRect >& rects, int qualityLevel, int compressionLevel, RfbSocket* socket )
 {
     auto& encoder = m_data->encoder;
 
     // quality: [1:100], level: [0,9]. Higher means better quality + less compression
     encoder.setQuality( ( qualityLevel + 1 ) * 10 );
 
+    const auto& format = m_data->format;
+
+    // f.e. JPEG is not allowed for 8 bit pixels
+    const bool jpegAllowed = ( qualityLevel >= 0 ) && RfbEncoder::isFormatSupported(
+        format.bytesPerPixel() * 8, format.isTrueColor() );
+
+    const auto tiles = tightTiles( image, rects, jpegAllowed );
+
     socket->sendUint8( 0 ); // msg type
     socket->sendPadding( 1 );
 
-    socket->sendUint16( 1 );
-
-    // Tight encoding limits the width of a rectangle
-    const int maxWidth = 2048;
+    socket->sendUint16( tiles.count() );
 
-    QVector< QRect > tightRects;
-    tightRects.reserve( image.width() / maxWidth + 1 ); // guessing fullscreen
+    QRegion lossyRegion;
 
-    for ( const QRect& rect : rects )
+    for ( const auto& tile : tiles )
     {
-        for ( int x = rect.x(); x < rect.x() + rect.width(); x += maxWidth )
+        socket->sendRect64( tile.rect );
+        socket->sendEncoding32( 7 ); // Tight
+
+        switch( tile.type )
         {
-            const int width = qMin( maxWidth, rect.x() + rect.width() - x );
-            tightRects += QRect( x, rect.y(), width, rect.height() );
+            case TileType::Fill:
+                sendTightFill( tile.colors.first(), socket );
+                break;
+
+            case TileType::Palette:
+                sendTightPalette( image, tile.rect, tile.colors, compressionLevel, socket );
+                break;
+
+            case TileType::Copy:
+                sendTightCopy( image, tile.rect, compressionLevel, socket );
+                break;
+
+            case TileType::JPEG:
+                if ( sendTightJPEG( image, tile.rect, socket ) )
+                    lossyRegion += tile.rect;
+                else
+                    sendTightCopy( image, tile.rect, compressionLevel, socket );
+
+                break;
         }
     }
 
-    for ( const QRect& rect : tightRects )
+    encoder.release();
+
+    socket->flush();
+
+    return lossyRegion;
+}
+
+bool RfbPixelStreamer::canSendYuv() const
+{
+    const auto& format = m_data->format;
+
+    return RfbEncoder::hasYuvSupport() && RfbEncoder::isFormatSupported(
+        format.bytesPerPixel() * 8, format.isTrueColor(), true );
+}
+
+QRegion RfbPixelStreamer::sendImageYuv( const RfbYuvImage& image,
+    const QPoint& pos, int qualityLevel, RfbSocket* socket )
+{
+    auto& encoder = m_data->encoder;
+    encoder.setQuality( ( qualityLevel + 1 ) * 10 );
+
+    /*
+        Viewers reject Tight rectangles being wider than maxTightWidth:
+        wide frames are sent as strips. As the number of rectangles
+        is sent first, all strips are encoded in advance.
+     */
+    QVector< QRect > rects;
+    QVector< QByteArray > encodedData;
+
+    for ( int x = 0; x < image.size.width(); x += maxTightWidth )
     {
-        socket->sendRect64( rect );
+        const int width = qMin( maxTightWidth, image.size.width() - x );
+
+        if ( !encoder.encode( yuvStrip( image, x, width ) ) )
+        {
+            rects.clear();
+            encodedData.clear();
+
+            break;
+        }
 
+        rects += QRect( pos.x() + x, pos.y(), width, image.size.height() );
+        encodedData += encoder.encodedData();
+    }
+
+    encoder.release();
+
+    socket->sendUint8( 0 ); // msg type
+    socket->sendPadding( 1 );
+
+    // when failing, the update is empty and the caller has to resend the frame
+    socket->sendUint16( rects.count() );
+
+    QRegion lossyRegion;
+
+    for ( int i = 0; i < rects.count(); i++ )
+    {
+        socket->sendRect64( rects[i] );
         socket->sendEncoding32( 7 ); // Tight
-        socket->sendUint8( ( 1 << 4 ) | ( 1 << 7 ) );
 
-        encoder.encode( image, rect );
+        socket->sendUint8( 0x09 << 4 ); // JpegCompression
 
-        const quint32 length = encoder.encodedData().size();
+        sendCompactLength( encodedData[i].size(), socket );
+        socket->sendByteArray( encodedData[i] );
 
-        // length in compact representation
-        if ( length >= 16384 )
+        lossyRegion += rects[i];
+    }
+
+    socket->flush();
+
+    return lossyRegion;
+}
+
+void RfbPixelStreamer::sendTightFill( QRgb rgb, RfbSocket* socket )
+{
+    const auto& format = m_data->format;
+
+    socket->sendUint8( 0x08 << 4 ); // FillCompression
+
+    QVarLengthArray< char, 4 > pixel( format.tightPixelSize() );
+    format.convertTightBuffer( &rgb, 1, pixel.data() );
+
+    socket->sendScanLine8( pixel.constData(), pixel.size() );
+}
+
+void RfbPixelStreamer::sendTightPalette( const QImage& image, const QRect& rect,
+    const QVector< QRgb >& palette, int compressionLevel, RfbSocket* socket )
+{
+    const auto& format = m_data->format;
+
+    /*
+        Each rectangle starts with a new zlib stream, so that we can
+        use qCompress instead of maintaining the streams of the viewer
+     */
+    const int stream = 1;
+
+    socket->sendUint8( ( 1 << stream ) | ( stream << 4 ) | ( 1 << 6 ) );
+    socket->sendUint8( 1 ); // PaletteFilter
+    socket->sendUint8( palette.count() - 1 );
+
+    QVarLengthArray< char, maxPaletteSize * 4 > colors( palette.count() * format.tightPixelSize() );
+    format.convertTightBuffer( palette.constData(), palette.count(), colors.data() );
+
+    socket->sendScanLine8( colors.constData(), colors.size() );
+
+    // 2 colors: 1 bit per pixel, otherwise 1 byte per pixel
+    const bool mono = ( palette.count() == 2 );
+    const int lineSize = mono ? ( rect.width() + 7 ) / 8 : rect.width();
+
+    QByteArray data( lineSize * rect.height(), 0 );
+    auto out = reinterpret_cast< quint8* >( data.data() );
+
+    for ( int y = rect.top(); y <= rect.bottom(); y++ )
+    {
+        auto line = reinterpret_cast< const QRgb* >( image.constScanLine( y ) ) + rect.x();
+
+        QRgb previous = 0;
+        int index = 0;
+
+        for ( int x = 0; x < rect.width(); x++ )
         {
-            socket->sendUint8( ( length & 0x7f ) | ( 1 << 7 ) );
-            socket->sendUint8( ( ( length >> 7 ) & 0x7f ) | ( 1 << 7 ) );
-            socket->sendUint8( length >> 14 );
+            const auto rgb = line[x] | 0xff000000;
+
+            if ( x == 0 || rgb != previous )
+            {
+                index = palette.indexOf( rgb );
+                previous = rgb;
+            }
+
+            if ( mono )
+                out[ x / 8 ] |= index << ( 7 - ( x % 8 ) );
+            else
+                out[x] = index;
         }
-        else if ( length >= 128 )
+
+        out += lineSize;
+    }
+
+    sendTightData( data, compressionLevel, socket );
+}
+
+void RfbPixelStreamer::sendTightCopy( const QImage& image,
+    const QRect& rect, int compressionLevel, RfbSocket* socket )
+{
+    const auto& format = m_data->format;
+
+    const int stream = 0;
+    socket->sendUint8( ( 1 << stream ) | ( stream << 4 ) ); // BasicCompression, CopyFilter
+
+    const int lineSize = rect.width() * format.tightPixelSize();
+
+    QByteArray data( lineSize * rect.height(), Qt::Uninitialized );
+    auto out = data.data();
+
+    for ( int y = rect.top(); y <= rect.bottom(); y++ )
+    {
+        auto line = reinterpret_cast< const QRgb* >( image.constScanLine( y ) ) + rect.x();
+        format.convertTightBuffer( line, rect.width(), out );
+
+        out += lineSize;
+    }
+
+    sendTightData( data, compressionLevel, socket );
+}
+
+bool RfbPixelStreamer::sendTightJPEG( const QImage& image,
+    const QRect& rect, RfbSocket* socket )
+{
+    auto& encoder = m_data->encoder;
+
+    // a JPEG rectangle without data would be a protocol error
+    if ( !encoder.encode( image, rect ) )
+        return false;
+
+    socket->sendUint8( 0x09 << 4 ); // JpegCompression
+
+    sendCompactLength( encoder.encodedData().size(), socket );
+    socket->sendByteArray( encoder.encodedData() );
+
+    return true;
+}
+
+void RfbPixelStreamer::sendTightData(
+    const QByteArray& data, int compressionLevel, RfbSocket* socket )
+{
+    if ( data.size() < 12 )
+    {
+        // small data is sent uncompressed, without length
+        socket->sendByteArray( data );
+        return;
+    }
+
+    // qCompress prepends the uncompressed size ( 4 bytes ) to the zlib stream
+    const auto compressed = qCompress( data, compressionLevel );
+    const int headerSize = 4;
+
+    const quint32 length = compressed.size() - headerSize;
+
+    sendCompactLength( length, socket );
+    socket->sendScanLine8( compressed.constData() + headerSize, length );
+}
+
+void RfbPixelStreamer::sendCursor(
+    const QPoint& pos, const QImage& cursor, RfbSocket* socket )
+{
+    if ( cursor.cacheKey() != m_data->cursorKey )
+    {
+        // converting the image only once for each shape
+
+        const auto& format = m_data->format;
+
+        const auto image = cursor.convertToFormat( QImage::Format_RGB32 );
+        const int lineSize = image.width() * format.bytesPerPixel();
+
+        const auto mask = cursor.createAlphaMask().convertToFormat( QImage::Format_Mono );
+        const int maskLineSize = ( mask.width() + 7 ) / 8;
+
+        auto& data = m_data->cursorData;
+        data.resize( image.height() * ( lineSize + maskLineSize ) );
+
+        auto out = data.data();
+
+        for ( int i = 0; i < image.height(); i++ )
         {
-            socket->sendUint8( ( length & 0x7f ) | ( 1 << 7 ) );
-            socket->sendUint8( length >> 7 );
+            format.convertBuffer( reinterpret_cast< const QRgb* >( image.constScanLine( i ) ),
+                image.width(), out );
+
+            out += lineSize;
         }
-        else
+
+        for ( int i = 0; i < mask.height(); i++ )
         {
-            socket->sendUint8( length );
+            memcpy( out, mask.constScanLine( i ), maskLineSize );
+            out += maskLineSize;
         }
 
-        socket->sendByteArray( encoder.encodedData() );
+        m_data->cursorKey = cursor.cacheKey();
     }
 
-    encoder.release();
+    socket->sendUint8( 0 );
+    socket->sendPadding( 1 );
+
+    socket->sendUint16( 1 ); // number of rectangles
+    socket->sendRect64( pos, cursor.size() );
+
+    socket->sendEncoding32( -239 ); // Cursor
+    socket->sendByteArray( m_data->cursorData );
 
     socket->flush();
 }
 
-void RfbPixelStreamer::sendCursor(
+void RfbPixelStreamer::sendCursorWithAlpha(
     const QPoint& pos, const QImage& cursor, RfbSocket* socket )
 {
+    // the server has already converted the image to RGBA, premultiplied
+    Q_ASSERT( cursor.format() == QImage::Format_RGBA8888_Premultiplied );
+
     socket->sendUint8( 0 );
     socket->sendPadding( 1 );
 
     socket->sendUint16( 1 ); // number of rectangles
     socket->sendRect64( pos, cursor.size() );
 
-    socket->sendEncoding32( -239 ); // Cursor
+    socket->sendEncoding32( -314 ); // CursorWithAlpha
+    socket->sendEncoding32( 0 ); // Raw
 
+    const int lineSize = cursor.width() * 4;
+    for ( int i = 0; i < cursor.height(); i++ )
     {
-        const auto image = cursor.convertToFormat( QImage::Format_RGB32 );
-
-        const QRect r( 0, 0, image.width(), image.height() );
-        sendImageData( image, r, socket );
+        socket->sendScanLine8(
+            reinterpret_cast< const char* >( cursor.constScanLine( i ) ), lineSize );
     }
 
-    {
-        const auto mask = cursor.createAlphaMask();
-        const auto bitmap = mask.convertToFormat( QImage::Format_Mono );
-
-        const int width = ( bitmap.width() + 7 ) / 8;
-        for ( int i = 0; i < bitmap.height(); ++i )
-            socket->sendScanLine8( reinterpret_cast<const char*>( bitmap.scanLine(i) ), width );
-    }
+    socket->flush();
 }
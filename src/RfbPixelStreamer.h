@@ -6,12 +6,15 @@
 #pragma once
 
 #include <qvector.h>
+#include <qrgb.h>
 #include <memory>
 
 class RfbSocket;
+class RfbYuvImage;
 class QImage;
 class QRect;
 class QPoint;
+class QRegion;
 
 class RfbPixelStreamer
 {
@@ -22,10 +25,29 @@ class RfbPixelStreamer
     void sendImageRaw( const QImage&,
         const QVector< QRect >&, RfbSocket* );
 
-    void sendImageJPEG( const QImage&,
-        const QVector< QRect >&, int qualityLevel, RfbSocket* );
+    /*
+        Tight encoding, where the best compression is selected for each tile.
+        JPEG is not used, when qualityLevel < 0.
+
+        Returns the parts, that have been sent lossy
+     */
+    QRegion sendImageTight( const QImage&, const QVector< QRect >&,
+        int qualityLevel, int compressionLevel, RfbSocket* );
+
+    /*
+        Sending planes, that have been converted to YCbCr on the GPU,
+        as one Tight JPEG rectangle at pos. Needs libjpeg and a
+        pixel format with more than 8 bits.
+
+        Returns the parts, that have been sent: an empty region
+        indicates, that encoding the planes has failed.
+     */
+    bool canSendYuv() const;
+    QRegion sendImageYuv( const RfbYuvImage&, const QPoint& pos,
+        int qualityLevel, RfbSocket* );
 
     void sendCursor( const QPoint&, const QImage&, RfbSocket* );
+    void sendCursorWithAlpha( const QPoint&, const QImage&, RfbSocket* );
 
     void sendServerFormat( RfbSocket* );
     void receiveClientFormat( RfbSocket* );
@@ -33,6 +55,14 @@ class RfbPixelStreamer
   private:
     void sendImageData( const QImage&, const QRect&, RfbSocket* );
 
+    void sendTightFill( QRgb, RfbSocket* );
+    void sendTightPalette( const QImage&, const QRect&,
+        const QVector< QRgb >& palette, int compressionLevel, RfbSocket* );
+    void sendTightCopy( const QImage&, const QRect&, int compressionLevel, RfbSocket* );
+    bool sendTightJPEG( const QImage&, const QRect&, RfbSocket* );
+
+    void sendTightData( const QByteArray&, int compressionLevel, RfbSocket* );
+
   private:
     Q_DISABLE_COPY( RfbPixelStreamer )
 
@@ -4,41 +4,56 @@
  *****************************************************************************/
 
 #include "RfbSocket.h"
+#include "RfbWebSocket.h"
+
 #include <qtcpsocket.h>
+#include <qlocalsocket.h>
 #include <qrect.h>
 #include <qendian.h>
 
-void RfbSocket::open( QTcpSocket* tcpSocket )
+void RfbSocket::open( QIODevice* device )
 {
-    m_tcpSocket = tcpSocket;
+    m_device = device;
 }
 
 void RfbSocket::close()
 {
-    delete m_tcpSocket;
+    delete m_device;
 }
 
 void RfbSocket::flush()
 {
-    if ( m_tcpSocket && m_tcpSocket->isOpen() )
-        m_tcpSocket->flush();
+    if ( m_device && m_device->isOpen() )
+    {
+        if ( auto webSocket = qobject_cast< RfbWebSocket* >( m_device.data() ) )
+            webSocket->flush();
+        else if ( auto tcpSocket = qobject_cast< QTcpSocket* >( m_device.data() ) )
+            tcpSocket->flush();
+        else if ( auto localSocket = qobject_cast< QLocalSocket* >( m_device.data() ) )
+            localSocket->flush();
+    }
 }
 
 qint64 RfbSocket::bytesAvailable() const
 {
-    return m_tcpSocket ? m_tcpSocket->bytesAvailable() : 0;
+    return m_device ? m_device->bytesAvailable() : 0;
+}
+
+qint64 RfbSocket::bytesToWrite() const
+{
+    return m_device ? m_device->bytesToWrite() : 0;
 }
 
 void RfbSocket::sendBytes( const void* data, qint64 count )
 {
-    if ( m_tcpSocket && m_tcpSocket->isOpen() )
-        m_tcpSocket->write( reinterpret_cast< const char* >( data ), count );
+    if ( m_device && m_device->isOpen() )
+        m_device->write( reinterpret_cast< const char* >( data ), count );
 }
 
 qint64 RfbSocket::readBytes( void* data, qint64 count )
 {
-    if ( m_tcpSocket )
-        return m_tcpSocket->read( reinterpret_cast< char* >( data ), count );
+    if ( m_device )
+        return m_device->read( reinterpret_cast< char* >( data ), count );
 
     memset( data, 0, count );
     return -1;
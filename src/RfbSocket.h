@@ -10,12 +10,13 @@
 #include <QRect>
 #include <QByteArray>
 
-class QTcpSocket;
+class QIODevice;
 
 class RfbSocket
 {
   public:
-    void open( QTcpSocket* );
+    // QTcpSocket, QLocalSocket or RfbWebSocket
+    void open( QIODevice* );
     void close();
 
     void sendEncoding32( qint32 );
@@ -49,11 +50,12 @@ class RfbSocket
     QRect readRect64();
 
     qint64 bytesAvailable() const;
+    qint64 bytesToWrite() const;
     void flush();
 
   private:
     void sendBytes( const void*, qint64 count );
     qint64 readBytes( void*, qint64 count );
 
-    QPointer< QTcpSocket > m_tcpSocket;
+    QPointer< QIODevice > m_device;
 };
@@ -0,0 +1,378 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "RfbWebSocket.h"
+
+#include <qtcpsocket.h>
+#include <qcryptographichash.h>
+#include <qendian.h>
+#include <qloggingcategory.h>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY( logWebSocket, "vnceglfs.websocket", QtCriticalMsg )
+
+namespace
+{
+    enum OpCode
+    {
+        Continuation = 0x0,
+        Text = 0x1,
+        Binary = 0x2,
+        Close = 0x8,
+        Ping = 0x9,
+        Pong = 0xa
+    };
+
+    const int maxHeaderSize = 10;
+
+    // limits to protect against broken or malicious clients
+    const int maxRequestSize = 8 * 1024;
+    const quint64 maxFrameSize = 64 * 1024 * 1024;
+
+    // large updates are split, so that the viewer can start decoding
+    const int maxFramePayload = 256 * 1024;
+
+    inline int headerSize( qint64 length )
+    {
+        if ( length < 126 )
+            return 2;
+
+        return ( length <= 0xffff ) ? 4 : 10;
+    }
+
+    void writeHeader( uchar* header, int opCode, qint64 length )
+    {
+        header[0] = 0x80 | opCode; // FIN
+
+        if ( length < 126 )
+        {
+            header[1] = static_cast< uchar >( length );
+        }
+        else if ( length <= 0xffff )
+        {
+            header[1] = 126;
+            qToBigEndian< quint16 >( length, header + 2 );
+        }
+        else
+        {
+            header[1] = 127;
+            qToBigEndian< quint64 >( length, header + 2 );
+        }
+    }
+
+    void unmask( char* data, qint64 length, const uchar mask[4] )
+    {
+        /*
+            XOR-ing 8 bytes at a time, what the compiler turns into
+            SIMD instructions. The mask is repeated in memory order,
+            so the result does not depend on the byte order of the CPU.
+         */
+        quint32 mask32;
+        memcpy( &mask32, mask, 4 );
+
+        const quint64 mask64 = ( quint64( mask32 ) << 32 ) | mask32;
+
+        qint64 i = 0;
+
+        for ( ; i + 8 <= length; i += 8 )
+        {
+            quint64 value;
+            memcpy( &value, data + i, 8 );
+
+            value ^= mask64;
+            memcpy( data + i, &value, 8 );
+        }
+
+        for ( ; i < length; i++ )
+            data[i] ^= mask[ i % 4 ];
+    }
+}
+
+RfbWebSocket::RfbWebSocket( QTcpSocket* socket, QObject* parent )
+    : QIODevice( parent )
+    , m_socket( socket )
+{
+    m_socket->setParent( this );
+
+    connect( m_socket, &QTcpSocket::readyRead, this, &RfbWebSocket::readSocket );
+    connect( m_socket, &QTcpSocket::disconnected, this, &RfbWebSocket::disconnected );
+
+    QIODevice::open( QIODevice::ReadWrite | QIODevice::Unbuffered );
+}
+
+RfbWebSocket::~RfbWebSocket()
+{
+}
+
+bool RfbWebSocket::isSequential() const
+{
+    return true;
+}
+
+qint64 RfbWebSocket::bytesAvailable() const
+{
+    return m_payload.size() + QIODevice::bytesAvailable();
+}
+
+qint64 RfbWebSocket::bytesToWrite() const
+{
+    const auto pending = qMax( qint64( m_output.size() ) - maxHeaderSize, qint64( 0 ) );
+    return pending + m_socket->bytesToWrite();
+}
+
+bool RfbWebSocket::flush()
+{
+    const qint64 length = qint64( m_output.size() ) - maxHeaderSize;
+
+    if ( m_state == Connected && length > 0 )
+    {
+        /*
+            The header is written into the space in front of the payload,
+            so that the frame goes to the socket in one piece without
+            copying the payload again.
+         */
+        const auto size = headerSize( length );
+
+        auto header = reinterpret_cast< uchar* >( m_output.data() ) + maxHeaderSize - size;
+        writeHeader( header, Binary, length );
+
+        m_socket->write( reinterpret_cast< const char* >( header ), size + length );
+
+        m_output.resize( maxHeaderSize ); // keeping the capacity
+    }
+
+    return m_socket->flush();
+}
+
+qint64 RfbWebSocket::readData( char* data, qint64 maxSize )
+{
+    const auto count = qMin( maxSize, qint64( m_payload.size() ) );
+
+    memcpy( data, m_payload.constData(), count );
+    m_payload.remove( 0, int( count ) );
+
+    return count;
+}
+
+qint64 RfbWebSocket::writeData( const char* data, qint64 size )
+{
+    if ( m_state == Closed )
+        return -1;
+
+    if ( m_output.isEmpty() )
+        m_output.resize( maxHeaderSize );
+
+    m_output.append( data, int( size ) );
+
+    if ( m_output.size() - maxHeaderSize >= maxFramePayload )
+        flush();
+
+    return size;
+}
+
+void RfbWebSocket::readSocket()
+{
+    m_input += m_socket->readAll();
+
+    if ( m_state == Handshake && !readHandshake() )
+        return;
+
+    const auto size = m_payload.size();
+
+    while ( m_state == Connected && readFrame() )
+        ;
+
+    if ( m_payload.size() > size )
+        Q_EMIT readyRead();
+
+    // all responses to the client messages go into one frame
+    flush();
+}
+
+bool RfbWebSocket::readHandshake()
+{
+    const auto end = m_input.indexOf( "\r\n\r\n" );
+    if ( end < 0 )
+    {
+        if ( m_input.size() > maxRequestSize )
+            abort();
+
+        return false;
+    }
+
+    const auto lines = m_input.left( end ).split( '\n' );
+    m_input.remove( 0, end + 4 );
+
+    QByteArray key;
+    bool binaryProtocol = false;
+
+    for ( int i = 1; i < lines.count(); i++ )
+    {
+        const auto& line = lines[i];
+
+        const auto pos = line.indexOf( ':' );
+        if ( pos <= 0 )
+            continue;
+
+        const auto name = line.left( pos ).trimmed().toLower();
+        const auto value = line.mid( pos + 1 ).trimmed();
+
+        if ( name == "sec-websocket-key" )
+        {
+            key = value;
+        }
+        else if ( name == "sec-websocket-protocol" )
+        {
+            // older versions of noVNC insist on the "binary" subprotocol
+            const auto protocols = value.split( ',' );
+            for ( const auto& protocol : protocols )
+            {
+                if ( protocol.trimmed() == "binary" )
+                    binaryProtocol = true;
+            }
+        }
+    }
+
+    if ( !lines.first().startsWith( "GET " ) || key.isEmpty() )
+    {
+        qCWarning( logWebSocket ) << "Invalid upgrade request:" << lines.first();
+
+        m_socket->write( "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n" );
+        abort();
+
+        return false;
+    }
+
+    const QByteArray guid( "258EAFA5-E914-47DA-95CA-C5AB0DC85B11" );
+    const auto accept = QCryptographicHash::hash(
+        key + guid, QCryptographicHash::Sha1 ).toBase64();
+
+    QByteArray response( "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\nConnection: Upgrade\r\n" );
+
+    response += "Sec-WebSocket-Accept: " + accept + "\r\n";
+
+    if ( binaryProtocol )
+        response += "Sec-WebSocket-Protocol: binary\r\n";
+
+    response += "\r\n";
+
+    m_socket->write( response );
+    m_socket->flush();
+
+    m_state = Connected;
+    qCDebug( logWebSocket ) << "Upgrade accepted";
+
+    Q_EMIT connected();
+
+    return true;
+}
+
+bool RfbWebSocket::readFrame()
+{
+    const auto data = reinterpret_cast< const uchar* >( m_input.constData() );
+    const qint64 available = m_input.size();
+
+    if ( available < 2 )
+        return false;
+
+    const int opCode = data[0] & 0x0f;
+    const bool masked = data[1] & 0x80;
+
+    quint64 length = data[1] & 0x7f;
+    int size = 2;
+
+    if ( length == 126 )
+    {
+        if ( available < 4 )
+            return false;
+
+        length = qFromBigEndian< quint16 >( data + 2 );
+        size = 4;
+    }
+    else if ( length == 127 )
+    {
+        if ( available < 10 )
+            return false;
+
+        length = qFromBigEndian< quint64 >( data + 2 );
+        size = 10;
+    }
+
+    if ( !masked || length > maxFrameSize )
+    {
+        // frames from clients have to be masked
+        qCWarning( logWebSocket ) << "Invalid frame:" << opCode << length;
+
+        abort();
+        return false;
+    }
+
+    const qint64 frameSize = size + 4 + qint64( length );
+    if ( available < frameSize )
+        return false;
+
+    uchar mask[4];
+    memcpy( mask, data + size, 4 );
+
+    auto payload = m_input.data() + size + 4;
+    unmask( payload, length, mask );
+
+    switch ( opCode )
+    {
+        case Continuation:
+        case Text:
+        case Binary:
+        {
+            // RFB is a stream: frame boundaries are irrelevant
+            m_payload.append( payload, int( length ) );
+            break;
+        }
+        case Ping:
+        {
+            sendControlFrame( Pong, QByteArray( payload, int( length ) ) );
+            break;
+        }
+        case Close:
+        {
+            // echoing the status code
+            sendControlFrame( Close, QByteArray( payload, qMin( int( length ), 2 ) ) );
+            abort();
+
+            return false;
+        }
+        default:
+            break;
+    }
+
+    m_input.remove( 0, int( frameSize ) );
+    return true;
+}
+
+void RfbWebSocket::sendControlFrame( int opCode, const QByteArray& payload )
+{
+    // control frames must not exceed 125 bytes and are never fragmented
+    const auto data = payload.left( 125 );
+
+    uchar header[2];
+    writeHeader( header, opCode, data.size() );
+
+    m_socket->write( reinterpret_cast< const char* >( header ), 2 );
+    m_socket->write( data );
+}
+
+void RfbWebSocket::abort()
+{
+    m_state = Closed;
+
+    m_input.clear();
+    m_output.clear();
+
+    // pending data like the close frame is still sent
+    m_socket->disconnectFromHost();
+}
+
+#include "moc_RfbWebSocket.cpp"
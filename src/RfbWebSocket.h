@@ -0,0 +1,71 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qiodevice.h>
+#include <qbytearray.h>
+
+class QTcpSocket;
+
+/*
+    RFC 6455 transport for browser based viewers like noVNC, that
+    can't open plain TCP connections.
+
+    After the HTTP upgrade the RFB stream is tunneled through binary
+    frames. Everything being written in between 2 calls of flush()
+    is sent as one frame.
+ */
+class RfbWebSocket final : public QIODevice
+{
+    Q_OBJECT
+
+  public:
+    // the socket is taken over as child
+    RfbWebSocket( QTcpSocket*, QObject* parent = nullptr );
+    ~RfbWebSocket() override;
+
+    bool isSequential() const override;
+
+    qint64 bytesAvailable() const override;
+    qint64 bytesToWrite() const override;
+
+    bool flush();
+
+  Q_SIGNALS:
+    // the upgrade has been accepted and the RFB protocol can start
+    void connected();
+    void disconnected();
+
+  protected:
+    qint64 readData( char*, qint64 maxSize ) override;
+    qint64 writeData( const char*, qint64 size ) override;
+
+  private:
+    void readSocket();
+
+    bool readHandshake();
+    bool readFrame();
+
+    void sendControlFrame( int opCode, const QByteArray& );
+    void abort();
+
+    QTcpSocket* m_socket;
+
+    enum State
+    {
+        Handshake,
+        Connected,
+        Closed
+    };
+
+    State m_state = Handshake;
+
+    QByteArray m_input;   // received, but not yet decoded
+    QByteArray m_payload; // decoded RFB stream
+
+    // header space is reserved in front of the payload
+    QByteArray m_output;
+};
@@ -7,19 +7,28 @@
 #include "VncServer.h"
 
 #include "RfbSocket.h"
-#include "RfbInputEventHandler.h"
+#include "RfbWebSocket.h"
+#include "RfbInputEventQueue.h"
 #include "RfbPixelStreamer.h"
 #include "VncNamespace.h"
+#include "VncScaler.h"
+#include "VncEncodeStage.h"
+#include "VncCpuGovernor.h"
 
 #include <qtcpsocket.h>
+#include <qlocalsocket.h>
 
 #include <qcoreapplication.h>
 #include <qendian.h>
 #include <qmetaobject.h>
+#include <qmath.h>
 #if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
 #include <qrandom.h>
 #endif
 #include <qtimer.h>
+#include <qelapsedtimer.h>
+#include <qmutex.h>
+#include <qregion.h>
 #include <qvarlengtharray.h>
 #include <qwindow.h>
 
@@ -251,7 +260,53 @@ class VncClient::PrivateData
   public:
     PrivateData( VncServer* server )
         : server( server )
+        , encodeStage( &pixelStreamer )
     {
+        divisor = qRound( 1.0 / Vnc::scaleFactor() );
+        scaler.setDivisor( divisor );
+
+        server->addScaleLevel( scaler.divisor() );
+    }
+
+    ~PrivateData()
+    {
+        setYuvCapable( false );
+        server->removeScaleLevel( scaler.divisor() );
+    }
+
+    void setScaleDivisor( int divisor )
+    {
+        const int oldDivisor = scaler.divisor();
+        scaler.setDivisor( divisor );
+
+        if ( scaler.divisor() != oldDivisor )
+        {
+            // the server might downscale on the GPU for us
+            server->removeScaleLevel( oldDivisor );
+            server->addScaleLevel( scaler.divisor() );
+        }
+
+        updateYuvCapability();
+    }
+
+    void updateYuvCapability()
+    {
+        // the planes are sent as JPEG in full resolution
+        setYuvCapable( tightEnabled && !localTransport && ( jpegLevel >= 0 )
+            && pixelStreamer.canSendYuv() && ( scaler.divisor() == 1 ) );
+    }
+
+    void setYuvCapable( bool on )
+    {
+        if ( on != yuvCapable )
+        {
+            yuvCapable = on;
+
+            if ( on )
+                server->addYuvClient();
+            else
+                server->removeYuvClient();
+        }
     }
 
     QWindow* window() const
@@ -263,16 +318,33 @@ class VncClient::PrivateData
 
     RfbSocket socket;
     RfbPixelStreamer pixelStreamer;
+    RfbInputEventQueue inputQueue;
+    VncScaler scaler;
+
+    // requested divisor, the governor might scale down further
+    int divisor = 1;
+
+    // encoding the next frame, while the previous one is sent
+    VncEncodeStage encodeStage;
+
+    // Cursor or CursorWithAlpha, whatever comes first in encodings
+    qint32 cursorEncoding = 0;
+    qint64 cursorKey = 0;
 
-    bool cursorEnabled = false;
     bool screenResizable = false;
+    bool extendedDesktopSize = false;
 
     int state = -1;
 
     int messageType = -1;
     int pendingBytes = 0;
 
+    // what has been sent to the viewer: scaled size, unscaled layout
     QSize frameBufferSize;
+    QVector< QRect > screenLayout;
+
+    // from the last SetDesktopSize message
+    QSize requestedSize;
 
     // supported encodings in order of preference
     QVector< qint32 > encodings;
@@ -280,35 +352,98 @@ class VncClient::PrivateData
     bool tightEnabled = false;
     int jpegLevel = -1;
 
+    // on local sockets Raw is cheaper than compressing
+    bool localTransport = false;
+
+    // zlib level for the Tight encoding
+    int compressionLevel = 1;
+
+    // accepting frames, that have been converted to YCbCr on the GPU
+    bool yuvCapable = false;
+
+    // parts of the frame buffer, that have been sent as JPEG
+    QRegion lossyRegion;
+    QElapsedTimer lossyTimer;
+    int refreshDelay = 0;
+
     bool frameRequested = false;
-    bool frameDirty = true;
+
+    // limiting the frame rate, when the CPU budget is exceeded
+    QElapsedTimer encodeTimer;
+
+    // the last time a frame has been requested from the server
+    QElapsedTimer requestTimer;
+
+    // modified from the scene graph thread
+    QMutex dirtyMutex;
+    QRegion dirtyRegion;
 
     QTimer updateTimer;
 
     QByteArray challenge;
 };
 
-VncClient::VncClient( qintptr socketDescriptor, VncServer* server )
+VncClient::VncClient( qintptr socketDescriptor,
+        VncListener::Transport transport, VncServer* server )
     : m_data( new PrivateData( server ) )
 {
-    auto socket = new QTcpSocket( this );
-    socket->setSocketDescriptor( socketDescriptor );
+    m_data->updateTimer.setInterval( Vnc::timerInterval() );
+    m_data->refreshDelay = Vnc::losslessRefreshDelay();
+    connect( &m_data->updateTimer, &QTimer::timeout, this, &VncClient::maybeSendFrameBuffer );
 
-    connect( socket, &QTcpSocket::readyRead, this, &VncClient::processClientData );
-    connect( socket, &QTcpSocket::disconnected, this, &VncClient::disconnected );
-    connect( socket, &QTcpSocket::disconnected, &m_data->updateTimer, &QTimer::stop );
+    // queued: the stage emits from its own thread
+    connect( &m_data->encodeStage, &VncEncodeStage::finished,
+        this, &VncClient::maybeSendFrameBuffer );
 
-    m_data->socket.open( socket );
+    switch( transport )
+    {
+        case VncListener::Local:
+        case VncListener::VSock:
+        {
+            auto socket = new QLocalSocket( this );
+            socket->setSocketDescriptor( socketDescriptor );
 
-    m_data->updateTimer.setInterval( Vnc::timerInterval() );
-    connect( &m_data->updateTimer, &QTimer::timeout, this, &VncClient::maybeSendFrameBuffer );
+            connect( socket, &QLocalSocket::readyRead, this, &VncClient::processClientData );
+            connect( socket, &QLocalSocket::disconnected, this, &VncClient::disconnected );
+            connect( socket, &QLocalSocket::disconnected, &m_data->updateTimer, &QTimer::stop );
 
-    // send protocol version
-    const char proto[] = "RFB 003.003\n";
-    m_data->socket.sendString( proto, 12 );
+            m_data->socket.open( socket );
+            m_data->localTransport = true;
 
-    m_data->state = RfbData::Protocol;
-    qCDebug( logRfb ) << "State" << m_data->state;
+            sendProtocolVersion();
+            break;
+        }
+        case VncListener::WebSocket:
+        {
+            auto tcpSocket = new QTcpSocket( this );
+            tcpSocket->setSocketDescriptor( socketDescriptor );
+
+            auto socket = new RfbWebSocket( tcpSocket, this );
+
+            connect( socket, &QIODevice::readyRead, this, &VncClient::processClientData );
+            connect( socket, &RfbWebSocket::disconnected, this, &VncClient::disconnected );
+            connect( socket, &RfbWebSocket::disconnected, &m_data->updateTimer, &QTimer::stop );
+
+            // the RFB protocol starts after the HTTP upgrade
+            connect( socket, &RfbWebSocket::connected, this, &VncClient::sendProtocolVersion );
+
+            m_data->socket.open( socket );
+            break;
+        }
+        default:
+        {
+            auto socket = new QTcpSocket( this );
+            socket->setSocketDescriptor( socketDescriptor );
+
+            connect( socket, &QTcpSocket::readyRead, this, &VncClient::processClientData );
+            connect( socket, &QTcpSocket::disconnected, this, &VncClient::disconnected );
+            connect( socket, &QTcpSocket::disconnected, &m_data->updateTimer, &QTimer::stop );
+
+            m_data->socket.open( socket );
+
+            sendProtocolVersion();
+        }
+    }
 }
 
 VncClient::~VncClient()
@@ -316,6 +451,16 @@ VncClient::~VncClient()
     m_data->socket.close();
 }
 
+void VncClient::sendProtocolVersion()
+{
+    const char proto[] = "RFB 003.003\n";
+    m_data->socket.sendString( proto, 12 );
+    m_data->socket.flush();
+
+    m_data->state = RfbData::Protocol;
+    qCDebug( logRfb ) << "State" << m_data->state;
+}
+
 void VncClient::setTimerInterval( int ms )
 {
     m_data->updateTimer.setInterval( ms );
@@ -328,16 +473,22 @@ int VncClient::timerInterval() const
 
 void VncClient::markDirty()
 {
-    if ( m_data->frameDirty == false )
-    {
+    markDirty( QRect( QPoint(), m_data->server->frameBufferSize() ) );
+}
+
+void VncClient::markDirty( const QRegion& region )
+{
+    QMutexLocker locker( &m_data->dirtyMutex );
+
+    if ( m_data->dirtyRegion.isEmpty() )
         qCDebug( logFb ) << "FB dirty";
-        m_data->frameDirty = true;
-    }
+
+    m_data->dirtyRegion += region;
 }
 
 void VncClient::processClientData()
 {
-    if ( m_data->window() == nullptr )
+    if ( m_data->window() == nullptr && !m_data->server->isSubscribed() )
         return;
 
     auto socket = &m_data->socket;
@@ -419,7 +570,8 @@ void VncClient::processClientData()
 
             // 6.3.2 ServerInit
 
-            socket->sendSize32( m_data->window()->size() );
+            socket->sendSize32(
+                m_data->scaler.scaledSize( m_data->server->frameBufferSize() ) );
             m_data->pixelStreamer.sendServerFormat( socket );
 
             auto name = Vnc::name().toUtf8();
@@ -445,7 +597,8 @@ void VncClient::processClientData()
             FramebufferUpdateRequest = 3,
             KeyEvent = 4,
             PointerEvent = 5,
-            ClientCutText = 6
+            ClientCutText = 6,
+            SetDesktopSize = 251
         };
 
         do
@@ -481,6 +634,10 @@ void VncClient::processClientData()
                     done = handleClientCutText();
                     break;
 
+                case SetDesktopSize:
+                    done = handleSetDesktopSize();
+                    break;
+
                 case FixColourMapEntries:
                     done = true; // ignored
                     break;
@@ -494,16 +651,86 @@ void VncClient::processClientData()
                 m_data->messageType = -1;
 
         } while ( ( m_data->messageType < 0 ) && socket->bytesAvailable() );
+
+        m_data->inputQueue.flush();
     }
 }
 
+static QVector< QRect > regionRects( const QRegion& region )
+{
+    /*
+        Many small rectangles are more expensive for the encoders
+        and the viewer than sending a couple of unmodified pixels
+     */
+    if ( region.rectCount() > 16 )
+        return { region.boundingRect() };
+
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 8, 0 )
+    QVector< QRect > rects;
+    rects.reserve( region.rectCount() );
+
+    for ( const auto& rect : region )
+        rects += rect;
+
+    return rects;
+#else
+    return region.rects();
+#endif
+}
+
 void VncClient::maybeSendFrameBuffer()
 {
+    const auto governor = VncCpuGovernor::instance();
+
+    auto& scaler = m_data->scaler;
+
+    if ( m_data->screenResizable || m_data->extendedDesktopSize )
+    {
+        // the size of the frame buffer changes: the viewer has to support it
+        const auto divisor = qMax( m_data->divisor, governor->scaleDivisor() );
+        if ( divisor != scaler.divisor() )
+        {
+            m_data->setScaleDivisor( divisor );
+            m_data->lossyRegion = QRegion();
+        }
+    }
+
     const auto fb = m_data->server->frameBuffer();
-    if ( fb.isNull() )
+    const auto fbSize = fb.isNull() ? m_data->server->frameBufferSize() : fb.size();
+    const auto fbRect = QRect( QPoint(), fbSize );
+
+    const auto size = scaler.scaledSize( fbSize );
+
+    // the server might have downscaled the frame on the GPU
+    auto scaledFb = ( scaler.divisor() > 1 )
+        ? m_data->server->scaledFrameBuffer( scaler.divisor() ) : QImage();
+
+    if ( scaledFb.size() != size )
+        scaledFb = QImage();
+
+    if ( fb.isNull() && scaledFb.isNull() )
+    {
+        maybeRequestFrame();
         return;
+    }
 
-    if ( fb.size() != m_data->frameBufferSize )
+    if ( m_data->extendedDesktopSize )
+    {
+        const auto layout = m_data->server->screenLayout();
+
+        if ( size != m_data->frameBufferSize || layout != m_data->screenLayout )
+        {
+            sendExtendedDesktopSize( size, 0, 0 );
+
+            m_data->frameBufferSize = size;
+            m_data->screenLayout = layout;
+
+            // the encoded frame does not fit to the new size
+            m_data->encodeStage.discard();
+            markDirty( fbRect );
+        }
+    }
+    else if ( size != m_data->frameBufferSize )
     {
         if ( m_data->screenResizable )
         {
@@ -512,36 +739,267 @@ void VncClient::maybeSendFrameBuffer()
             socket->sendUint8( 0 ); // msg type
             socket->sendPadding( 1 );
             socket->sendUint16( 1 );
-            socket->sendRect64( QPoint(), fb.size() );
+            socket->sendRect64( QPoint(), size );
             socket->sendEncoding32( -223 );
+            socket->flush();
         }
 
-        m_data->frameBufferSize = fb.size();
+        m_data->frameBufferSize = size;
+
+        m_data->encodeStage.discard();
+        markDirty( fbRect );
     }
 
-    if ( !( m_data->frameRequested && m_data->frameDirty ) )
+    if ( m_data->frameRequested )
     {
-        /*
-            Better skip this interval to avoid flooding the client
-            or hogging the network
-         */
+        updateCursor();
+        sendEncodedFrame();
+    }
+
+    auto& stage = m_data->encodeStage;
+
+    if ( stage.isBusy() || stage.hasResult() )
+    {
+        // not more than one frame in flight
         return;
     }
 
-    m_data->frameRequested = m_data->frameDirty = false;
+    const auto minInterval = governor->minFrameInterval();
+    if ( minInterval > 0 && m_data->encodeTimer.isValid()
+        && m_data->encodeTimer.elapsed() < minInterval )
+    {
+        return;
+    }
 
-    const QRect rect( 0, 0, fb.width(), fb.height() );
+    QRegion region;
 
-    auto& streamer = m_data->pixelStreamer;
+    {
+        QMutexLocker locker( &m_data->dirtyMutex );
+
+        region = m_data->dirtyRegion & fbRect;
+        m_data->dirtyRegion = QRegion();
+    }
+
+    // during animations the server might have converted the frame on the GPU
+    QPoint yuvPos;
+    const auto yuv = m_data->server->yuvFrame( yuvPos );
+
+    if ( !yuv.isNull() )
+    {
+        const QRect yuvRect( yuvPos, yuv.size );
+
+        if ( region.intersects( yuvRect ) )
+        {
+            if ( !m_data->yuvCapable )
+            {
+                // waiting for the server to fall back to RGB
+                markDirty( region );
+                maybeRequestFrame();
+
+                return;
+            }
+
+            // the RGB frame buffer is outdated inside of yuvRect
+            markDirty( region - yuvRect );
 
-    if ( m_data->tightEnabled && m_data->jpegLevel >= 0 )
+            VncEncodeStage::Job job;
+            job.yuv = yuv;
+            job.yuvPos = yuvPos;
+            job.rects = { yuvRect };
+            job.region = yuvRect;
+            job.tight = true;
+            job.qualityLevel = qMin( m_data->jpegLevel, governor->maxJpegLevel() );
+
+            m_data->encodeTimer.start();
+            stage.encode( job );
+
+            return;
+        }
+    }
+
+    if ( region.isEmpty() )
     {
-        streamer.sendImageJPEG( fb, { rect }, m_data->jpegLevel, &m_data->socket );
+        QImage image = fb;
+
+        if ( !scaledFb.isNull() )
+            image = scaledFb;
+        else if ( scaler.divisor() > 1 )
+            image = scaler.image();
+
+        // no lossless refresh, before the animation has stopped
+        if ( m_data->frameRequested
+            && !( yuv.isNull() && maybeSendLosslessRefresh( image ) ) )
+        {
+            // waiting for the next frame
+            maybeRequestFrame();
+        }
+
+        return;
     }
-    else
+
+    /*
+        The frame is encoded, even when the viewer has not requested
+        it yet. Then it is ready to be sent, when the request
+        for the next frame arrives.
+     */
+
+    auto rects = regionRects( region );
+    auto image = fb;
+
+    if ( !scaledFb.isNull() )
+    {
+        for ( auto& rect : rects )
+            rect = scaler.scaledRect( rect ) & scaledFb.rect();
+
+        image = scaledFb;
+
+        // the CPU scaled image is outdated now
+        scaler.clear();
+    }
+    else if ( scaler.divisor() > 1 )
+    {
+        // the scaled image is updated for the dirty parts only
+        for ( auto& rect : rects )
+            rect = scaler.update( fb, rect );
+
+        image = scaler.image();
+    }
+
+    VncEncodeStage::Job job;
+    job.image = image;
+    job.rects = rects;
+    job.region = region;
+    job.tight = m_data->tightEnabled && !m_data->localTransport;
+    job.qualityLevel = m_data->jpegLevel;
+    job.compressionLevel = m_data->compressionLevel;
+
+    if ( job.qualityLevel >= 0 )
+        job.qualityLevel = qMin( job.qualityLevel, governor->maxJpegLevel() );
+
+    m_data->encodeTimer.start();
+    stage.encode( job );
+}
+
+bool VncClient::sendEncodedFrame()
+{
+    VncEncodeStage::Result result;
+    if ( !m_data->encodeStage.takeResult( result ) )
+        return false;
+
+    const VncCpuTimer cpuTimer;
+
+    m_data->frameRequested = false;
+
+    m_data->socket.sendByteArray( result.data );
+    m_data->socket.flush();
+
+    for ( const auto& rect : result.rects )
+        m_data->lossyRegion -= rect;
+
+    if ( !result.failedRegion.isEmpty() )
+    {
+        // the viewer is still showing the previous content
+        markDirty( result.failedRegion );
+    }
+
+    if ( !result.lossyRegion.isEmpty() )
+    {
+        m_data->lossyRegion += result.lossyRegion;
+        m_data->lossyTimer.start();
+    }
+
+    /*
+        The next frame is not requested before the viewer asks for it:
+        the readback rate follows the demand of the viewers.
+     */
+    if ( !result.region.isEmpty() )
+        m_data->server->frameSent( result.region );
+
+    return true;
+}
+
+void VncClient::maybeRequestFrame()
+{
+    if ( !m_data->frameRequested )
+        return;
+
+    // limiting the frame rate, when the CPU budget is exceeded
+    const auto minInterval = VncCpuGovernor::instance()->minFrameInterval();
+    if ( minInterval > 0 && m_data->requestTimer.isValid()
+        && m_data->requestTimer.elapsed() < minInterval )
+    {
+        return;
+    }
+
+    m_data->requestTimer.start();
+    m_data->server->requestFrame();
+}
+
+bool VncClient::maybeSendLosslessRefresh( const QImage& image )
+{
+    /*
+        JPEG at low quality levels leaves blurred texts, when an
+        animation has stopped. So we send the parts, that have been
+        sent lossy, again - as soon as nothing has been sent lossy for
+        a while and the connection is idle.
+     */
+
+    if ( m_data->refreshDelay <= 0 || m_data->lossyRegion.isEmpty() )
+        return false;
+
+    if ( m_data->lossyTimer.elapsed() < m_data->refreshDelay )
+        return false;
+
+    if ( m_data->socket.bytesToWrite() > 0 )
+        return false;
+
+    const auto rects = regionRects( m_data->lossyRegion & image.rect() );
+
+    m_data->lossyRegion = QRegion();
+
+    if ( rects.isEmpty() )
+        return false;
+
+    qCDebug( logFb ) << "Lossless refresh:" << rects;
+
+    VncEncodeStage::Job job;
+    job.image = image;
+    job.rects = rects;
+    job.tight = m_data->tightEnabled && !m_data->localTransport;
+    job.qualityLevel = -1;
+    job.compressionLevel = m_data->compressionLevel;
+
+    m_data->encodeStage.encode( job );
+
+    return true;
+}
+
+void VncClient::sendExtendedDesktopSize( const QSize& size, int reason, int status )
+{
+    const auto layout = m_data->server->screenLayout();
+
+    auto socket = &m_data->socket;
+
+    socket->sendUint8( 0 ); // msg type
+    socket->sendPadding( 1 );
+    socket->sendUint16( 1 );
+
+    socket->sendUint16( reason );
+    socket->sendUint16( status );
+    socket->sendSize32( size );
+    socket->sendEncoding32( RfbData::ExtendedDesktopSize );
+
+    socket->sendUint8( layout.count() );
+    socket->sendPadding( 3 );
+
+    for ( int i = 0; i < layout.count(); i++ )
     {
-        streamer.sendImageRaw( fb, { rect }, &m_data->socket );
+        socket->sendUint32( i ); // id
+        socket->sendRect64( m_data->scaler.scaledRect( layout[i] ) );
+        socket->sendUint32( 0 ); // flags
     }
+
+    socket->flush();
 }
 
 bool VncClient::handleSetPixelFormat()
@@ -551,7 +1009,13 @@ bool VncClient::handleSetPixelFormat()
     if ( socket->bytesAvailable() < 19 )
         return false;
 
+    // the stage is reading the format of the streamer
+    m_data->encodeStage.waitForIdle();
+    m_data->encodeStage.discard();
+
     m_data->pixelStreamer.receiveClientFormat( socket );
+    m_data->updateYuvCapability();
+    markDirty();
 
     return true;
 }
@@ -571,37 +1035,72 @@ bool VncClient::handleSetEncodings()
 
         m_data->encodings.clear();
         m_data->tightEnabled = false;
-        m_data->cursorEnabled = false;
+        m_data->cursorEncoding = 0;
+        m_data->cursorKey = 0;
         m_data->screenResizable = false;
+        m_data->extendedDesktopSize = false;
         m_data->jpegLevel = -1;
+        m_data->compressionLevel = 1;
+
+        // the encoded frame might use an encoding, that is not supported anymore
+        m_data->encodeStage.discard();
+        markDirty();
+
+        // the complete frame is sent again with the new encodings
+        m_data->lossyRegion = QRegion();
     }
 
     const auto bytesAvailable = static_cast<unsigned>( socket->bytesAvailable() );
     if ( bytesAvailable < count * sizeof( quint32 ) )
         return false;
 
+    bool hasFrameEncoding = false;
+
     for ( int i = 0; i < count; ++i )
     {
         const qint32 encoding = socket->receiveUint32();
         m_data->encodings += encoding;
 
-        if ( encoding == RfbData::Tight )
+        if ( encoding == RfbData::Raw || encoding == RfbData::Tight )
         {
-            m_data->tightEnabled = true;
+            /*
+                The encodings are in the order of preference: the first one,
+                that we are able to send wins. When the viewer does not
+                list any of them Raw is used, what is always supported.
+             */
+            if ( !hasFrameEncoding )
+            {
+                m_data->tightEnabled = ( encoding == RfbData::Tight );
+                hasFrameEncoding = true;
+            }
         }
-        else if ( encoding == RfbData::Cursor )
+        else if ( encoding == RfbData::Cursor || encoding == RfbData::CursorWithAlpha )
         {
-            m_data->cursorEnabled = true;
-            updateCursor();
+            if ( m_data->cursorEncoding == 0 )
+                m_data->cursorEncoding = encoding;
         }
         else if ( encoding == RfbData::DesktopSize )
         {
             m_data->screenResizable = true;
         }
+        else if ( encoding == RfbData::ExtendedDesktopSize )
+        {
+            /*
+                The viewer expects an ExtendedDesktopSize rectangle
+                as confirmation, so we need to send the layout again
+             */
+            m_data->extendedDesktopSize = true;
+            m_data->screenLayout.clear();
+        }
         else if ( encoding >= -32 && encoding <= -23 )
         {
             m_data->jpegLevel = 32 + encoding;
         }
+        else if ( encoding >= -256 && encoding <= -247 )
+        {
+            // level 0 would be no compression at all
+            m_data->compressionLevel = qMax( 256 + encoding, 1 );
+        }
         else if ( encoding >= -512 && encoding <= -412 )
         {
             // TODO ...
@@ -609,6 +1108,9 @@ bool VncClient::handleSetEncodings()
     }
 
     qCDebug( logRfb ) << "Encodings\n" << m_data->encodings;
+    qCDebug( logRfb ) << "Frame encoding:" << ( m_data->tightEnabled ? "Tight" : "Raw" );
+
+    m_data->updateYuvCapability();
 
     m_data->pendingBytes = 0;
     return true;
@@ -638,6 +1140,10 @@ bool VncClient::handleFrameBufferUpdateRequest()
     {
         m_data->frameRequested = true;
         qCDebug( logFb ) << "FB requested, incremental:" << incremental;
+
+        // a frame might be encoded already
+        if ( !( incremental && sendEncodedFrame() ) )
+            maybeRequestFrame();
     }
 
     if ( !incremental )
@@ -658,8 +1164,18 @@ bool VncClient::handlePointerEvent()
     const auto x = socket->receiveUint16();
     const auto y = socket->receiveUint16();
 
-    if ( auto window = m_data->window() )
-        Rfb::handlePointerEvent( QPoint( x, y ), buttonMask, window );
+    const auto fbPos = m_data->scaler.unscaledPos( QPoint( x, y ) );
+
+    if ( m_data->server->isSubscribed() )
+    {
+        // the windows are in the application process
+        m_data->server->forwardPointerEvent( fbPos, buttonMask );
+        return true;
+    }
+
+    QPointF pos;
+    if ( auto window = m_data->server->windowAt( fbPos, pos ) )
+        m_data->inputQueue.addPointerEvent( window, pos, buttonMask );
 
     return true;
 }
@@ -676,8 +1192,14 @@ bool VncClient::handleKeyEvent()
 
     const quint32 key = socket->receiveUint32();
 
-    if ( auto window = m_data->window() )
-        Rfb::handleKeyEvent( key, down, window );
+    if ( m_data->server->isSubscribed() )
+    {
+        m_data->server->forwardKeyEvent( key, down );
+        return true;
+    }
+
+    if ( auto window = m_data->server->keyboardWindow() )
+        m_data->inputQueue.addKeyEvent( window, key, down );
 
     return true;
 }
@@ -711,14 +1233,102 @@ bool VncClient::handleClientCutText()
     return true;
 }
 
-void VncClient::updateCursor()
+bool VncClient::handleSetDesktopSize()
 {
-    if ( m_data->cursorEnabled )
+    auto socket = &m_data->socket;
+    auto& count = m_data->pendingBytes;
+
+    if ( count == 0 )
+    {
+        if ( socket->bytesAvailable() < 7 )
+            return false;
+
+        socket->receivePadding( 1 );
+        m_data->requestedSize.setWidth( socket->receiveUint16() );
+        m_data->requestedSize.setHeight( socket->receiveUint16() );
+
+        count = socket->receiveUint8();
+        socket->receivePadding( 1 );
+
+        if ( count == 0 )
+            count = -1; // no screens
+    }
+
+    if ( count > 0 )
+    {
+        if ( socket->bytesAvailable() < count * 16 )
+            return false;
+
+        socket->receivePadding( count * 16 );
+    }
+
+    count = 0;
+
+    /*
+        The layout is defined by the windows, but we can offer a downscaled
+        frame buffer, when the viewer asks for a smaller size. The size
+        of the scaled frame buffer does not necessarily match the request.
+     */
+    const auto fbSize = m_data->server->frameBufferSize();
+    const auto& requested = m_data->requestedSize;
+
+    if ( fbSize.isEmpty() || requested.isEmpty() )
     {
-        const auto cursor = m_data->server->cursor();
-        m_data->pixelStreamer.sendCursor(
-            cursor.hotspot, cursor.image, &m_data->socket );
+        // "Invalid screen layout"
+        sendExtendedDesktopSize( m_data->frameBufferSize, 1, 3 );
+        return true;
     }
+
+    int divisor = 1;
+
+    if ( requested.width() < fbSize.width() || requested.height() < fbSize.height() )
+    {
+        const auto fx = double( fbSize.width() ) / requested.width();
+        const auto fy = double( fbSize.height() ) / requested.height();
+
+        divisor = qCeil( qMax( fx, fy ) );
+    }
+
+    m_data->divisor = divisor;
+    m_data->setScaleDivisor( qMax( divisor, VncCpuGovernor::instance()->scaleDivisor() ) );
+
+    auto& scaler = m_data->scaler;
+
+    m_data->lossyRegion = QRegion();
+
+    m_data->frameBufferSize = scaler.scaledSize( fbSize );
+    m_data->screenLayout = m_data->server->screenLayout();
+
+    m_data->encodeStage.discard();
+
+    sendExtendedDesktopSize( m_data->frameBufferSize, 1, 0 );
+    markDirty();
+
+    return true;
+}
+
+void VncClient::updateCursor()
+{
+    if ( m_data->cursorEncoding == 0 )
+        return;
+
+    /*
+        The server creates a new image, whenever the shape
+        of the cursor has changed. So we can use the cacheKey
+        to find out if the viewer already knows the cursor.
+     */
+    const auto cursor = m_data->server->cursor();
+    if ( cursor.image.cacheKey() == m_data->cursorKey )
+        return;
+
+    m_data->cursorKey = cursor.image.cacheKey();
+
+    auto& streamer = m_data->pixelStreamer;
+
+    if ( m_data->cursorEncoding == RfbData::CursorWithAlpha )
+        streamer.sendCursorWithAlpha( cursor.hotspot, cursor.image, &m_data->socket );
+    else
+        streamer.sendCursor( cursor.hotspot, cursor.image, &m_data->socket );
 }
 
 #include "VncClient.moc"
@@ -5,32 +5,42 @@
 
 #pragma once
 
+#include "VncListener.h"
+
 #include <qobject.h>
 #include <memory>
 
 class VncServer;
-class QTcpSocket;
+class QRegion;
+class QSize;
+class QImage;
 
 class VncClient final : public QObject
 {
     Q_OBJECT
 
   public:
-    explicit VncClient( qintptr fd, VncServer* );
+    VncClient( qintptr fd, VncListener::Transport, VncServer* );
     ~VncClient() override;
 
     void setTimerInterval( int ms );
     int timerInterval() const;
 
     void markDirty();
+    void markDirty( const QRegion& );
+
     void updateCursor();
 
   Q_SIGNALS:
     void disconnected();
 
   private:
+    void sendProtocolVersion();
     void processClientData();
     void maybeSendFrameBuffer();
+    bool sendEncodedFrame();
+    void maybeRequestFrame();
+    bool maybeSendLosslessRefresh( const QImage& );
 
     bool handleSetPixelFormat();
     bool handleSetEncodings();
@@ -38,6 +48,9 @@ class VncClient final : public QObject
     bool handlePointerEvent();
     bool handleKeyEvent();
     bool handleClientCutText();
+    bool handleSetDesktopSize();
+
+    void sendExtendedDesktopSize( const QSize&, int reason, int status );
 
   private:
     class PrivateData;
@@ -0,0 +1,183 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncCpuGovernor.h"
+
+#include <qglobalstatic.h>
+#include <qloggingcategory.h>
+
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+Q_LOGGING_CATEGORY( logGovernor, "vnceglfs.governor", QtWarningMsg )
+
+// export QT_LOGGING_RULES="vnceglfs.governor.info=true"
+
+namespace
+{
+    class Restriction
+    {
+      public:
+        int maxJpegLevel;
+        int minFrameInterval;
+        int scaleDivisor;
+    };
+
+    // ordered by how much they hurt the viewer
+    const Restriction restrictions[] =
+    {
+        { 9, 0, 1 },
+        { 6, 0, 1 },
+        { 4, 0, 1 },
+        { 2, 0, 1 },
+        { 2, 100, 1 }, // 10 fps
+        { 2, 200, 1 }, // 5 fps
+        { 2, 200, 2 },
+        { 2, 200, 3 }
+    };
+
+    const int maxLevel = sizeof( restrictions ) / sizeof( restrictions[0] ) - 1;
+
+    // going back needs some time below the budget to avoid oscillation
+    const int calmUpdatesNeeded = 3;
+    const qreal calmLoad = 0.6;
+}
+
+Q_GLOBAL_STATIC( VncCpuGovernor, cpuGovernor )
+
+VncCpuGovernor::VncCpuGovernor()
+{
+    m_clock.start();
+}
+
+VncCpuGovernor* VncCpuGovernor::instance()
+{
+    return cpuGovernor;
+}
+
+qint64 VncCpuGovernor::threadCpuTime()
+{
+#ifdef Q_OS_UNIX
+    struct timespec ts;
+    if ( ::clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) == 0 )
+        return qint64( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+#endif
+
+    return 0;
+}
+
+void VncCpuGovernor::setBudget( int percent )
+{
+    percent = qMax( percent, 0 );
+
+    if ( percent != m_budget.loadAcquire() )
+    {
+        m_budget.storeRelease( percent );
+
+        if ( percent == 0 )
+            m_level.storeRelease( 0 );
+
+        // starting a new measurement
+        m_cpuTime.fetchAndStoreOrdered( 0 );
+        m_clock.restart();
+    }
+}
+
+int VncCpuGovernor::budget() const
+{
+    return m_budget.loadAcquire();
+}
+
+void VncCpuGovernor::addCpuTime( qint64 nsecs )
+{
+    m_cpuTime.fetchAndAddRelaxed( nsecs );
+}
+
+void VncCpuGovernor::update()
+{
+    const int budget = m_budget.loadAcquire();
+
+    const auto elapsed = m_clock.nsecsElapsed();
+    const auto cpuTime = m_cpuTime.fetchAndStoreOrdered( 0 );
+
+    m_clock.restart();
+
+    if ( budget <= 0 || elapsed <= 0 )
+        return;
+
+    // percentage of one core
+    const qreal load = 100.0 * cpuTime / elapsed;
+
+    int level = m_level.loadAcquire();
+    const int oldLevel = level;
+
+    if ( load > budget )
+    {
+        m_calmUpdates = 0;
+        level = qMin( level + 1, maxLevel );
+    }
+    else if ( load < calmLoad * budget )
+    {
+        if ( ++m_calmUpdates >= calmUpdatesNeeded )
+        {
+            m_calmUpdates = 0;
+            level = qMax( level - 1, 0 );
+        }
+    }
+    else
+    {
+        m_calmUpdates = 0;
+    }
+
+    if ( level != oldLevel )
+    {
+        m_level.storeRelease( level );
+
+        const auto& r = restrictions[ level ];
+
+        qCInfo( logGovernor ).nospace() << "CPU: " << qRound( load ) << "% of "
+            << budget << "%, level: " << level << ", max. JPEG level: " << r.maxJpegLevel
+            << ", min. frame interval: " << r.minFrameInterval << "ms"
+            << ", scale: 1/" << r.scaleDivisor;
+    }
+}
+
+int VncCpuGovernor::level() const
+{
+    return m_level.loadAcquire();
+}
+
+int VncCpuGovernor::maxJpegLevel() const
+{
+    return restrictions[ level() ].maxJpegLevel;
+}
+
+int VncCpuGovernor::minFrameInterval() const
+{
+    return restrictions[ level() ].minFrameInterval;
+}
+
+int VncCpuGovernor::scaleDivisor() const
+{
+    return restrictions[ level() ].scaleDivisor;
+}
+
+VncCpuTimer::VncCpuTimer()
+    : m_start( -1 )
+{
+    // reading the clock is a syscall: only when being needed
+    if ( VncCpuGovernor::instance()->budget() > 0 )
+        m_start = VncCpuGovernor::threadCpuTime();
+}
+
+VncCpuTimer::~VncCpuTimer()
+{
+    if ( m_start >= 0 )
+    {
+        VncCpuGovernor::instance()->addCpuTime(
+            VncCpuGovernor::threadCpuTime() - m_start );
+    }
+}
@@ -0,0 +1,73 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qatomic.h>
+#include <qelapsedtimer.h>
+
+/*
+    The costs of VNC grow with the number of viewers, the resolution
+    and the content. To guarantee the application its share of the CPU,
+    the CPU time being spent for grabbing, encoding and sending is
+    measured against a budget for the process - f.e. 25% of one core.
+
+    When exceeding the budget the governor degrades step by step for all
+    servers and clients: lower JPEG quality, then less frames per second,
+    then downscaling. When being below the budget for a while it
+    goes back in the opposite order.
+ */
+class VncCpuGovernor
+{
+  public:
+    VncCpuGovernor();
+
+    static VncCpuGovernor* instance();
+
+    // CPU time of the calling thread in nanoseconds
+    static qint64 threadCpuTime();
+
+    // percentage of one core, 0: unlimited
+    void setBudget( int percent );
+    int budget() const;
+
+    // can be called from any thread
+    void addCpuTime( qint64 nsecs );
+
+    // called periodically from the GUI thread
+    void update();
+
+    int level() const;
+
+    // the restrictions for the current level
+
+    int maxJpegLevel() const;     // [0, 9]
+    int minFrameInterval() const; // ms, 0: unlimited
+    int scaleDivisor() const;     // >= 1
+
+  private:
+    QAtomicInt m_budget;
+    QAtomicInt m_level;
+    QAtomicInteger< qint64 > m_cpuTime;
+
+    QElapsedTimer m_clock;
+    int m_calmUpdates = 0;
+};
+
+/*
+    Adding the CPU time of the calling thread between
+    construction and destruction to the governor.
+ */
+class VncCpuTimer
+{
+  public:
+    VncCpuTimer();
+    ~VncCpuTimer();
+
+  private:
+    Q_DISABLE_COPY( VncCpuTimer )
+
+    qint64 m_start;
+};
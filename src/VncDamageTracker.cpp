@@ -0,0 +1,258 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncDamageTracker.h"
+
+#include <qquickwindow.h>
+#include <qquickitem.h>
+
+#include <private/qquickwindow_p.h>
+#include <private/qquickitem_p.h>
+#include <private/qabstractanimation_p.h>
+
+namespace
+{
+    /*
+        Layers and shader effects might draw beyond the bounding rectangle
+        of the item - f.e. shadows. Their output also changes, when their
+        source items are modified, without being dirty themselves.
+     */
+    bool isEffectItem( QQuickItem* item )
+    {
+        if ( item->inherits( "QQuickShaderEffect" ) )
+            return true;
+
+#if QT_CONFIG( quick_shadereffect )
+        // QQuickItemPrivate::layer() would create the layer on the fly
+        const auto itemPrivate = QQuickItemPrivate::get( item );
+        if ( itemPrivate->extra.isAllocated() )
+        {
+            const auto layer = itemPrivate->extra->layer;
+            return layer && layer->enabled();
+        }
+#endif
+
+        return false;
+    }
+
+    /*
+        Animator jobs ( OpacityAnimator, RotationAnimator ... ) are running
+        in the scene graph thread without modifying the items. With the basic
+        render loop all animations of the GUI thread are counted.
+     */
+    bool hasRunningAnimators()
+    {
+        const auto timer = QUnifiedTimer::instance( false );
+        return timer && timer->runningAnimationCount() > 0;
+    }
+}
+
+VncDamageTracker::VncDamageTracker( QWindow* window )
+    : m_window( static_cast< QQuickWindow* >( window ) )
+{
+    Q_ASSERT( window && window->inherits( "QQuickWindow" ) );
+
+    connect( m_window, &QQuickWindow::colorChanged,
+        this, &VncDamageTracker::invalidate );
+}
+
+VncDamageTracker::~VncDamageTracker()
+{
+    stop();
+}
+
+void VncDamageTracker::start()
+{
+    invalidate();
+
+    if ( !m_connection )
+    {
+        // beforeSynchronizing is from the scene graph thread, while the GUI thread is blocked
+        m_connection = connect( m_window, &QQuickWindow::beforeSynchronizing,
+            this, &VncDamageTracker::collect, Qt::DirectConnection );
+    }
+}
+
+void VncDamageTracker::stop()
+{
+    if ( m_connection )
+        disconnect( m_connection );
+}
+
+void VncDamageTracker::invalidate()
+{
+    QMutexLocker locker( &m_mutex );
+    m_fullDamage = true;
+}
+
+QRegion VncDamageTracker::takeDamage()
+{
+    const QRect windowRect( QPoint(), m_window->size() * m_window->devicePixelRatio() );
+
+    /*
+        The frame, that is rendered after the animators have
+        finished, needs to be updated completely as well.
+     */
+    const bool animating = hasRunningAnimators();
+    const bool animated = animating || m_animating;
+
+    m_animating = animating;
+
+    QMutexLocker locker( &m_mutex );
+
+    QRegion damage;
+
+    if ( m_fullDamage || !m_synchronized || animated )
+    {
+        // frames without synchronizing are f.e triggered by animators
+        damage = windowRect;
+    }
+    else
+    {
+        damage = m_damage & windowRect;
+    }
+
+    m_damage = QRegion();
+    m_fullDamage = false;
+    m_synchronized = false;
+
+    return damage;
+}
+
+void VncDamageTracker::collect()
+{
+    auto windowPrivate = QQuickWindowPrivate::get( m_window );
+
+    bool fullDamage;
+
+    {
+        QMutexLocker locker( &m_mutex );
+
+        fullDamage = m_fullDamage;
+        m_synchronized = true;
+    }
+
+    if ( windowPrivate->dirtyItemList == nullptr )
+    {
+        // rendering has been requested without modifying any item
+        fullDamage = true;
+    }
+
+    if ( m_rects.count() > m_maxRects )
+    {
+        // too many entries of items, that have been deleted in the meantime
+        fullDamage = true;
+    }
+
+    if ( fullDamage )
+    {
+        m_rects.clear();
+        m_effectRects.clear();
+
+        updateSubtreeRect( m_window->contentItem() );
+
+        m_maxRects = 2 * m_rects.count() + 256;
+
+        QMutexLocker locker( &m_mutex );
+        m_fullDamage = true;
+
+        return;
+    }
+
+    const auto ratio = m_window->devicePixelRatio();
+
+    QRegion damage;
+
+    // the effects might depend on any of the dirty items
+    for ( auto it = m_effectRects.constBegin(); it != m_effectRects.constEnd(); ++it )
+    {
+        const auto& rect = it.value();
+        if ( !rect.isEmpty() )
+        {
+            const QRectF scaledRect( rect.topLeft() * ratio, rect.size() * ratio );
+            damage += scaledRect.toAlignedRect().adjusted( -1, -1, 1, 1 );
+        }
+    }
+
+    for ( auto item = windowPrivate->dirtyItemList;
+        item != nullptr; item = QQuickItemPrivate::get( item )->nextDirtyItem )
+    {
+        const auto oldRect = m_rects.value( item );
+        const auto newRect = updateSubtreeRect( item );
+
+        /*
+            The rectangles of the ancestors need to include the modified item,
+            so that we know what to update, when it gets removed from its parent.
+            We only extend them and rely on them being recalculated, when the
+            ancestor itself is dirty.
+         */
+        for ( auto parent = item->parentItem();
+            parent && !newRect.isEmpty(); parent = parent->parentItem() )
+        {
+            auto& rect = m_rects[ parent ];
+            if ( rect.contains( newRect ) )
+                break;
+
+            rect |= newRect;
+        }
+
+        const auto rect = oldRect | newRect;
+        if ( !rect.isEmpty() )
+        {
+            const QRectF scaledRect( rect.topLeft() * ratio, rect.size() * ratio );
+
+            // adding a pixel for antialiasing
+            damage += scaledRect.toAlignedRect().adjusted( -1, -1, 1, 1 );
+        }
+    }
+
+    QMutexLocker locker( &m_mutex );
+    m_damage += damage;
+}
+
+QRectF VncDamageTracker::updateSubtreeRect( QQuickItem* item )
+{
+    QRectF rect;
+
+    if ( item->isVisible() )
+    {
+        if ( isEffectItem( item ) )
+        {
+            rect = effectRect( item );
+            m_effectRects.insert( item, rect );
+        }
+        else
+        {
+            rect = item->mapRectToScene( item->boundingRect() );
+            m_effectRects.remove( item );
+        }
+
+        const auto children = item->childItems();
+        for ( auto child : children )
+            rect |= updateSubtreeRect( child );
+    }
+    else
+    {
+        m_effectRects.remove( item );
+    }
+
+    m_rects.insert( item, rect );
+
+    return rect;
+}
+
+QRectF VncDamageTracker::effectRect( const QQuickItem* item ) const
+{
+    // what an effect draws is limited by the clip only
+    for ( auto it = item; it != nullptr; it = it->parentItem() )
+    {
+        if ( it->clip() )
+            return it->mapRectToScene( it->clipRect() );
+    }
+
+    return QRectF( QPointF(), m_window->size() );
+}
+
+#include "moc_VncDamageTracker.cpp"
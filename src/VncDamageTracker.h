@@ -0,0 +1,74 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qobject.h>
+#include <qregion.h>
+#include <qhash.h>
+#include <qmutex.h>
+
+class QWindow;
+class QQuickWindow;
+class QQuickItem;
+
+/*
+    The scene graph knows which items have been modified since
+    the last frame. Collecting their geometries - before and after the
+    modification - gives a conservative approximation of the pixels, that
+    might have changed.
+
+    Whenever the damage can't be calculated from the dirty items the
+    complete window is reported.
+
+    The complete window is also reported, while animators ( OpacityAnimator,
+    RotationAnimator ... ) are running in the scene graph thread, as they do
+    not modify the items. Layers and shader effects are expected to draw
+    anywhere inside of the clip of their item and to change, whenever
+    any other item is modified.
+ */
+class VncDamageTracker final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    VncDamageTracker( QWindow* );
+    ~VncDamageTracker() override;
+
+    void start();
+    void stop();
+
+    // called from the scene graph thread after a frame has been rendered
+    QRegion takeDamage();
+
+  private:
+    void collect();
+    void invalidate();
+
+    QRectF updateSubtreeRect( QQuickItem* );
+    QRectF effectRect( const QQuickItem* ) const;
+
+    QQuickWindow* const m_window;
+    QMetaObject::Connection m_connection;
+
+    /*
+        The bounding rectangles of the items and their children,
+        when they have been rendered the last time.
+        Only accessed when the GUI thread is blocked by synchronizing.
+     */
+    QHash< const QQuickItem*, QRectF > m_rects;
+    int m_maxRects = 0;
+
+    // layers and shader effects
+    QHash< const QQuickItem*, QRectF > m_effectRects;
+
+    // only accessed from the scene graph thread
+    bool m_animating = false;
+
+    QMutex m_mutex;
+    QRegion m_damage;
+    bool m_fullDamage = true;
+    bool m_synchronized = false;
+};
@@ -0,0 +1,229 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncEncodeStage.h"
+#include "RfbPixelStreamer.h"
+#include "RfbSocket.h"
+#include "VncCpuGovernor.h"
+#include "VncThreadPolicy.h"
+
+#include <qbuffer.h>
+#include <qcoreapplication.h>
+#include <qelapsedtimer.h>
+#include <qloggingcategory.h>
+
+Q_LOGGING_CATEGORY( logEncode, "vnceglfs.encode", QtCriticalMsg )
+
+namespace
+{
+    class JobEvent final : public QEvent
+    {
+      public:
+        static QEvent::Type eventType()
+        {
+            static const auto type = static_cast< QEvent::Type >( QEvent::registerEventType() );
+            return type;
+        }
+
+        JobEvent( const VncEncodeStage::Job& encodeJob )
+            : QEvent( eventType() )
+            , job( encodeJob )
+        {
+        }
+
+        const VncEncodeStage::Job job;
+    };
+}
+
+class VncEncodeWorker final : public QObject
+{
+  public:
+    VncEncodeWorker( VncEncodeStage* stage, RfbPixelStreamer* streamer )
+        : m_stage( stage )
+        , m_streamer( streamer )
+    {
+    }
+
+  protected:
+    void customEvent( QEvent* event ) override
+    {
+        if ( event->type() == JobEvent::eventType() )
+            encode( static_cast< const JobEvent* >( event )->job );
+    }
+
+  private:
+    void encode( const VncEncodeStage::Job& job )
+    {
+        const VncCpuTimer cpuTimer;
+
+        QElapsedTimer timer;
+
+        if ( logEncode().isDebugEnabled() )
+            timer.start();
+
+        VncEncodeStage::Result result;
+        result.rects = job.rects;
+        result.region = job.region;
+
+        /*
+            The message is collected in memory and written to the socket
+            by the client thread. The capacity of the previous frame is a
+            good guess for the next one.
+         */
+        result.data.reserve( m_capacity );
+
+        QBuffer buffer( &result.data );
+        buffer.open( QIODevice::WriteOnly );
+
+        RfbSocket socket;
+        socket.open( &buffer );
+
+        if ( !job.yuv.isNull() )
+        {
+            result.lossyRegion = m_streamer->sendImageYuv(
+                job.yuv, job.yuvPos, job.qualityLevel, &socket );
+
+            if ( result.lossyRegion.isEmpty() )
+            {
+                // the JPEG encoder failed: nothing of the frame has been sent
+                result.failedRegion = job.region;
+
+                result.rects.clear();
+                result.region = QRegion();
+            }
+        }
+        else if ( job.tight )
+        {
+            result.lossyRegion = m_streamer->sendImageTight( job.image, job.rects,
+                job.qualityLevel, job.compressionLevel, &socket );
+        }
+        else
+        {
+            m_streamer->sendImageRaw( job.image, job.rects, &socket );
+        }
+
+        buffer.close();
+
+        m_capacity = result.data.size();
+
+        if ( logEncode().isDebugEnabled() )
+        {
+            qCDebug( logEncode ) << "encoded:" << result.data.size() << "bytes"
+                << timer.elapsed() << "ms";
+        }
+
+        m_stage->setResult( result );
+    }
+
+    VncEncodeStage* m_stage;
+    RfbPixelStreamer* m_streamer;
+
+    int m_capacity = 0;
+};
+
+VncEncodeStage::VncEncodeStage( RfbPixelStreamer* streamer )
+    : m_worker( new VncEncodeWorker( this, streamer ) )
+{
+    m_worker->moveToThread( &m_thread );
+
+    m_thread.setObjectName( QStringLiteral( "VncEncodeStage" ) );
+    VncThreadPolicy::attach( &m_thread, Vnc::EncodeThreads );
+
+    m_thread.start();
+}
+
+VncEncodeStage::~VncEncodeStage()
+{
+    m_thread.quit();
+    m_thread.wait();
+
+    delete m_worker;
+}
+
+void VncEncodeStage::encode( const Job& job )
+{
+    {
+        QMutexLocker locker( &m_mutex );
+
+        Q_ASSERT( !m_busy && !m_hasResult );
+
+        m_busy = true;
+        m_discarded = false;
+    }
+
+    // the image is implicitely shared and gets detached, when being modified
+    QCoreApplication::postEvent( m_worker, new JobEvent( job ) );
+}
+
+bool VncEncodeStage::isBusy() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_busy;
+}
+
+bool VncEncodeStage::hasResult() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_hasResult;
+}
+
+bool VncEncodeStage::takeResult( Result& result )
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( !m_hasResult )
+        return false;
+
+    result = m_result;
+
+    m_result = Result();
+    m_hasResult = false;
+
+    return true;
+}
+
+void VncEncodeStage::discard()
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( m_busy )
+        m_discarded = true;
+
+    m_result = Result();
+    m_hasResult = false;
+}
+
+void VncEncodeStage::waitForIdle()
+{
+    QMutexLocker locker( &m_mutex );
+
+    while ( m_busy )
+        m_idleCondition.wait( &m_mutex );
+}
+
+void VncEncodeStage::setResult( const Result& result )
+{
+    bool discarded;
+
+    {
+        QMutexLocker locker( &m_mutex );
+
+        m_busy = false;
+        discarded = m_discarded;
+
+        if ( !discarded )
+        {
+            m_result = result;
+            m_hasResult = true;
+        }
+
+        m_idleCondition.wakeAll();
+    }
+
+    if ( !discarded )
+        Q_EMIT finished();
+}
+
+#include "moc_VncEncodeStage.cpp"
@@ -0,0 +1,100 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qobject.h>
+#include <qthread.h>
+#include <qmutex.h>
+#include <qwaitcondition.h>
+#include <qimage.h>
+#include <qregion.h>
+#include <qvector.h>
+
+#include "RfbEncoder.h"
+
+class RfbPixelStreamer;
+
+/*
+    Encoding a frame and writing it to the socket are done in the
+    same thread of the client. So the CPU is idle, while the socket
+    is drained, and the network is idle, while the next frame is encoded.
+
+    The encode stage runs in a thread of its own, so that frame N+1
+    is encoded, while the client thread is still sending frame N.
+    At most one encoded frame is waiting to be sent.
+ */
+class VncEncodeStage final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    class Job
+    {
+      public:
+        QImage image;
+        QVector< QRect > rects;  // in coordinates of image
+
+        QRegion region; // unscaled, for VncServer::frameSent
+
+        bool tight = false;
+        int qualityLevel = -1;
+        int compressionLevel = 1;
+
+        // converted on the GPU, sent as JPEG instead of image
+        RfbYuvImage yuv;
+        QPoint yuvPos;
+    };
+
+    class Result
+    {
+      public:
+        QByteArray data; // a complete FramebufferUpdate message
+
+        QVector< QRect > rects;
+        QRegion region;
+        QRegion lossyRegion;
+
+        // could not be encoded, has to be sent again
+        QRegion failedRegion;
+    };
+
+    // the streamer must not be modified, while the stage is busy
+    VncEncodeStage( RfbPixelStreamer* );
+    ~VncEncodeStage() override;
+
+    // called from the client thread, when the stage is idle
+    void encode( const Job& );
+
+    bool isBusy() const;
+    bool hasResult() const;
+
+    bool takeResult( Result& );
+
+    // dropping the result, f.e. after the frame buffer size has changed
+    void discard();
+
+    void waitForIdle();
+
+  Q_SIGNALS:
+    // a result is available, emitted from the thread of the stage
+    void finished();
+
+  private:
+    friend class VncEncodeWorker;
+    void setResult( const Result& );
+
+    QThread m_thread;
+    QObject* m_worker;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_idleCondition;
+
+    bool m_busy = false;
+    bool m_discarded = false;
+
+    bool m_hasResult = false;
+    Result m_result;
+};
@@ -0,0 +1,236 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncFrameHasher.h"
+#include "VncThreadPolicy.h"
+
+#include <qimage.h>
+#include <qregion.h>
+#include <qhash.h>
+#include <qcoreapplication.h>
+#include <qendian.h>
+#include <qelapsedtimer.h>
+#include <qloggingcategory.h>
+
+Q_LOGGING_CATEGORY( logHash, "vnceglfs.hash", QtCriticalMsg )
+
+namespace
+{
+    /*
+        XXH64 ( https://github.com/Cyan4973/xxHash ): the 4 lanes are
+        independent from each other, what allows the CPU to process
+        them in parallel. Good enough to be limited by the memory bandwidth
+        without having to deal with intrinsics for each platform.
+     */
+
+    const quint64 prime1 = Q_UINT64_C( 0x9E3779B185EBCA87 );
+    const quint64 prime2 = Q_UINT64_C( 0xC2B2AE3D27D4EB4F );
+    const quint64 prime3 = Q_UINT64_C( 0x165667B19E3779F9 );
+    const quint64 prime4 = Q_UINT64_C( 0x85EBCA77C2B2AE63 );
+    const quint64 prime5 = Q_UINT64_C( 0x27D4EB2F165667C5 );
+
+    inline quint64 rotl( quint64 value, int bits )
+    {
+        return ( value << bits ) | ( value >> ( 64 - bits ) );
+    }
+
+    inline quint64 read64( const uchar* data )
+    {
+        return qFromLittleEndian< quint64 >( data );
+    }
+
+    inline quint64 hashRound( quint64 acc, quint64 input )
+    {
+        acc += input * prime2;
+        acc = rotl( acc, 31 );
+        return acc * prime1;
+    }
+
+    inline quint64 mergeRound( quint64 acc, quint64 value )
+    {
+        acc ^= hashRound( 0, value );
+        return acc * prime1 + prime4;
+    }
+
+    quint64 xxHash64( const uchar* data, size_t length, quint64 seed )
+    {
+        const auto end = data + length;
+
+        quint64 hash;
+
+        if ( length >= 32 )
+        {
+            quint64 v1 = seed + prime1 + prime2;
+            quint64 v2 = seed + prime2;
+            quint64 v3 = seed;
+            quint64 v4 = seed - prime1;
+
+            const auto limit = end - 32;
+
+            do
+            {
+                v1 = hashRound( v1, read64( data ) );
+                v2 = hashRound( v2, read64( data + 8 ) );
+                v3 = hashRound( v3, read64( data + 16 ) );
+                v4 = hashRound( v4, read64( data + 24 ) );
+
+                data += 32;
+            } while ( data <= limit );
+
+            hash = rotl( v1, 1 ) + rotl( v2, 7 ) + rotl( v3, 12 ) + rotl( v4, 18 );
+
+            hash = mergeRound( hash, v1 );
+            hash = mergeRound( hash, v2 );
+            hash = mergeRound( hash, v3 );
+            hash = mergeRound( hash, v4 );
+        }
+        else
+        {
+            hash = seed + prime5;
+        }
+
+        hash += length;
+
+        for ( ; data + 8 <= end; data += 8 )
+        {
+            hash ^= hashRound( 0, read64( data ) );
+            hash = rotl( hash, 27 ) * prime1 + prime4;
+        }
+
+        if ( data + 4 <= end )
+        {
+            hash ^= quint64( qFromLittleEndian< quint32 >( data ) ) * prime1;
+            hash = rotl( hash, 23 ) * prime2 + prime3;
+            data += 4;
+        }
+
+        for ( ; data < end; data++ )
+        {
+            hash ^= ( *data ) * prime5;
+            hash = rotl( hash, 11 ) * prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= prime2;
+        hash ^= hash >> 29;
+        hash *= prime3;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+    class FrameEvent final : public QEvent
+    {
+      public:
+        static QEvent::Type eventType()
+        {
+            static const auto type = static_cast< QEvent::Type >( QEvent::registerEventType() );
+            return type;
+        }
+
+        FrameEvent( VncFrameHasher::Source frameSource, const QImage& frameImage,
+                const QRegion& frameRegion, bool frameEnforced )
+            : QEvent( eventType() )
+            , source( frameSource )
+            , image( frameImage )
+            , region( frameRegion )
+            , enforced( frameEnforced )
+        {
+        }
+
+        const VncFrameHasher::Source source;
+        const QImage image;
+        const QRegion region;
+        const bool enforced;
+    };
+
+    class Worker final : public QObject
+    {
+      public:
+        Worker( VncFrameHasher* hasher )
+            : m_hasher( hasher )
+        {
+        }
+
+      protected:
+        void customEvent( QEvent* event ) override
+        {
+            if ( event->type() == FrameEvent::eventType() )
+                checkFrame( static_cast< const FrameEvent* >( event ) );
+        }
+
+      private:
+        void checkFrame( const FrameEvent* event )
+        {
+            QElapsedTimer timer;
+
+            if ( logHash().isDebugEnabled() )
+                timer.start();
+
+            const auto hash = VncFrameHasher::fingerprint( event->image );
+
+            auto& lastHash = m_fingerprints[ event->source ];
+            const bool changed = event->enforced || ( hash != lastHash );
+
+            lastHash = hash;
+
+            if ( logHash().isDebugEnabled() )
+            {
+                qCDebug( logHash ) << "fingerprint:" << timer.elapsed() << "ms"
+                    << ( changed ? "changed" : "unchanged" );
+            }
+
+            if ( changed )
+                Q_EMIT m_hasher->frameChanged( event->region );
+        }
+
+        VncFrameHasher* m_hasher;
+
+        // the fingerprints of the previous frames
+        QHash< int, quint64 > m_fingerprints;
+    };
+}
+
+VncFrameHasher::VncFrameHasher()
+    : m_worker( new Worker( this ) )
+{
+    m_worker->moveToThread( &m_thread );
+
+    m_thread.setObjectName( QStringLiteral( "VncFrameHasher" ) );
+    VncThreadPolicy::attach( &m_thread, Vnc::WorkerThreads );
+
+    m_thread.start();
+}
+
+VncFrameHasher::~VncFrameHasher()
+{
+    m_thread.quit();
+    m_thread.wait();
+
+    delete m_worker;
+}
+
+void VncFrameHasher::checkFrame( Source source, const QImage& image,
+    const QRegion& dirtyRegion, bool enforced )
+{
+    QCoreApplication::postEvent( m_worker,
+        new FrameEvent( source, image, dirtyRegion, enforced ) );
+}
+
+quint64 VncFrameHasher::fingerprint( const QImage& image )
+{
+    // including the geometry, so that resized frames are never identical
+    const auto seed = ( quint64( image.width() ) << 32 ) | quint32( image.height() );
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    const auto size = static_cast< size_t >( image.sizeInBytes() );
+#else
+    const auto size = static_cast< size_t >( image.byteCount() );
+#endif
+
+    return xxHash64( image.constBits(), size, seed );
+}
+
+#include "moc_VncFrameHasher.cpp"
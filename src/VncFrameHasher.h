@@ -0,0 +1,57 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qobject.h>
+#include <qthread.h>
+
+class QImage;
+class QRegion;
+
+/*
+    Many frames do not differ from the previous one: f.e. when properties
+    without any visual effect have been modified or when the render loop
+    continues after an animation has stopped.
+
+    Comparing a fingerprint of the frame with the one of the previous frame
+    allows to drop those frames before the clients start to encode them.
+    The fingerprint is calculated in a separate thread to keep the scene
+    graph thread free.
+ */
+class VncFrameHasher final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    // frames are compared with the previous frame of the same source only
+    enum Source
+    {
+        FrameBuffer,
+        ScaledFrameBuffer,
+        YuvFrame
+    };
+
+    VncFrameHasher();
+    ~VncFrameHasher() override;
+
+    /*
+        Can be called from any thread. The image is implicitly shared and must not
+        be modified in place by the caller. frameChanged( dirtyRegion ) is emitted
+        from the thread of the hasher, when the fingerprint of the image differs
+        from the previous frame of the source - or when enforced.
+     */
+    void checkFrame( Source, const QImage&, const QRegion& dirtyRegion, bool enforced );
+
+    // XXH64 of the pixels
+    static quint64 fingerprint( const QImage& );
+
+  Q_SIGNALS:
+    void frameChanged( const QRegion& );
+
+  private:
+    QThread m_thread;
+    QObject* m_worker;
+};
@@ -0,0 +1,241 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncFramePublisher.h"
+#include "VncServer.h"
+
+#include <qlocalserver.h>
+#include <qlocalsocket.h>
+#include <qimage.h>
+#include <qregion.h>
+#include <qloggingcategory.h>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+Q_LOGGING_CATEGORY( logPublisher, "vnceglfs.publisher" )
+
+namespace
+{
+    bool sendFd( qintptr socket, int fd )
+    {
+#ifdef Q_OS_LINUX
+        // SCM_RIGHTS needs at least one byte of payload
+        char byte = 0;
+
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        union
+        {
+            char buffer[ CMSG_SPACE( sizeof( int ) ) ];
+            struct cmsghdr align;
+        } control;
+
+        memset( &control, 0, sizeof( control ) );
+
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof( control.buffer );
+
+        auto cmsg = CMSG_FIRSTHDR( &msg );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+
+        memcpy( CMSG_DATA( cmsg ), &fd, sizeof( int ) );
+
+        return ::sendmsg( int( socket ), &msg, MSG_NOSIGNAL ) == 1;
+#else
+        Q_UNUSED( socket )
+        Q_UNUSED( fd )
+
+        return false;
+#endif
+    }
+}
+
+VncFramePublisher::VncFramePublisher( VncServer* server )
+    : QObject( server )
+    , m_server( server )
+    , m_localServer( new QLocalServer( this ) )
+{
+    connect( m_localServer, &QLocalServer::newConnection,
+        this, &VncFramePublisher::addReaders );
+}
+
+VncFramePublisher::~VncFramePublisher()
+{
+}
+
+bool VncFramePublisher::listen( const QString& path )
+{
+    // removing a socket file left from a crashed process
+    QLocalServer::removeServer( path );
+
+    return m_localServer->listen( path );
+}
+
+QString VncFramePublisher::path() const
+{
+    return m_localServer->fullServerName();
+}
+
+int VncFramePublisher::readerCount() const
+{
+    return m_readers.count();
+}
+
+void VncFramePublisher::addReaders()
+{
+    // not inside the lock: publish is called with the frame buffer being locked
+    const auto size = m_server->frameBufferSize();
+
+    while ( auto socket = m_localServer->nextPendingConnection() )
+    {
+        bool recreated = false;
+        bool ok;
+
+        {
+            QMutexLocker locker( &m_mutex );
+
+            if ( m_ring.size() != size )
+            {
+                m_ring.create( size );
+                recreated = true;
+            }
+
+            ok = m_ring.isValid() && sendFd( socket->socketDescriptor(), m_ring.fd() );
+        }
+
+        if ( recreated )
+            closeReaders(); // they are still attached to the previous ring
+
+        if ( !ok )
+        {
+            qCWarning( logPublisher ) << "Can't pass the frames to a reader";
+
+            socket->abort();
+            socket->deleteLater();
+
+            continue;
+        }
+
+        connect( socket, &QLocalSocket::readyRead,
+            this, [this, socket]() { readMessages( socket ); } );
+
+        connect( socket, &QLocalSocket::disconnected,
+            this, [this, socket]() { removeReader( socket ); } );
+
+        m_readers += socket;
+
+        qCDebug( logPublisher ) << "Reader attached, #readers:" << m_readers.count();
+        Q_EMIT readerCountChanged( m_readers.count() );
+    }
+}
+
+void VncFramePublisher::removeReader( QLocalSocket* socket )
+{
+    if ( m_readers.removeOne( socket ) )
+    {
+        socket->deleteLater();
+
+        qCDebug( logPublisher ) << "Reader detached, #readers:" << m_readers.count();
+        Q_EMIT readerCountChanged( m_readers.count() );
+    }
+}
+
+void VncFramePublisher::closeReaders()
+{
+    if ( m_readers.isEmpty() )
+        return;
+
+    const auto readers = m_readers;
+    m_readers.clear();
+
+    for ( auto socket : readers )
+    {
+        // the readers reconnect and receive the current ring
+        socket->disconnect( this );
+        socket->abort();
+        socket->deleteLater();
+    }
+
+    Q_EMIT readerCountChanged( 0 );
+}
+
+void VncFramePublisher::readMessages( QLocalSocket* socket )
+{
+    const qint64 messageSize = sizeof( VncRingMessage );
+
+    while ( socket->bytesAvailable() >= messageSize )
+    {
+        VncRingMessage message;
+        socket->read( reinterpret_cast< char* >( &message ), messageSize );
+
+        switch( message.type )
+        {
+            case VncRingMessage::FrameRequest:
+            {
+                m_server->requestFrame();
+                break;
+            }
+            case VncRingMessage::Pointer:
+            {
+                const QPoint fbPos( message.value1, message.value2 );
+
+                QPointF pos;
+                if ( auto window = m_server->windowAt( fbPos, pos ) )
+                    m_inputQueue.addPointerEvent( window, pos, message.flags );
+
+                break;
+            }
+            case VncRingMessage::Key:
+            {
+                if ( auto window = m_server->keyboardWindow() )
+                {
+                    m_inputQueue.addKeyEvent( window,
+                        quint32( message.value1 ), message.flags != 0 );
+                }
+
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    m_inputQueue.flush();
+}
+
+void VncFramePublisher::publish( const QImage& image, const QRegion& damage )
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( m_ring.size() != image.size() )
+    {
+        if ( !m_ring.create( image.size() ) )
+        {
+            qCWarning( logPublisher ) << "Can't create a ring for" << image.size();
+            return;
+        }
+
+        // the readers need to reconnect to receive the new memfd
+        QMetaObject::invokeMethod( this, "closeReaders", Qt::QueuedConnection );
+    }
+
+    m_ring.publish( image, damage );
+}
+
+#include "moc_VncFramePublisher.cpp"
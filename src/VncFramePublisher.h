@@ -0,0 +1,62 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include "VncFrameRing.h"
+#include "RfbInputEventQueue.h"
+
+#include <qobject.h>
+#include <qmutex.h>
+#include <qvector.h>
+
+class VncServer;
+class QLocalServer;
+class QLocalSocket;
+class QImage;
+class QRegion;
+
+/*
+    The application side of the out of process mode: grabbed frames are
+    published into a VncFrameRing, that is passed to the vnceglfs-server
+    processes connecting to a Unix domain socket. Frame requests and
+    input events are received through the same socket.
+ */
+class VncFramePublisher final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    VncFramePublisher( VncServer* );
+    ~VncFramePublisher() override;
+
+    bool listen( const QString& path );
+    QString path() const;
+
+    int readerCount() const;
+
+    // called from the render thread
+    void publish( const QImage&, const QRegion& damage );
+
+  Q_SIGNALS:
+    void readerCountChanged( int count );
+
+  private:
+    Q_INVOKABLE void closeReaders();
+
+    void addReaders();
+    void removeReader( QLocalSocket* );
+    void readMessages( QLocalSocket* );
+
+    VncServer* m_server;
+
+    QLocalServer* m_localServer;
+    QVector< QLocalSocket* > m_readers;
+
+    RfbInputEventQueue m_inputQueue;
+
+    QMutex m_mutex; // the ring is written from the render thread
+    VncFrameRing m_ring;
+};
@@ -0,0 +1,447 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncFrameRing.h"
+
+#include <qimage.h>
+#include <qatomic.h>
+
+#include <atomic>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// not available with older versions of the C library
+
+#ifndef MFD_CLOEXEC
+    #define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+    #define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+    #define F_ADD_SEALS 1033
+    #define F_GET_SEALS 1034
+
+    #define F_SEAL_SEAL 0x0001
+    #define F_SEAL_SHRINK 0x0002
+    #define F_SEAL_GROW 0x0004
+#endif
+
+#endif
+
+namespace
+{
+    const quint32 ringMagic = 0x474e5256; // "VRNG"
+    const int maxDamageRects = 64;
+
+    inline size_t pageAligned( size_t size )
+    {
+        const size_t pageSize = 4096;
+        return ( size + pageSize - 1 ) / pageSize * pageSize;
+    }
+
+    inline QVector< QRect > regionRects( const QRegion& region )
+    {
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 8, 0 )
+        QVector< QRect > rects;
+        rects.reserve( region.rectCount() );
+
+        for ( const auto& rect : region )
+            rects += rect;
+
+        return rects;
+#else
+        return region.rects();
+#endif
+    }
+}
+
+struct VncFrameRing::Header
+{
+    quint32 magic;
+    quint32 slotCount;
+
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+
+    quint32 pixelOffset; // offset of the frame of the first slot
+
+    // the last published frame, 0: nothing published yet
+    QBasicAtomicInteger< quint64 > sequence;
+};
+
+struct VncFrameRing::Slot
+{
+    // sequence number of the frame, 0 while being written
+    QBasicAtomicInteger< quint64 > sequence;
+
+    qint32 rectCount;
+    qint32 padding;
+
+    qint32 rects[ maxDamageRects ][ 4 ];
+};
+
+VncFrameRing::VncFrameRing()
+{
+}
+
+VncFrameRing::~VncFrameRing()
+{
+    reset();
+}
+
+bool VncFrameRing::create( const QSize& size, int slotCount )
+{
+    reset();
+
+#ifdef Q_OS_LINUX
+    if ( size.isEmpty() )
+        return false;
+
+    slotCount = qMax( slotCount, 2 );
+
+    const size_t pixelOffset = pageAligned( sizeof( Header ) + slotCount * sizeof( Slot ) );
+    const size_t frameSize = size_t( size.width() ) * 4 * size.height();
+    const size_t totalSize = pixelOffset + slotCount * frameSize;
+
+    m_fd = int( ::syscall( SYS_memfd_create, "vnceglfs-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING ) );
+    if ( m_fd < 0 )
+        return false;
+
+    if ( ::ftruncate( m_fd, off_t( totalSize ) ) != 0 || !map( totalSize, true ) )
+    {
+        reset();
+        return false;
+    }
+
+    // readers can rely on the size and won't run into SIGBUS
+    ::fcntl( m_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL );
+
+    // the memfd is zero initialized
+    auto header = reinterpret_cast< Header* >( m_data );
+
+    header->magic = ringMagic;
+    header->slotCount = quint32( slotCount );
+    header->width = size.width();
+    header->height = size.height();
+    header->bytesPerLine = size.width() * 4;
+    header->pixelOffset = quint32( pixelOffset );
+
+    // each slot needs to be written completely the first time
+    m_pendingDamage.fill( QRect( QPoint(), size ), slotCount );
+
+    return true;
+#else
+    Q_UNUSED( size )
+    Q_UNUSED( slotCount )
+
+    return false;
+#endif
+}
+
+bool VncFrameRing::attach( int fd )
+{
+    reset();
+
+#ifdef Q_OS_LINUX
+    m_fd = fd;
+
+    struct stat st;
+    if ( ::fstat( fd, &st ) != 0 || size_t( st.st_size ) < sizeof( Header ) )
+    {
+        reset();
+        return false;
+    }
+
+    // without the seal the writer could shrink the memfd below our feet
+    const int seals = ::fcntl( fd, F_GET_SEALS );
+    if ( seals < 0 || !( seals & F_SEAL_SHRINK ) )
+    {
+        reset();
+        return false;
+    }
+
+    if ( !map( size_t( st.st_size ), false ) )
+    {
+        reset();
+        return false;
+    }
+
+    const auto header = this->header();
+
+    const bool ok = header->magic == ringMagic
+        && header->slotCount >= 2 && header->width > 0 && header->height > 0
+        && header->bytesPerLine == header->width * 4
+        && header->pixelOffset >= sizeof( Header ) + header->slotCount * sizeof( Slot )
+        && header->pixelOffset + size_t( header->slotCount ) * header->bytesPerLine
+            * header->height <= m_mappedSize;
+
+    if ( !ok )
+        reset();
+
+    return ok;
+#else
+    Q_UNUSED( fd )
+    return false;
+#endif
+}
+
+bool VncFrameRing::map( size_t size, bool writable )
+{
+#ifdef Q_OS_LINUX
+    const int protection = writable ? ( PROT_READ | PROT_WRITE ) : PROT_READ;
+
+    auto data = ::mmap( nullptr, size, protection, MAP_SHARED, m_fd, 0 );
+    if ( data == MAP_FAILED )
+        return false;
+
+    m_data = static_cast< uchar* >( data );
+    m_mappedSize = size;
+
+    return true;
+#else
+    Q_UNUSED( size )
+    Q_UNUSED( writable )
+
+    return false;
+#endif
+}
+
+void VncFrameRing::reset()
+{
+#ifdef Q_OS_LINUX
+    if ( m_data )
+        ::munmap( m_data, m_mappedSize );
+
+    if ( m_fd >= 0 )
+        ::close( m_fd );
+#endif
+
+    m_data = nullptr;
+    m_mappedSize = 0;
+    m_fd = -1;
+
+    m_pendingDamage.clear();
+}
+
+bool VncFrameRing::isValid() const
+{
+    return m_data != nullptr;
+}
+
+int VncFrameRing::fd() const
+{
+    return m_fd;
+}
+
+QSize VncFrameRing::size() const
+{
+    if ( const auto header = this->header() )
+        return QSize( header->width, header->height );
+
+    return QSize();
+}
+
+VncFrameRing::Header* VncFrameRing::header() const
+{
+    return reinterpret_cast< Header* >( m_data );
+}
+
+VncFrameRing::Slot* VncFrameRing::slot( quint64 sequence ) const
+{
+    const auto index = sequence % header()->slotCount;
+    return reinterpret_cast< Slot* >( m_data + sizeof( Header ) ) + index;
+}
+
+uchar* VncFrameRing::pixels( quint64 sequence ) const
+{
+    const auto header = this->header();
+    const auto index = sequence % header->slotCount;
+
+    return m_data + header->pixelOffset
+        + index * size_t( header->bytesPerLine ) * header->height;
+}
+
+void VncFrameRing::publish( const QImage& image, const QRegion& damage )
+{
+    auto header = this->header();
+    if ( header == nullptr || image.size() != size() || image.depth() != 32 )
+        return;
+
+    const QRect rect( QPoint(), image.size() );
+    const auto frameDamage = damage & rect;
+
+    const quint64 sequence = header->sequence.loadAcquire() + 1;
+    const auto index = int( sequence % header->slotCount );
+
+    for ( int i = 0; i < m_pendingDamage.count(); i++ )
+        m_pendingDamage[i] += frameDamage;
+
+    auto slot = this->slot( sequence );
+
+    // readers detect, that the slot is being overwritten
+    slot->sequence.storeRelease( 0 );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    /*
+        The slot contains a frame, that is slotCount frames old.
+        Only what has changed since then needs to be copied.
+     */
+    const auto to = pixels( sequence );
+    const int bytesPerLine = header->bytesPerLine;
+
+    const auto rects = regionRects( m_pendingDamage[index] );
+    for ( const auto& r : rects )
+    {
+        for ( int y = r.top(); y <= r.bottom(); y++ )
+        {
+            memcpy( to + y * bytesPerLine + r.x() * 4,
+                image.constScanLine( y ) + r.x() * 4, r.width() * 4 );
+        }
+    }
+
+    m_pendingDamage[index] = QRegion();
+
+    if ( frameDamage.rectCount() <= maxDamageRects )
+    {
+        const auto damageRects = regionRects( frameDamage );
+
+        slot->rectCount = damageRects.count();
+        for ( int i = 0; i < damageRects.count(); i++ )
+        {
+            const auto& r = damageRects[i];
+
+            slot->rects[i][0] = r.x();
+            slot->rects[i][1] = r.y();
+            slot->rects[i][2] = r.width();
+            slot->rects[i][3] = r.height();
+        }
+    }
+    else
+    {
+        const auto r = frameDamage.boundingRect();
+
+        slot->rectCount = 1;
+        slot->rects[0][0] = r.x();
+        slot->rects[0][1] = r.y();
+        slot->rects[0][2] = r.width();
+        slot->rects[0][3] = r.height();
+    }
+
+    slot->sequence.storeRelease( sequence );
+    header->sequence.storeRelease( sequence );
+}
+
+bool VncFrameRing::slotDamage( quint64 sequence, QRegion& region ) const
+{
+    const auto slot = this->slot( sequence );
+
+    if ( slot->sequence.loadAcquire() != sequence )
+        return false;
+
+    const int count = qBound( 0, int( slot->rectCount ), maxDamageRects );
+
+    QRegion damage;
+    for ( int i = 0; i < count; i++ )
+    {
+        damage += QRect( slot->rects[i][0], slot->rects[i][1],
+            slot->rects[i][2], slot->rects[i][3] );
+    }
+
+    std::atomic_thread_fence( std::memory_order_acquire );
+
+    if ( slot->sequence.loadAcquire() != sequence )
+        return false;
+
+    region += damage;
+    return true;
+}
+
+bool VncFrameRing::read( quint64& sequence, QImage& image, QRegion& damage ) const
+{
+    const auto header = this->header();
+    if ( header == nullptr )
+        return false;
+
+    const QRect rect( QPoint(), size() );
+
+    bool full = ( sequence == 0 );
+
+    if ( image.size() != rect.size() || image.format() != QImage::Format_RGB32 )
+    {
+        image = QImage( rect.size(), QImage::Format_RGB32 );
+        full = true;
+    }
+
+    const int bytesPerLine = header->bytesPerLine;
+
+    for ( int attempt = 0; attempt < 3; attempt++ )
+    {
+        const auto latest = header->sequence.loadAcquire();
+        if ( latest == 0 || latest == sequence )
+            return false;
+
+        QRegion region;
+
+        if ( full || latest < sequence || latest - sequence >= header->slotCount )
+        {
+            // the frames in between are gone
+            region = rect;
+        }
+        else
+        {
+            for ( auto s = sequence + 1; s <= latest; s++ )
+            {
+                if ( !slotDamage( s, region ) )
+                {
+                    region = rect;
+                    break;
+                }
+            }
+
+            region &= rect;
+        }
+
+        const auto from = pixels( latest );
+
+        const auto rects = regionRects( region );
+        for ( const auto& r : rects )
+        {
+            for ( int y = r.top(); y <= r.bottom(); y++ )
+            {
+                memcpy( image.scanLine( y ) + r.x() * 4,
+                    from + y * bytesPerLine + r.x() * 4, r.width() * 4 );
+            }
+        }
+
+        std::atomic_thread_fence( std::memory_order_acquire );
+
+        if ( slot( latest )->sequence.loadAcquire() == latest )
+        {
+            sequence = latest;
+            damage = region;
+
+            return true;
+        }
+
+        // overtaken by the writer while copying
+        full = true;
+    }
+
+    // the content of image is undefined now
+    sequence = 0;
+
+    return false;
+}
@@ -0,0 +1,97 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qglobal.h>
+#include <qsize.h>
+#include <qvector.h>
+#include <qregion.h>
+
+class QImage;
+
+/*
+    Frames in shared memory ( memfd ), so that the viewers can be handled
+    by a vnceglfs-server process, while the application pays for the grab only.
+
+    The ring has a couple of slots, each of them holding a complete frame
+    with the sequence number and the damage of the frame. There is one writer
+    and any number of readers, that never block the writer: a reader, that
+    has been overtaken, detects this from the sequence numbers and
+    falls back to a full update.
+
+    Linux only.
+ */
+class VncFrameRing
+{
+  public:
+    VncFrameRing();
+    ~VncFrameRing();
+
+    // writer: creating a new memfd for frames of size, RGB32
+    bool create( const QSize& size, int slotCount = 4 );
+
+    // writer: the next frame, damage is what has changed since the previous one
+    void publish( const QImage&, const QRegion& damage );
+
+    // reader: mapping a memfd received from the writer, the fd is taken over
+    bool attach( int fd );
+
+    /*
+        reader: copying the damaged parts of the latest frame into image, that
+        has to contain the frame of sequence. Returns false, when there is
+        no frame newer than sequence.
+     */
+    bool read( quint64& sequence, QImage& image, QRegion& damage ) const;
+
+    void reset();
+
+    bool isValid() const;
+    int fd() const;
+    QSize size() const;
+
+  private:
+    Q_DISABLE_COPY( VncFrameRing )
+
+    struct Header;
+    struct Slot;
+
+    bool map( size_t size, bool writable );
+
+    Header* header() const;
+    Slot* slot( quint64 sequence ) const;
+    uchar* pixels( quint64 sequence ) const;
+
+    bool slotDamage( quint64 sequence, QRegion& ) const;
+
+    int m_fd = -1;
+    uchar* m_data = nullptr;
+    size_t m_mappedSize = 0;
+
+    // writer only: what has changed since a slot has been written
+    QVector< QRegion > m_pendingDamage;
+};
+
+/*
+    Messages from the vnceglfs-server process to the application,
+    that are sent through the Unix domain socket, where the
+    memfd has been received from.
+ */
+struct VncRingMessage
+{
+    enum Type
+    {
+        FrameRequest,
+        Pointer, // value1/2: position in the frame buffer, flags: button mask
+        Key      // value1: keysym, flags: down
+    };
+
+    quint8 type;
+    quint8 flags;
+    quint16 padding;
+
+    qint32 value1;
+    qint32 value2;
+};
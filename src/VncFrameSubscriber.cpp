@@ -0,0 +1,331 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncFrameSubscriber.h"
+#include "VncServer.h"
+
+#include <qlocalsocket.h>
+#include <qsocketnotifier.h>
+#include <qregion.h>
+#include <qdir.h>
+#include <qfile.h>
+#include <qloggingcategory.h>
+
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY( logSubscriber, "vnceglfs.subscriber" )
+
+namespace
+{
+    int connectToSocket( const QString& path )
+    {
+#ifdef Q_OS_LINUX
+        // relative names are resolved like QLocalServer does
+        QString name = path;
+        if ( !name.startsWith( QLatin1Char( '/' ) ) )
+            name = QDir::tempPath() + QLatin1Char( '/' ) + name;
+
+        const auto encodedName = QFile::encodeName( name );
+
+        struct sockaddr_un addr;
+        memset( &addr, 0, sizeof( addr ) );
+
+        if ( size_t( encodedName.size() ) >= sizeof( addr.sun_path ) )
+            return -1;
+
+        addr.sun_family = AF_UNIX;
+        memcpy( addr.sun_path, encodedName.constData(), size_t( encodedName.size() ) );
+
+        const int fd = ::socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+        if ( fd < 0 )
+            return -1;
+
+        /*
+            Connecting to a Unix domain socket never blocks: it succeeds
+            or fails immediately - with EAGAIN, when the backlog is full.
+         */
+        if ( ::connect( fd, reinterpret_cast< struct sockaddr* >( &addr ), sizeof( addr ) ) != 0 )
+        {
+            ::close( fd );
+            return -1;
+        }
+
+        return fd;
+#else
+        Q_UNUSED( path )
+        return -1;
+#endif
+    }
+
+    void closeSocket( int fd )
+    {
+#ifdef Q_OS_LINUX
+        ::close( fd );
+#else
+        Q_UNUSED( fd )
+#endif
+    }
+
+    int receiveFd( int socket )
+    {
+#ifdef Q_OS_LINUX
+        char byte;
+
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        union
+        {
+            char buffer[ CMSG_SPACE( sizeof( int ) ) ];
+            struct cmsghdr align;
+        } control;
+
+        struct msghdr msg;
+        memset( &msg, 0, sizeof( msg ) );
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof( control.buffer );
+
+        if ( ::recvmsg( socket, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT ) != 1 )
+            return -1;
+
+        const auto cmsg = CMSG_FIRSTHDR( &msg );
+        if ( cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET
+            || cmsg->cmsg_type != SCM_RIGHTS )
+        {
+            return -1;
+        }
+
+        int fd;
+        memcpy( &fd, CMSG_DATA( cmsg ), sizeof( int ) );
+
+        return fd;
+#else
+        Q_UNUSED( socket )
+        return -1;
+#endif
+    }
+}
+
+VncFrameSubscriber::VncFrameSubscriber( VncServer* server )
+    : QObject( server )
+    , m_server( server )
+{
+    m_connectTimer.setInterval( 1000 );
+    connect( &m_connectTimer, &QTimer::timeout,
+        this, &VncFrameSubscriber::connectToPublisher );
+
+    /*
+        Checking for a new frame is reading a counter from
+        the shared memory only.
+     */
+    m_pollTimer.setInterval( 10 );
+    connect( &m_pollTimer, &QTimer::timeout,
+        this, &VncFrameSubscriber::readFrame );
+}
+
+VncFrameSubscriber::~VncFrameSubscriber()
+{
+    abortConnecting();
+}
+
+void VncFrameSubscriber::subscribe( const QString& path )
+{
+    m_path = path;
+
+    connectToPublisher();
+}
+
+QString VncFrameSubscriber::path() const
+{
+    return m_path;
+}
+
+void VncFrameSubscriber::connectToPublisher()
+{
+    /*
+        This is the thread, that accepts the viewers. So we never block
+        here and a publisher, that did not send the ring within
+        an interval of the connect timer, is given up.
+     */
+    abortConnecting();
+
+    const int fd = connectToSocket( m_path );
+    if ( fd < 0 )
+    {
+        if ( !m_connectTimer.isActive() )
+        {
+            qCWarning( logSubscriber ) << "Waiting for frames from" << m_path;
+            m_connectTimer.start();
+        }
+
+        return;
+    }
+
+    /*
+        The memfd is sent immediately after accepting the connection.
+        It has to be received natively before wrapping the descriptor
+        into a QLocalSocket, that would read the byte and drop the descriptor.
+     */
+    m_pendingFd = fd;
+
+    m_notifier = new QSocketNotifier( fd, QSocketNotifier::Read, this );
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 15, 0 )
+    connect( m_notifier, SIGNAL(activated(QSocketDescriptor,QSocketNotifier::Type)),
+        this, SLOT(receiveRing()) );
+#else
+    connect( m_notifier, SIGNAL(activated(int)), this, SLOT(receiveRing()) );
+#endif
+
+    m_connectTimer.start();
+}
+
+void VncFrameSubscriber::receiveRing()
+{
+    const int fd = m_pendingFd;
+    const int memFd = receiveFd( fd );
+
+    m_notifier->setEnabled( false );
+    m_notifier->deleteLater();
+
+    m_notifier = nullptr;
+    m_pendingFd = -1;
+
+    if ( memFd < 0 || !m_ring.attach( memFd ) )
+    {
+        closeSocket( fd );
+        return; // retried by m_connectTimer
+    }
+
+    auto socket = new QLocalSocket( this );
+    if ( !socket->setSocketDescriptor( fd ) )
+    {
+        closeSocket( fd );
+        delete socket;
+
+        m_ring.reset();
+        return;
+    }
+
+    m_connectTimer.stop();
+
+    m_socket = socket;
+    connect( m_socket, &QLocalSocket::disconnected,
+        this, &VncFrameSubscriber::disconnectFromPublisher );
+
+    qCDebug( logSubscriber ) << "Receiving frames of" << m_ring.size() << "from" << m_path;
+
+    // the first frame of the ring needs to be copied completely
+    m_sequence = 0;
+
+    m_frameRequested.storeRelease( 0 );
+    requestFrame();
+
+    m_pollTimer.start();
+}
+
+void VncFrameSubscriber::abortConnecting()
+{
+    if ( m_notifier )
+    {
+        m_notifier->setEnabled( false );
+        delete m_notifier;
+        m_notifier = nullptr;
+    }
+
+    if ( m_pendingFd >= 0 )
+    {
+        closeSocket( m_pendingFd );
+        m_pendingFd = -1;
+    }
+}
+
+void VncFrameSubscriber::disconnectFromPublisher()
+{
+    qCDebug( logSubscriber ) << "Disconnected from" << m_path;
+
+    m_pollTimer.stop();
+    m_ring.reset();
+
+    if ( m_socket )
+    {
+        m_socket->disconnect( this );
+        m_socket->deleteLater();
+        m_socket = nullptr;
+    }
+
+    // the viewers keep the last frame, until the application is back
+    m_connectTimer.start();
+}
+
+void VncFrameSubscriber::readFrame()
+{
+    QRegion damage;
+
+    if ( m_ring.read( m_sequence, m_image, damage ) )
+    {
+        m_frameRequested.storeRelease( 0 );
+        m_server->setFrameBuffer( m_image, damage );
+    }
+}
+
+void VncFrameSubscriber::requestFrame()
+{
+    // one request until the next frame has arrived
+    if ( m_frameRequested.testAndSetOrdered( 0, 1 ) )
+    {
+        QMetaObject::invokeMethod( this, "sendMessage", Qt::QueuedConnection,
+            Q_ARG( int, VncRingMessage::FrameRequest ),
+            Q_ARG( int, 0 ), Q_ARG( int, 0 ), Q_ARG( int, 0 ) );
+    }
+}
+
+void VncFrameSubscriber::sendPointerEvent( const QPoint& pos, quint8 buttonMask )
+{
+    QMetaObject::invokeMethod( this, "sendMessage", Qt::QueuedConnection,
+        Q_ARG( int, VncRingMessage::Pointer ),
+        Q_ARG( int, buttonMask ), Q_ARG( int, pos.x() ), Q_ARG( int, pos.y() ) );
+}
+
+void VncFrameSubscriber::sendKeyEvent( quint32 key, bool down )
+{
+    QMetaObject::invokeMethod( this, "sendMessage", Qt::QueuedConnection,
+        Q_ARG( int, VncRingMessage::Key ),
+        Q_ARG( int, down ? 1 : 0 ), Q_ARG( int, int( key ) ), Q_ARG( int, 0 ) );
+}
+
+void VncFrameSubscriber::sendMessage( int type, int flags, int value1, int value2 )
+{
+    if ( m_socket == nullptr )
+    {
+        if ( type == VncRingMessage::FrameRequest )
+            m_frameRequested.storeRelease( 0 );
+
+        return;
+    }
+
+    VncRingMessage message;
+    memset( &message, 0, sizeof( message ) );
+
+    message.type = quint8( type );
+    message.flags = quint8( flags );
+    message.value1 = value1;
+    message.value2 = value2;
+
+    m_socket->write( reinterpret_cast< const char* >( &message ), sizeof( message ) );
+    m_socket->flush();
+}
+
+#include "moc_VncFrameSubscriber.cpp"
@@ -0,0 +1,71 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include "VncFrameRing.h"
+
+#include <qobject.h>
+#include <qimage.h>
+#include <qtimer.h>
+#include <qatomic.h>
+
+class VncServer;
+class QLocalSocket;
+class QSocketNotifier;
+
+/*
+    The vnceglfs-server side of the out of process mode: the frames of
+    a VncFramePublisher are fed into a server without windows, while input
+    events and frame requests of the viewers are sent back.
+
+    When the application is not running or restarts the connection is
+    retried, while the viewers keep the last frame.
+ */
+class VncFrameSubscriber final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    VncFrameSubscriber( VncServer* );
+    ~VncFrameSubscriber() override;
+
+    void subscribe( const QString& path );
+    QString path() const;
+
+    // called from the client threads
+    void requestFrame();
+    void sendPointerEvent( const QPoint& pos, quint8 buttonMask );
+    void sendKeyEvent( quint32 key, bool down );
+
+  private Q_SLOTS:
+    void receiveRing();
+
+  private:
+    Q_INVOKABLE void sendMessage( int type, int flags, int value1, int value2 );
+
+    void connectToPublisher();
+    void abortConnecting();
+    void disconnectFromPublisher();
+    void readFrame();
+
+    VncServer* m_server;
+    QString m_path;
+
+    QLocalSocket* m_socket = nullptr;
+
+    // a connection, that has not yet received the ring
+    QSocketNotifier* m_notifier = nullptr;
+    int m_pendingFd = -1;
+
+    QTimer m_connectTimer;
+    QTimer m_pollTimer;
+
+    VncFrameRing m_ring;
+    quint64 m_sequence = 0;
+    QImage m_image;
+
+    QAtomicInt m_frameRequested;
+};
@@ -0,0 +1,109 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncGrabBudget.h"
+#include <qloggingcategory.h>
+
+Q_LOGGING_CATEGORY( logBudget, "vnceglfs.budget", QtWarningMsg )
+
+// export QT_LOGGING_RULES="vnceglfs.budget.info=true"
+
+namespace
+{
+    const qint64 nsPerMs = 1000000;
+
+    // gaps between frames beyond this limit are idle periods
+    const qreal maxFrameTime = 100.0;
+
+    const qint64 reportInterval = 2000 * nsPerMs;
+
+    inline qreal average( qreal value, qreal sample )
+    {
+        return ( value > 0.0 ) ? 0.9 * value + 0.1 * sample : sample;
+    }
+}
+
+VncGrabBudget::VncGrabBudget()
+{
+    m_clock.start();
+}
+
+void VncGrabBudget::setBudget( qreal ms )
+{
+    m_budget = qMax( ms, qreal( 0.0 ) );
+    m_nextGrab = 0;
+}
+
+void VncGrabBudget::setLoadLimit( int percent )
+{
+    m_loadLimit = qBound( 1, percent, 100 );
+    m_nextGrab = 0;
+}
+
+bool VncGrabBudget::isGrabAllowed()
+{
+    const auto now = m_clock.nsecsElapsed();
+
+    if ( m_lastFrame >= 0 )
+    {
+        const qreal frameTime = qreal( now - m_lastFrame ) / nsPerMs;
+        if ( frameTime < maxFrameTime )
+            m_frameTime = average( m_frameTime, frameTime );
+    }
+
+    m_lastFrame = now;
+    m_frames++;
+
+    if ( now - m_reportTime >= reportInterval )
+        report( now );
+
+    return now >= m_nextGrab;
+}
+
+void VncGrabBudget::addGrab( qint64 nsecs )
+{
+    m_grabTime = average( m_grabTime, qreal( nsecs ) / nsPerMs );
+    m_grabs++;
+
+    const auto load = maxLoad();
+
+    if ( load >= 1.0 )
+    {
+        m_nextGrab = 0;
+    }
+    else
+    {
+        // the grab needs to be amortized by the following frames
+        const auto start = m_clock.nsecsElapsed() - nsecs;
+        m_nextGrab = start + static_cast< qint64 >( nsecs / load );
+    }
+}
+
+qreal VncGrabBudget::maxLoad() const
+{
+    qreal load = 0.01 * m_loadLimit;
+
+    if ( m_budget > 0.0 && m_frameTime > 0.0 )
+        load = qMin( load, m_budget / m_frameTime );
+
+    return load;
+}
+
+void VncGrabBudget::report( qint64 now )
+{
+    if ( m_reportTime > 0 && m_frames > 0 )
+    {
+        const qreal seconds = qreal( now - m_reportTime ) / ( 1000 * nsPerMs );
+
+        qCInfo( logBudget ).nospace()
+            << "grabbed " << m_grabs << " of " << m_frames << " frames: "
+            << qRound( m_grabs / seconds ) << " of " << qRound( m_frames / seconds ) << " fps"
+            << ", grab: " << m_grabTime << "ms, frame: " << m_frameTime << "ms"
+            << ", max. load: " << qRound( 100 * maxLoad() ) << "%";
+    }
+
+    m_reportTime = now;
+    m_frames = m_grabs = 0;
+}
@@ -0,0 +1,69 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qelapsedtimer.h>
+
+/*
+    Grabbing a frame blocks the scene graph thread and might cost
+    several milliseconds. To protect the frame rate of the application
+    the average time being spent for grabbing can be limited.
+
+    The limit is given as milliseconds per rendered frame and/or as
+    percentage of the frame time. After each grab the following frames are
+    skipped until the average is back within the limits. So the viewer
+    receives less frames, while the application keeps its frame rate.
+ */
+class VncGrabBudget
+{
+  public:
+    VncGrabBudget();
+
+    // 0: unlimited
+    void setBudget( qreal ms );
+    qreal budget() const;
+
+    // 100: unlimited
+    void setLoadLimit( int percent );
+    int loadLimit() const;
+
+    // called for each rendered frame: false, when the frame has to be skipped
+    bool isGrabAllowed();
+
+    // called after each grab with its costs
+    void addGrab( qint64 nsecs );
+
+  private:
+    qreal maxLoad() const;
+    void report( qint64 now );
+
+    qreal m_budget = 0.0;
+    int m_loadLimit = 100;
+
+    QElapsedTimer m_clock;
+
+    // running averages in ms
+    qreal m_frameTime = 0.0;
+    qreal m_grabTime = 0.0;
+
+    qint64 m_lastFrame = -1;
+    qint64 m_nextGrab = 0;
+
+    // statistics for the reports
+    qint64 m_reportTime = 0;
+    int m_frames = 0;
+    int m_grabs = 0;
+};
+
+inline qreal VncGrabBudget::budget() const
+{
+    return m_budget;
+}
+
+inline int VncGrabBudget::loadLimit() const
+{
+    return m_loadLimit;
+}
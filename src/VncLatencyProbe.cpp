@@ -0,0 +1,138 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncLatencyProbe.h"
+#include "VncFrameHasher.h"
+
+#include <qimage.h>
+#include <qregion.h>
+#include <qloggingcategory.h>
+
+#include <algorithm>
+
+Q_LOGGING_CATEGORY( logLatency, "vnceglfs.latency", QtWarningMsg )
+
+// export QT_LOGGING_RULES="vnceglfs.latency.info=true"
+
+namespace
+{
+    const qint64 nsPerUs = 1000;
+
+    // measurements without response are given up after this timeout
+    const qint64 timeout = 5000 * 1000 * nsPerUs;
+
+    const int samplesPerReport = 20;
+
+    QString distribution( QVector< qint64 >& samples )
+    {
+        std::sort( samples.begin(), samples.end() );
+
+        auto ms = [&samples]( int percent )
+        {
+            const auto index = ( samples.count() - 1 ) * percent / 100;
+            return QString::number( samples[ index ] / 1000.0, 'f', 1 );
+        };
+
+        return QStringLiteral( "min: %1, median: %2, p95: %3, max: %4 ms" )
+            .arg( ms( 0 ), ms( 50 ), ms( 95 ), ms( 100 ) );
+    }
+}
+
+VncLatencyProbe::VncLatencyProbe()
+{
+    m_clock.start();
+}
+
+void VncLatencyProbe::setRect( const QRect& rect )
+{
+    QMutexLocker locker( &m_mutex );
+
+    m_rect = rect;
+    m_state = Idle;
+}
+
+QRect VncLatencyProbe::rect() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_rect;
+}
+
+bool VncLatencyProbe::startMeasurement( const QImage& frameBuffer )
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( m_rect.isEmpty() || !frameBuffer.rect().contains( m_rect ) )
+        return false;
+
+    const auto now = m_clock.nsecsElapsed();
+
+    if ( m_state != Idle )
+    {
+        if ( now - m_injectTime < timeout )
+            return false;
+
+        m_lost++;
+    }
+
+    m_fingerprint = VncFrameHasher::fingerprint( frameBuffer.copy( m_rect ) );
+
+    m_state = Injected;
+    m_injectTime = now;
+
+    return true;
+}
+
+void VncLatencyProbe::checkFrame( const QImage& frameBuffer, const QRegion& dirtyRegion )
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( m_state != Injected || !dirtyRegion.intersects( m_rect ) )
+        return;
+
+    if ( !frameBuffer.rect().contains( m_rect ) )
+        return;
+
+    const auto fingerprint = VncFrameHasher::fingerprint( frameBuffer.copy( m_rect ) );
+    if ( fingerprint != m_fingerprint )
+    {
+        m_state = Grabbed;
+        m_grabTime = m_clock.nsecsElapsed();
+    }
+}
+
+void VncLatencyProbe::checkSent( const QRegion& region )
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( m_state == Grabbed && region.intersects( m_rect ) )
+    {
+        addSample( m_clock.nsecsElapsed() );
+        m_state = Idle;
+    }
+}
+
+void VncLatencyProbe::addSample( qint64 sentTime )
+{
+    m_grabLatencies += ( m_grabTime - m_injectTime ) / nsPerUs;
+    m_sendLatencies += ( sentTime - m_grabTime ) / nsPerUs;
+    m_totalLatencies += ( sentTime - m_injectTime ) / nsPerUs;
+
+    if ( m_totalLatencies.count() >= samplesPerReport )
+        report();
+}
+
+void VncLatencyProbe::report()
+{
+    qCInfo( logLatency ).noquote() << "input to grab:" << distribution( m_grabLatencies );
+    qCInfo( logLatency ).noquote() << "grab to socket:" << distribution( m_sendLatencies );
+    qCInfo( logLatency ).noquote() << "input to socket:" << distribution( m_totalLatencies )
+        << "#samples:" << m_totalLatencies.count() << "#lost:" << m_lost;
+
+    m_grabLatencies.clear();
+    m_sendLatencies.clear();
+    m_totalLatencies.clear();
+
+    m_lost = 0;
+}
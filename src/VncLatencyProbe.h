@@ -0,0 +1,74 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qrect.h>
+#include <qmutex.h>
+#include <qvector.h>
+#include <qelapsedtimer.h>
+
+class QImage;
+class QRegion;
+
+/*
+    Measuring the latency between an input event and the moment,
+    when its visual response has been written to the socket of a viewer.
+
+    The server injects a click into the center of a probe rectangle - f.e.
+    an item, that toggles its color - through the same path as the input
+    of the viewers. Then the probe waits for the first grabbed frame,
+    where the content of the rectangle has changed and for this part
+    of the frame being sent.
+
+    The distributions of the stages are reported to "vnceglfs.latency.info".
+ */
+class VncLatencyProbe
+{
+  public:
+    VncLatencyProbe();
+
+    // in frame buffer coordinates, an empty rectangle disables the probe
+    void setRect( const QRect& );
+    QRect rect() const;
+
+    // GUI thread: false, when a measurement is in progress
+    bool startMeasurement( const QImage& frameBuffer );
+
+    // scene graph thread: after composing the frame buffer
+    void checkFrame( const QImage& frameBuffer, const QRegion& dirtyRegion );
+
+    // client threads: after region has been written to the socket
+    void checkSent( const QRegion& );
+
+  private:
+    void addSample( qint64 sentTime );
+    void report();
+
+    enum State
+    {
+        Idle,
+        Injected,
+        Grabbed
+    };
+
+    mutable QMutex m_mutex;
+
+    QRect m_rect;
+    State m_state = Idle;
+
+    quint64 m_fingerprint = 0;
+
+    QElapsedTimer m_clock;
+    qint64 m_injectTime = 0;
+    qint64 m_grabTime = 0;
+
+    // in microseconds
+    QVector< qint64 > m_grabLatencies;
+    QVector< qint64 > m_sendLatencies;
+    QVector< qint64 > m_totalLatencies;
+
+    int m_lost = 0;
+};
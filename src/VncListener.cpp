@@ -0,0 +1,273 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncListener.h"
+
+#include <qtcpserver.h>
+#include <qlocalserver.h>
+#include <qstring.h>
+
+#if defined( Q_OS_LINUX ) && QT_VERSION >= QT_VERSION_CHECK( 5, 10, 0 )
+    // QLocalServer::listen( qintptr ) accepts any stream socket
+    #define VNC_VSOCK
+#endif
+
+#ifdef VNC_VSOCK
+#include <sys/socket.h>
+#include <linux/vm_sockets.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace
+{
+    class TcpServer final : public QTcpServer
+    {
+      public:
+        TcpServer( VncListener* listener )
+            : QTcpServer( listener )
+            , m_listener( listener )
+        {
+        }
+
+      protected:
+        void incomingConnection( qintptr socketDescriptor ) override
+        {
+            /*
+                We do not want to use QTcpServer::nextPendingConnection to avoid
+                QTcpSocket being created in the wrong thread
+             */
+            Q_EMIT m_listener->connectionRequested( socketDescriptor );
+        }
+
+      private:
+        VncListener* m_listener;
+    };
+
+    class LocalServer final : public QLocalServer
+    {
+      public:
+        LocalServer( VncListener* listener )
+            : QLocalServer( listener )
+            , m_listener( listener )
+        {
+        }
+
+      protected:
+        void incomingConnection( quintptr socketDescriptor ) override
+        {
+            Q_EMIT m_listener->connectionRequested( socketDescriptor );
+        }
+
+      private:
+        VncListener* m_listener;
+    };
+
+    int openVSock( int port )
+    {
+#ifdef VNC_VSOCK
+        const int fd = ::socket( AF_VSOCK, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+        if ( fd < 0 )
+            return -1;
+
+        struct sockaddr_vm addr;
+        memset( &addr, 0, sizeof( addr ) );
+
+        addr.svm_family = AF_VSOCK;
+        addr.svm_cid = VMADDR_CID_ANY;
+        addr.svm_port = ( port >= 0 ) ? port : VMADDR_PORT_ANY;
+
+        if ( ::bind( fd, reinterpret_cast< struct sockaddr* >( &addr ), sizeof( addr ) ) != 0
+            || ::listen( fd, 8 ) != 0 )
+        {
+            ::close( fd );
+            return -1;
+        }
+
+        return fd;
+#else
+        Q_UNUSED( port )
+        return -1;
+#endif
+    }
+
+    int vsockPort( int fd )
+    {
+#ifdef VNC_VSOCK
+        // the port being assigned for VMADDR_PORT_ANY
+        struct sockaddr_vm addr;
+        memset( &addr, 0, sizeof( addr ) );
+
+        socklen_t length = sizeof( addr );
+
+        if ( ::getsockname( fd, reinterpret_cast< struct sockaddr* >( &addr ), &length ) == 0 )
+            return static_cast< int >( addr.svm_port );
+#else
+        Q_UNUSED( fd )
+#endif
+        return -1;
+    }
+}
+
+VncListener::VncListener( Transport transport, QObject* parent )
+    : QObject( parent )
+    , m_transport( transport )
+{
+}
+
+VncListener::~VncListener()
+{
+    close();
+}
+
+VncListener* VncListener::create( const QString& address, QObject* parent )
+{
+    const auto pos = address.indexOf( QLatin1Char( ':' ) );
+    if ( pos <= 0 )
+        return nullptr;
+
+    const auto scheme = address.left( pos ).trimmed().toLower();
+    const auto value = address.mid( pos + 1 ).trimmed();
+
+    Transport transport;
+
+    if ( scheme == QLatin1String( "tcp" ) )
+        transport = Tcp;
+    else if ( scheme == QLatin1String( "ws" ) )
+        transport = WebSocket;
+    else if ( scheme == QLatin1String( "unix" ) )
+        transport = Local;
+    else if ( scheme == QLatin1String( "vsock" ) )
+        transport = VSock;
+    else
+        return nullptr;
+
+    auto listener = new VncListener( transport, parent );
+
+    bool ok;
+
+    if ( transport == Local )
+    {
+        ok = listener->listen( value );
+    }
+    else
+    {
+        const auto port = value.toInt( &ok );
+        ok = ok && listener->listen( port );
+    }
+
+    if ( !ok )
+    {
+        delete listener;
+        listener = nullptr;
+    }
+
+    return listener;
+}
+
+bool VncListener::listen( int port )
+{
+    close();
+
+    if ( m_transport == Tcp || m_transport == WebSocket )
+    {
+        auto server = new TcpServer( this );
+        m_server = server;
+
+        if ( server->listen( QHostAddress::Any, port ) )
+        {
+            m_port = server->serverPort();
+            return true;
+        }
+    }
+    else if ( m_transport == VSock )
+    {
+        const auto fd = openVSock( port );
+        if ( fd >= 0 )
+        {
+#ifdef VNC_VSOCK
+            auto server = new LocalServer( this );
+            m_server = server;
+
+            const auto boundPort = vsockPort( fd );
+
+            // the fd is owned and closed by the server, when listening
+            if ( server->listen( fd ) )
+            {
+                m_port = boundPort;
+                return true;
+            }
+
+            ::close( fd );
+#endif
+        }
+    }
+
+    close();
+    return false;
+}
+
+bool VncListener::listen( const QString& path )
+{
+    close();
+
+    if ( m_transport == Local && !path.isEmpty() )
+    {
+        auto server = new LocalServer( this );
+        m_server = server;
+
+        // removing a socket file left from a crashed process
+        QLocalServer::removeServer( path );
+
+        if ( server->listen( path ) )
+            return true;
+    }
+
+    close();
+    return false;
+}
+
+bool VncListener::isListening() const
+{
+    return m_server != nullptr;
+}
+
+int VncListener::port() const
+{
+    return m_port;
+}
+
+QString VncListener::address() const
+{
+    switch( m_transport )
+    {
+        case Tcp:
+            return QStringLiteral( "tcp:%1" ).arg( m_port );
+
+        case WebSocket:
+            return QStringLiteral( "ws:%1" ).arg( m_port );
+
+        case Local:
+        {
+            const auto server = static_cast< const QLocalServer* >( m_server );
+            return QStringLiteral( "unix:%1" ).arg( server ? server->fullServerName() : QString() );
+        }
+
+        case VSock:
+            return QStringLiteral( "vsock:%1" ).arg( m_port );
+    }
+
+    return QString();
+}
+
+void VncListener::close()
+{
+    delete m_server;
+
+    m_server = nullptr;
+    m_port = -1;
+}
+
+#include "moc_VncListener.cpp"
@@ -0,0 +1,76 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qobject.h>
+
+class QString;
+
+/*
+    Accepting connections for a server. Beside TCP a server might
+    listen on local transports, that avoid the overhead of the TCP stack
+    for viewers on the same device or in a guest of a virtual machine.
+
+    Listeners never create socket objects. They pass the descriptor of
+    an accepted connection, so that the socket can be created in the
+    thread of the client.
+ */
+class VncListener final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    enum Transport
+    {
+        Tcp,
+        WebSocket,
+        Local, // Unix domain socket
+        VSock  // AF_VSOCK
+    };
+
+    Q_ENUM( Transport )
+
+    VncListener( Transport, QObject* parent = nullptr );
+    ~VncListener() override;
+
+    /*
+        "tcp:<port>", "ws:<port>", "unix:<path>", "vsock:<port>".
+        nullptr, when the address is invalid or listening failed.
+     */
+    static VncListener* create( const QString& address, QObject* parent = nullptr );
+
+    Transport transport() const;
+
+    // Tcp, WebSocket, VSock
+    bool listen( int port );
+
+    // Local
+    bool listen( const QString& path );
+
+    bool isListening() const;
+
+    // -1 for Unix domain sockets
+    int port() const;
+
+    // for log messages
+    QString address() const;
+
+  Q_SIGNALS:
+    void connectionRequested( qintptr fd );
+
+  private:
+    void close();
+
+    const Transport m_transport;
+
+    QObject* m_server = nullptr;
+    int m_port = -1;
+};
+
+inline VncListener::Transport VncListener::transport() const
+{
+    return m_transport;
+}
@@ -5,9 +5,13 @@
 
 #include "VncNamespace.h"
 #include "VncServer.h"
+#include "VncCpuGovernor.h"
+#include "VncThreadPolicy.h"
 
 #include <qguiapplication.h>
 #include <qwindow.h>
+#include <qtimer.h>
+#include <qpointer.h>
 #include <qdebug.h>
 
 namespace
@@ -27,47 +31,133 @@ namespace
         void setInitialPort( int );
         int initialPort() const;
 
+        void setInitialWebSocketPort( int );
+        int initialWebSocketPort() const;
+
         void setName( const QString& name );
         QString name() const;
 
         void setPassword( const QByteArray& password );
         QByteArray password() const;
 
+        void setCompositionEnabled( bool );
+        bool isCompositionEnabled() const;
+
+        void setScaleFactor( qreal );
+        qreal scaleFactor() const;
+
+        void setGrabBudget( qreal ms );
+        qreal grabBudget() const;
+
+        void setGrabLoadLimit( int percent );
+        int grabLoadLimit() const;
+
+        void setLosslessRefreshDelay( int ms );
+        int losslessRefreshDelay() const;
+
+        void setCpuBudget( int percent );
+        int cpuBudget() const;
+
+        void setThreadAffinity( Vnc::ThreadRole, const QList< int >& cpus );
+        QList< int > threadAffinity( Vnc::ThreadRole ) const;
+
+        void setThreadScheduling( Vnc::ThreadRole, Vnc::ThreadScheduling, int nice );
+        Vnc::ThreadScheduling threadScheduling( Vnc::ThreadRole ) const;
+        int threadNiceness( Vnc::ThreadRole ) const;
+
         bool startServer( QWindow*, int port );
         void stopServer( const QWindow* );
 
+        bool startPublishing( const QWindow*, const QString& path );
+        bool startRemoteServer( const QString& path, int port );
+
         VncServer* server( const QWindow* ) const;
         int serverPort( const QWindow* ) const;
+        int webSocketPort( const QWindow* ) const;
+
+        bool addListener( const QWindow*, const QString& address );
+        void setLatencyProbe( const QWindow*, const QRect&, int interval );
 
         QList< QWindow* > windows() const;
 
-      private:
+        bool startRecording( const QWindow*, const QString& fileName );
+        void stopRecording( const QWindow* );
+
+        bool startReplay( const QWindow*, const QString& fileName, bool maxSpeed );
+        void stopReplay( const QWindow* );
+
+      protected:
         bool eventFilter( QObject*, QEvent* ) override;
 
+      private:
+        void addListeners( VncServer*, int port );
+
+        void attachWindows();
+        void attachWindow( QWindow* );
+        void detachWindow( QWindow* );
+        void detachWindows();
+
         int nextPort() const;
         bool isPortUsed( int port ) const;
 
+        int nextWebSocketPort() const;
+
         bool m_autoStart = false;
+        bool m_composition = false;
         int m_timerInterval = 30;
+        qreal m_scaleFactor = 1.0;
+
+        qreal m_grabBudget = 0.0;
+        int m_grabLoadLimit = 100;
+
+        int m_refreshDelay = 500;
+
+        // evaluating the CPU time being spent for VNC
+        QTimer m_governorTimer;
 
         QString m_name = QStringLiteral( "VNC Server for Qt/Quick on EGLFS" );
         QByteArray m_password;
 
         int m_port = -1;
+        int m_webSocketPort = -1;
+
         QVector< VncServer* > m_servers; // usually <= 1
+
+        // top level windows being observed in autoStart mode
+        QVector< QWindow* > m_windows;
     };
 
-    inline bool isOpenGLQuickWindow( const QObject* object )
+    inline bool isSupportedQuickWindow( const QObject* object )
     {
         // no qobject_cast to avoid dependencies to Qt/Quick classes
         if ( object && object->inherits( "QQuickWindow" ) )
         {
+#ifdef VNC_RHI
+            // other graphics APIs are grabbed with QRhi readbacks
+            return true;
+#else
             auto window = qobject_cast< const QWindow* >( object );
+
+#ifdef VNC_SOFTWARE
+            // the software adaptation renders into a raster surface
+            if ( window->surfaceType() == QSurface::RasterSurface )
+                return true;
+#endif
+
             return window->supportsOpenGL();
+#endif
         }
 
         return false;
     }
+
+    inline QString effectiveFileName( const QString& fileName, int port )
+    {
+        if ( fileName.contains( QStringLiteral( "%1" ) ) )
+            return fileName.arg( port );
+
+        return fileName;
+    }
 }
 
 VncManager::VncManager()
@@ -78,6 +168,10 @@ VncManager::VncManager()
     if ( !ok )
         m_port = 5900; // default port for VNC
 
+    m_webSocketPort = qEnvironmentVariableIntValue( "QVNC_GL_WEBSOCKET_PORT", &ok );
+    if ( !ok )
+        m_webSocketPort = -1; // no WebSocket
+
     m_timerInterval = qEnvironmentVariableIntValue( "QVNC_GL_TIMER_INTERVAL", &ok );
     if ( !ok )
         m_timerInterval = 30;
@@ -87,6 +181,45 @@ VncManager::VncManager()
     const auto password = qgetenv( "QVNC_GL_PASSWORD" );
     if ( !password.isEmpty() )
         setPassword( password );
+
+    m_composition = qEnvironmentVariableIntValue( "QVNC_GL_COMPOSITION" ) > 0;
+
+    const auto scaleFactor = qgetenv( "QVNC_GL_SCALE_FACTOR" ).toDouble( &ok );
+    if ( ok )
+        setScaleFactor( scaleFactor );
+
+    const auto grabBudget = qgetenv( "QVNC_GL_GRAB_BUDGET" ).toDouble( &ok );
+    if ( ok )
+        setGrabBudget( grabBudget );
+
+    const auto grabLoadLimit = qEnvironmentVariableIntValue( "QVNC_GL_GRAB_LOAD", &ok );
+    if ( ok )
+        setGrabLoadLimit( grabLoadLimit );
+
+    const auto refreshDelay = qEnvironmentVariableIntValue( "QVNC_GL_REFRESH_DELAY", &ok );
+    if ( ok )
+        setLosslessRefreshDelay( refreshDelay );
+
+    m_governorTimer.setInterval( 1000 );
+    connect( &m_governorTimer, &QTimer::timeout,
+        []() { VncCpuGovernor::instance()->update(); } );
+
+    const auto cpuBudget = qEnvironmentVariableIntValue( "QVNC_GL_CPU_BUDGET", &ok );
+    if ( ok )
+        setCpuBudget( cpuBudget );
+
+    const char* threadVariables[] =
+        { "QVNC_GL_IO_THREADS", "QVNC_GL_ENCODE_THREADS", "QVNC_GL_WORKER_THREADS" };
+
+    for ( int role = Vnc::IOThreads; role <= Vnc::WorkerThreads; role++ )
+    {
+        const auto specification = qgetenv( threadVariables[ role ] );
+        if ( !specification.isEmpty() )
+        {
+            VncThreadPolicy::instance()->setSpecification(
+                static_cast< Vnc::ThreadRole >( role ), specification );
+        }
+    }
 }
 
 VncManager::~VncManager()
@@ -96,27 +229,126 @@ VncManager::~VncManager()
 
 bool VncManager::startServer( QWindow* window, int port )
 {
-    if ( !isOpenGLQuickWindow( window ) )
+    if ( !isSupportedQuickWindow( window ) )
         return false;
 
     for ( const auto server : m_servers )
     {
-        if ( server->window() == window || server->port() == port )
+        if ( server->hasWindow( window ) )
             return false;
     }
 
+    if ( m_composition && !m_servers.isEmpty() )
+    {
+        // all windows are composed into the frame buffer of the same server
+
+        auto server = m_servers.first();
+        if ( port < 0 || port == server->port() )
+        {
+            server->addWindow( window );
+            return true;
+        }
+    }
+
+    if ( isPortUsed( port ) )
+        return false;
+
     if ( port < 0 )
         port = nextPort();
 
-    m_servers += new VncServer( port, window );
+    auto server = new VncServer( port, window );
+    m_servers += server;
+
+    // f.e. "/run/vnceglfs%1.sock"
+    const auto publishPath = QString::fromLocal8Bit( qgetenv( "QVNC_GL_PUBLISH" ) );
+    if ( !publishPath.isEmpty() )
+    {
+        // the viewers are handled by a vnceglfs-server process
+        server->startPublishing( effectiveFileName( publishPath, port ) );
+    }
+    else
+    {
+        addListeners( server, port );
+    }
+
+    // "x,y,w,h[,interval]"
+    const auto probe = qgetenv( "QVNC_GL_LATENCY_PROBE" ).split( ',' );
+    if ( probe.count() >= 4 )
+    {
+        const QRect rect( probe[0].toInt(), probe[1].toInt(),
+            probe[2].toInt(), probe[3].toInt() );
+
+        const int interval = ( probe.count() > 4 ) ? probe[4].toInt() : 1000;
+        server->setLatencyProbe( rect, interval );
+    }
+
+    const auto recordFile = QString::fromLocal8Bit( qgetenv( "QVNC_GL_RECORD" ) );
+    if ( !recordFile.isEmpty() )
+        server->startRecording( effectiveFileName( recordFile, port ) );
+
+    const auto replayFile = QString::fromLocal8Bit( qgetenv( "QVNC_GL_REPLAY" ) );
+    if ( !replayFile.isEmpty() )
+    {
+        const bool maxSpeed = qEnvironmentVariableIntValue( "QVNC_GL_REPLAY_MAXSPEED" ) > 0;
+        server->startReplay( effectiveFileName( replayFile, port ), maxSpeed );
+    }
+
     return true;
 }
 
+bool VncManager::startRemoteServer( const QString& path, int port )
+{
+    if ( isPortUsed( port ) )
+        return false;
+
+    if ( port < 0 )
+        port = nextPort();
+
+    auto server = new VncServer( port, nullptr );
+    if ( !server->subscribe( path ) )
+    {
+        delete server;
+        return false;
+    }
+
+    m_servers += server;
+    addListeners( server, port );
+
+    return true;
+}
+
+bool VncManager::startPublishing( const QWindow* window, const QString& path )
+{
+    if ( auto srv = server( window ) )
+        return srv->startPublishing( path );
+
+    return false;
+}
+
+void VncManager::addListeners( VncServer* server, int port )
+{
+    if ( m_webSocketPort >= 0 )
+        server->addListener( QStringLiteral( "ws:%1" ).arg( nextWebSocketPort() ) );
+
+    // f.e "unix:/run/vnc%1.sock,vsock:%1"
+    const auto addresses = QString::fromLocal8Bit( qgetenv( "QVNC_GL_LISTEN" ) );
+    if ( !addresses.isEmpty() )
+    {
+        const auto list = addresses.split( QLatin1Char( ',' ) );
+        for ( const auto& address : list )
+            server->addListener( effectiveFileName( address, port ) );
+    }
+}
+
 void VncManager::stopServer( const QWindow* window )
 {
-    for ( auto server : m_servers )
+    if ( auto server = this->server( window ) )
     {
-        if ( server->window() == window )
+        if ( server->windows().count() > 1 )
+        {
+            server->removeWindow( window );
+        }
+        else
         {
             m_servers.removeOne( server );
             delete server;
@@ -128,7 +360,7 @@ VncServer* VncManager::server( const QWindow* window ) const
 {
     for ( auto server : m_servers )
     {
-        if ( server->window() == window )
+        if ( server->hasWindow( window ) )
             return server;
     }
 
@@ -143,21 +375,75 @@ int VncManager::serverPort( const QWindow* window ) const
     return -1;
 }
 
+int VncManager::webSocketPort( const QWindow* window ) const
+{
+    if ( auto srv = server( window ) )
+        return srv->webSocketPort();
+
+    return -1;
+}
+
+bool VncManager::addListener( const QWindow* window, const QString& address )
+{
+    if ( auto srv = server( window ) )
+        return srv->addListener( address );
+
+    return false;
+}
+
+void VncManager::setLatencyProbe( const QWindow* window, const QRect& rect, int interval )
+{
+    if ( auto srv = server( window ) )
+        srv->setLatencyProbe( rect, interval );
+}
+
 QList< QWindow* > VncManager::windows() const
 {
     QList< QWindow* > windows;
 
     for ( auto server : m_servers )
-        windows += server->window();
+        windows += server->windows();
 
     return windows;
 }
 
+bool VncManager::startRecording( const QWindow* window, const QString& fileName )
+{
+    if ( auto srv = server( window ) )
+        return srv->startRecording( fileName );
+
+    return false;
+}
+
+void VncManager::stopRecording( const QWindow* window )
+{
+    if ( auto srv = server( window ) )
+        srv->stopRecording();
+}
+
+bool VncManager::startReplay( const QWindow* window, const QString& fileName, bool maxSpeed )
+{
+    if ( auto srv = server( window ) )
+        return srv->startReplay( fileName, maxSpeed );
+
+    return false;
+}
+
+void VncManager::stopReplay( const QWindow* window )
+{
+    if ( auto srv = server( window ) )
+        srv->stopReplay();
+}
+
 bool VncManager::isPortUsed( int port ) const
 {
+    // -1: no specific port or no WebSocket listener
+    if ( port < 0 )
+        return false;
+
     for ( const auto server : m_servers )
     {
-        if ( port == server->port() )
+        if ( port == server->port() || port == server->webSocketPort() )
             return true;
     }
 
@@ -174,21 +460,104 @@ int VncManager::nextPort() const
     return port;
 }
 
-bool VncManager::eventFilter( QObject* object, QEvent* event )
+int VncManager::nextWebSocketPort() const
 {
-    if ( event->type() == QEvent::Expose )
+    auto port = initialWebSocketPort();
+
+    while( isPortUsed( port ) )
+        port++;
+
+    return port;
+}
+
+void VncManager::attachWindows()
+{
+    const auto windows = QGuiApplication::topLevelWindows();
+    for ( auto window : windows )
     {
-        if ( auto window = qobject_cast< QWindow* >( object ) )
-            startServer( window, -1 );
+        if ( isSupportedQuickWindow( window ) && !m_windows.contains( window ) )
+            attachWindow( window );
     }
-    else if ( event->type() == QEvent::Close )
+}
+
+void VncManager::attachWindow( QWindow* window )
+{
+    m_windows += window;
+
+    connect( window, &QWindow::visibleChanged, this,
+        [this, window]( bool on )
+        {
+            // closing a window also hides it
+            if ( on )
+                startServer( window, -1 );
+            else
+                stopServer( window );
+        }
+    );
+
+    connect( window, &QObject::destroyed,
+        this, [this, window]() { detachWindow( window ); } );
+
+    // for QEvent::Close
+    window->installEventFilter( this );
+
+    if ( window->isVisible() )
+        startServer( window, -1 );
+}
+
+bool VncManager::eventFilter( QObject* object, QEvent* event )
+{
+    // installed on the observed top level windows only
+
+    if ( event->type() == QEvent::Close )
     {
-        // TODO ...
+        /*
+            The application might ignore the close event. So we check
+            after it has been delivered, if the window is really gone.
+         */
+        QPointer< QWindow > window = static_cast< QWindow* >( object );
+
+        QTimer::singleShot( 0, this,
+            [this, window]()
+            {
+                if ( window && !window->isVisible() )
+                    stopServer( window );
+            }
+        );
     }
 
     return QObject::eventFilter( object, event );
 }
 
+void VncManager::detachWindow( QWindow* window )
+{
+    m_windows.removeOne( window );
+    stopServer( window );
+
+    // the server might have dropped the window already, when being destroyed
+    for ( int i = m_servers.count() - 1; i >= 0; i-- )
+    {
+        auto server = m_servers[i];
+        if ( server->windows().isEmpty() && !server->isSubscribed() )
+        {
+            m_servers.remove( i );
+            delete server;
+        }
+    }
+}
+
+void VncManager::detachWindows()
+{
+    const auto windows = m_windows;
+    for ( auto window : windows )
+    {
+        window->disconnect( this );
+        window->removeEventFilter( this );
+    }
+
+    m_windows.clear();
+}
+
 void VncManager::setTimerInterval( int ms )
 {
     ms = qMax( ms, 10 );
@@ -216,6 +585,16 @@ int VncManager::initialPort() const
     return m_port;
 }
 
+void VncManager::setInitialWebSocketPort( int port )
+{
+    m_webSocketPort = qMax( port, -1 );
+}
+
+int VncManager::initialWebSocketPort() const
+{
+    return m_webSocketPort;
+}
+
 void VncManager::setName( const QString& name )
 {
     m_name = name;
@@ -236,34 +615,156 @@ QByteArray VncManager::password() const
     return m_password;
 }
 
+void VncManager::setCompositionEnabled( bool on )
+{
+    m_composition = on;
+}
+
+bool VncManager::isCompositionEnabled() const
+{
+    return m_composition;
+}
+
+void VncManager::setScaleFactor( qreal factor )
+{
+    if ( factor > 0.0 )
+    {
+        // the scaler supports integer divisors only
+        const int divisor = qBound( 1, qRound( 1.0 / factor ), 8 );
+        m_scaleFactor = 1.0 / divisor;
+    }
+}
+
+qreal VncManager::scaleFactor() const
+{
+    return m_scaleFactor;
+}
+
+void VncManager::setGrabBudget( qreal ms )
+{
+    ms = qMax( ms, qreal( 0.0 ) );
+    if ( ms != m_grabBudget )
+    {
+        m_grabBudget = ms;
+        for ( auto server : m_servers )
+            server->setGrabBudget( m_grabBudget, m_grabLoadLimit );
+    }
+}
+
+qreal VncManager::grabBudget() const
+{
+    return m_grabBudget;
+}
+
+void VncManager::setGrabLoadLimit( int percent )
+{
+    percent = qBound( 1, percent, 100 );
+    if ( percent != m_grabLoadLimit )
+    {
+        m_grabLoadLimit = percent;
+        for ( auto server : m_servers )
+            server->setGrabBudget( m_grabBudget, m_grabLoadLimit );
+    }
+}
+
+int VncManager::grabLoadLimit() const
+{
+    return m_grabLoadLimit;
+}
+
+void VncManager::setLosslessRefreshDelay( int ms )
+{
+    m_refreshDelay = qMax( ms, 0 );
+}
+
+int VncManager::losslessRefreshDelay() const
+{
+    return m_refreshDelay;
+}
+
+void VncManager::setCpuBudget( int percent )
+{
+    auto governor = VncCpuGovernor::instance();
+    governor->setBudget( percent );
+
+    if ( governor->budget() > 0 )
+        m_governorTimer.start();
+    else
+        m_governorTimer.stop();
+}
+
+int VncManager::cpuBudget() const
+{
+    return VncCpuGovernor::instance()->budget();
+}
+
+void VncManager::setThreadAffinity( Vnc::ThreadRole role, const QList< int >& cpus )
+{
+    VncThreadPolicy::instance()->setAffinity( role, cpus );
+}
+
+QList< int > VncManager::threadAffinity( Vnc::ThreadRole role ) const
+{
+    return VncThreadPolicy::instance()->affinity( role );
+}
+
+void VncManager::setThreadScheduling( Vnc::ThreadRole role,
+    Vnc::ThreadScheduling scheduling, int nice )
+{
+    VncThreadPolicy::instance()->setScheduling( role, scheduling, nice );
+}
+
+Vnc::ThreadScheduling VncManager::threadScheduling( Vnc::ThreadRole role ) const
+{
+    return VncThreadPolicy::instance()->scheduling( role );
+}
+
+int VncManager::threadNiceness( Vnc::ThreadRole role ) const
+{
+    return VncThreadPolicy::instance()->niceness( role );
+}
+
 void VncManager::setAutoStartEnabled( bool on )
 {
     if ( on == m_autoStart )
         return;
 
-    auto app = QCoreApplication::instance();
+    auto app = qobject_cast< QGuiApplication* >( QCoreApplication::instance() );
 
     if ( on )
     {
         if ( app == nullptr )
         {
             // TODO: using Q_COREAPP_STARTUP_FUNCTION instead of giving up
-            qWarning("VNC: you need to create the QCoreApplication instance first");
+            qWarning("VNC: you need to create the QGuiApplication instance first");
             return;
         }
 
-        for ( auto window : QGuiApplication::topLevelWindows() )
-        {
-            if ( window->isExposed() )
-                startServer( window, -1 );
-        }
+        /*
+            Filtering the events of the application would put us on the path
+            of each event of the process. Instead we observe the top level
+            windows and look for new ones, whenever the focus window
+            changes or screens are added. New windows on EGLFS usually
+            become the focus window, when being shown.
+         */
+
+        connect( app, &QGuiApplication::focusWindowChanged,
+            this, [this]() { attachWindows(); } );
+
+        connect( app, &QGuiApplication::screenAdded,
+            this, [this]() { attachWindows(); } );
+
+        attachWindows();
 
-        app->installEventFilter( this );
+        // windows, that have been created before entering the event loop
+        QTimer::singleShot( 0, this, [this]() { if ( m_autoStart ) attachWindows(); } );
     }
     else
     {
         if ( app )
-            app->removeEventFilter( this );
+            app->disconnect( this );
+
+        detachWindows();
     }
 
     m_autoStart = on;
@@ -284,18 +785,69 @@ namespace Vnc
     void setInitialPort( int port ) { vncManager->setInitialPort( port ); }
     int initialPort() { return vncManager->initialPort(); }
 
+    void setInitialWebSocketPort( int port ) { vncManager->setInitialWebSocketPort( port ); }
+    int initialWebSocketPort() { return vncManager->initialWebSocketPort(); }
+
     void setName( const QString& name ) { vncManager->setName( name ); }
     QString name() { return vncManager->name(); }
 
     void setPassword( const QByteArray& password ) { vncManager->setPassword( password ); }
     QByteArray password() { return vncManager->password(); }
 
+    void setCompositionEnabled( bool on ) { vncManager->setCompositionEnabled( on ); }
+    bool isCompositionEnabled() { return vncManager->isCompositionEnabled(); }
+
+    void setScaleFactor( qreal factor ) { vncManager->setScaleFactor( factor ); }
+    qreal scaleFactor() { return vncManager->scaleFactor(); }
+
+    void setGrabBudget( qreal ms ) { vncManager->setGrabBudget( ms ); }
+    qreal grabBudget() { return vncManager->grabBudget(); }
+
+    void setGrabLoadLimit( int percent ) { vncManager->setGrabLoadLimit( percent ); }
+    int grabLoadLimit() { return vncManager->grabLoadLimit(); }
+
+    void setLosslessRefreshDelay( int ms ) { vncManager->setLosslessRefreshDelay( ms ); }
+    int losslessRefreshDelay() { return vncManager->losslessRefreshDelay(); }
+
+    void setCpuBudget( int percent ) { vncManager->setCpuBudget( percent ); }
+    int cpuBudget() { return vncManager->cpuBudget(); }
+
+    void setThreadAffinity( ThreadRole role, const QList< int >& cpus )
+        { vncManager->setThreadAffinity( role, cpus ); }
+    QList< int > threadAffinity( ThreadRole role ) { return vncManager->threadAffinity( role ); }
+
+    void setThreadScheduling( ThreadRole role, ThreadScheduling scheduling, int nice )
+        { vncManager->setThreadScheduling( role, scheduling, nice ); }
+    ThreadScheduling threadScheduling( ThreadRole role ) { return vncManager->threadScheduling( role ); }
+    int threadNiceness( ThreadRole role ) { return vncManager->threadNiceness( role ); }
+
     void setAutoStartEnabled( bool on ) { vncManager->setAutoStartEnabled( on ); }
     bool isAutoStartEnabled() { return vncManager->isAutoStartEnabled(); }
 
     bool startServer( QWindow* w, int port ) { return vncManager->startServer( w, port ); }
     void stopServer( const QWindow* w ) { vncManager->stopServer( w ); }
 
+    bool startPublishing( const QWindow* w, const QString& path )
+        { return vncManager->startPublishing( w, path ); }
+
+    bool startRemoteServer( const QString& path, int port )
+        { return vncManager->startRemoteServer( path, port ); }
+
     QList< QWindow* > windows() { return vncManager->windows(); }
     int serverPort( const QWindow* w ) { return vncManager->serverPort( w ); }
+    int webSocketPort( const QWindow* w ) { return vncManager->webSocketPort( w ); }
+
+    bool addListener( const QWindow* w, const QString& address )
+        { return vncManager->addListener( w, address ); }
+
+    void setLatencyProbe( const QWindow* w, const QRect& rect, int interval )
+        { vncManager->setLatencyProbe( w, rect, interval ); }
+
+    bool startRecording( const QWindow* w, const QString& fileName )
+        { return vncManager->startRecording( w, fileName ); }
+    void stopRecording( const QWindow* w ) { vncManager->stopRecording( w ); }
+
+    bool startReplay( const QWindow* w, const QString& fileName, bool maxSpeed )
+        { return vncManager->startReplay( w, fileName, maxSpeed ); }
+    void stopReplay( const QWindow* w ) { vncManager->stopReplay( w ); }
 }
@@ -10,6 +10,7 @@
 #include <qlist.h>
 
 class QWindow;
+class QRect;
 
 #if defined( VNC_MAKEDLL )
     #define VNC_EXPORT Q_DECL_EXPORT
@@ -44,6 +45,31 @@ namespace Vnc
      */
     VNC_EXPORT int initialPort();
 
+    /*!
+        \brief Set the initial port for WebSocket connections
+
+        Browser based viewers like noVNC connect via WebSocket. When the port
+        is >= 0 each server accepts WebSocket connections on the first
+        unused port >= initial WebSocket port.
+
+        \param port Port number, -1 disables WebSocket connections
+        \sa initialWebSocketPort(), webSocketPort()
+        \note Affects servers started afterwards only
+     */
+    VNC_EXPORT void setInitialWebSocketPort( int port );
+
+    /*!
+        \brief Initial port for WebSocket connections
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_WEBSOCKET_PORT. If QVNC_GL_WEBSOCKET_PORT is not set
+        the default value is -1 ( disabled ).
+
+        \sa setInitialWebSocketPort()
+        \return initial WebSocket port
+     */
+    VNC_EXPORT int initialWebSocketPort();
+
 
     /*!
         \brief Name of the Screen in ServerInit VNC message
@@ -89,12 +115,254 @@ namespace Vnc
      */
     VNC_EXPORT int timerInterval();
 
+    /*!
+        \brief Enable composing windows into one frame buffer
+
+        When composition is enabled all windows are mirrored by one server,
+        where each window is placed according to its geometry. This
+        is useful for devices with several screens, where each screen
+        is covered by a window. Viewers supporting the "ExtendedDesktopSize"
+        pseudo encoding receive the geometries as screen layout.
+
+        Otherwise each window has its own server and port.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_COMPOSITION.
+
+        \note Composition affects servers being started after enabling it only
+        \sa isCompositionEnabled(), startServer()
+     */
+    VNC_EXPORT void setCompositionEnabled( bool on );
+
+    /*!
+        \return True, when windows are composed into one frame buffer
+        \sa setCompositionEnabled()
+     */
+    VNC_EXPORT bool isCompositionEnabled();
+
+    /*!
+        \brief Set the initial scale factor for the frame buffer sent to viewers
+
+        Downscaling is done on the server side, so that viewers with small screens
+        or slow connections do not receive pixels, that would be thrown away by
+        their own scaling anyway. The factor is rounded to 1/n with n in [1, 8].
+
+        Viewers supporting the "ExtendedDesktopSize" pseudo encoding can
+        request a smaller size, what changes the factor for this viewer only.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_SCALE_FACTOR. If QVNC_GL_SCALE_FACTOR is not set the default
+        value is 1.0.
+
+        \note The factor affects viewers connecting after changing it only
+        \sa scaleFactor()
+     */
+    VNC_EXPORT void setScaleFactor( qreal factor );
+
+    /*!
+        \return Initial scale factor for the frame buffer sent to viewers
+        \sa setScaleFactor()
+     */
+    VNC_EXPORT qreal scaleFactor();
+
+    /*!
+        \brief Limit the time being spent for grabbing frames
+
+        Grabbing a frame blocks the render thread of the window. To protect
+        the frame rate of the application, frames are skipped, so that the
+        average time for grabbing does not exceed the budget per rendered frame.
+        The viewers will receive less frames in this case.
+
+        The achieved grab rate is reported to the "vnceglfs.budget"
+        logging category.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_GRAB_BUDGET. If QVNC_GL_GRAB_BUDGET is not set the default
+        value is 0, what means unlimited.
+
+        \param ms Milliseconds per rendered frame
+        \sa grabBudget(), setGrabLoadLimit()
+     */
+    VNC_EXPORT void setGrabBudget( qreal ms );
+
+    /*!
+        \return Milliseconds per rendered frame, that can be spent for grabbing
+        \sa setGrabBudget()
+     */
+    VNC_EXPORT qreal grabBudget();
+
+    /*!
+        \brief Limit the time being spent for grabbing frames relative to the frame time
+
+        Similar to setGrabBudget(), but the limit is a percentage of the
+        measured time between frames. When both limits are set the lower
+        one is effective.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_GRAB_LOAD. If QVNC_GL_GRAB_LOAD is not set the default
+        value is 100, what means unlimited.
+
+        \param percent Percentage of the frame time in [1, 100]
+        \sa grabLoadLimit(), setGrabBudget()
+     */
+    VNC_EXPORT void setGrabLoadLimit( int percent );
+
+    /*!
+        \return Percentage of the frame time, that can be spent for grabbing
+        \sa setGrabLoadLimit()
+     */
+    VNC_EXPORT int grabLoadLimit();
+
+    /*!
+        \brief Set the delay for refreshing lossy parts of the frame buffer
+
+        Parts of the frame buffer, that have been sent as JPEG, are sent
+        again lossless, when nothing has been sent as JPEG for the delay
+        and the connection to the viewer is idle. So animations can be sent
+        with low quality, while static content ends up being sharp.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_REFRESH_DELAY. If QVNC_GL_REFRESH_DELAY is not set the default
+        value is 500.
+
+        \param ms Delay in milliseconds, 0 disables the refresh
+
+        \note The delay affects viewers connecting after changing it only
+        \sa losslessRefreshDelay()
+     */
+    VNC_EXPORT void setLosslessRefreshDelay( int ms );
+
+    /*!
+        \return Delay for refreshing lossy parts of the frame buffer
+        \sa setLosslessRefreshDelay()
+     */
+    VNC_EXPORT int losslessRefreshDelay();
+
+    /*!
+        \brief Limit the CPU time being spent for VNC
+
+        The CPU time for grabbing, encoding and sending frames of all
+        servers and clients is measured against the budget. When exceeding
+        it the quality is degraded step by step: lower JPEG quality,
+        then less frames per second, then downscaling - for viewers, that
+        support changing the size of the frame buffer. When being below
+        the budget for a while the restrictions are lifted again.
+
+        Level changes are reported to the "vnceglfs.governor" logging category.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_CPU_BUDGET. If QVNC_GL_CPU_BUDGET is not set the default
+        value is 0, what means unlimited.
+
+        \param percent Percentage of one CPU core
+        \sa cpuBudget(), setGrabBudget()
+     */
+    VNC_EXPORT void setCpuBudget( int percent );
+
+    /*!
+        \return Percentage of one CPU core, that can be spent for VNC
+        \sa setCpuBudget()
+     */
+    VNC_EXPORT int cpuBudget();
+
+    /*!
+        \brief Threads of the servers, that can be configured individually
+
+        - IOThreads: one thread for each viewer, reading and writing the socket
+        - EncodeThreads: threads, where the frames are encoded
+        - WorkerThreads: threads comparing frames and writing recordings
+
+        The render thread of the application is never modified.
+
+        \sa setThreadAffinity(), setThreadScheduling()
+     */
+    enum ThreadRole
+    {
+        IOThreads,
+        EncodeThreads,
+        WorkerThreads
+    };
+
+    /*!
+        \brief Scheduling policies for the threads of the servers
+
+        - NormalScheduling: SCHED_OTHER
+        - BatchScheduling: SCHED_BATCH, for CPU intensive threads without latency demands
+        - IdleScheduling: SCHED_IDLE, running only when nothing else wants the CPU
+
+        \sa setThreadScheduling()
+     */
+    enum ThreadScheduling
+    {
+        NormalScheduling,
+        BatchScheduling,
+        IdleScheduling
+    };
+
+    /*!
+        \brief Pin the threads of a role to a set of CPUs
+
+        On SoCs with big and little cores moving the threads of the servers
+        to the little cores avoids competing with the render thread.
+
+        The affinity is applied by the threads, when being started. The effective
+        setup is verified and reported to the "vnceglfs.threads" logging category.
+        ( Linux only )
+
+        The default value can be initialized by the environment variables
+        QVNC_GL_IO_THREADS, QVNC_GL_ENCODE_THREADS and QVNC_GL_WORKER_THREADS.
+
+        \param role Role of the threads
+        \param cpus CPU numbers, an empty list means all CPUs
+        \sa threadAffinity(), setThreadScheduling()
+     */
+    VNC_EXPORT void setThreadAffinity( ThreadRole role, const QList< int >& cpus );
+
+    /*!
+        \return CPUs, where the threads of a role are running on
+        \sa setThreadAffinity()
+     */
+    VNC_EXPORT QList< int > threadAffinity( ThreadRole role );
+
+    /*!
+        \brief Set the scheduling policy and the nice value for the threads of a role
+
+        The settings are applied by the threads, when being started. Lowering
+        the nice value below 0 needs CAP_SYS_NICE. The nice value is ignored
+        with IdleScheduling. ( Linux only )
+
+        The default value can be initialized by the environment variables
+        QVNC_GL_IO_THREADS, QVNC_GL_ENCODE_THREADS and QVNC_GL_WORKER_THREADS.
+
+        \param role Role of the threads
+        \param scheduling Scheduling policy
+        \param nice Nice value [-20, 19]
+        \sa threadScheduling(), threadNiceness(), setThreadAffinity()
+     */
+    VNC_EXPORT void setThreadScheduling( ThreadRole role,
+        ThreadScheduling scheduling, int nice = 0 );
+
+    /*!
+        \return Scheduling policy for the threads of a role
+        \sa setThreadScheduling()
+     */
+    VNC_EXPORT ThreadScheduling threadScheduling( ThreadRole role );
+
+    /*!
+        \return Nice value for the threads of a role
+        \sa setThreadScheduling()
+     */
+    VNC_EXPORT int threadNiceness( ThreadRole role );
+
     /*!
         \brief Enable the autoStart mode
 
         When autoStart is enabled VNC servers will be started
-        for all exposed QQuickWindow - or whenever a new QQuickWindow
-        gets exposed.
+        for all visible top level QQuickWindow - or whenever a new QQuickWindow
+        gets shown. When a window gets closed, hidden or destroyed its server is stopped.
+
+        New windows are detected, when the focus window changes or a screen is added.
+        Windows, that never get the focus, need to be started manually.
 
         Otherwise a server must be started manually by startServer()
 
@@ -130,16 +398,154 @@ namespace Vnc
      */
     VNC_EXPORT void stopServer( const QWindow* window );
 
+    /*!
+        \brief Hand over the viewers of a window to a vnceglfs-server process
+
+        The server of the window stops accepting viewers and publishes the grabbed
+        frames - with sequence numbers and damage - into shared memory instead. A
+        vnceglfs-server process connecting to path does the client handling and
+        encoding, so that the application pays for the grab only and an overloaded
+        or crashing VNC side can't take down the application.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_PUBLISH. A "%1" in the path is replaced by the port.
+
+        \param window Window mirrored by a server
+        \param path Unix domain socket, where to accept vnceglfs-server processes
+        \return true, when listening on path has been started
+
+        \sa startRemoteServer()
+        \note Linux only
+     */
+    VNC_EXPORT bool startPublishing( const QWindow* window, const QString& path );
+
+    /*!
+        \brief Start a VNC server for the frames published by another process
+
+        The counterpart of startPublishing(), that is used by the vnceglfs-server
+        executable. The server is running without windows: input of the viewers
+        is forwarded to the application. When the application is not running
+        the connection is retried periodically.
+
+        When the port is < 0 the next free port >= initialPort() will be used
+
+        \param path Unix domain socket of the application
+        \param port Port
+
+        \sa startPublishing()
+        \note Linux only
+     */
+    VNC_EXPORT bool startRemoteServer( const QString& path, int port = -1 );
+
     /*!
         \return Port used by the VNC server of window
         \sa startServer(), setInitialPort()
      */
     VNC_EXPORT int serverPort( const QWindow* );
 
+    /*!
+        \return Port for WebSocket connections to the VNC server of window,
+                -1 when WebSocket connections are not accepted
+        \sa startServer(), setInitialWebSocketPort()
+     */
+    VNC_EXPORT int webSocketPort( const QWindow* );
+
+    /*!
+        \brief Accept connections to the VNC server of a window on a further address
+
+        Viewers on the same device or in the guest of a virtual machine
+        can avoid the overhead of the TCP stack by connecting via a local transport.
+        For those the Raw encoding is preferred over compressing encodings.
+
+        Supported addresses are: "tcp:<port>", "ws:<port>" ( WebSocket ),
+        "unix:<path>" ( Unix domain socket ) and "vsock:<port>" ( AF_VSOCK, Linux only )
+
+        Additional addresses for all servers can be set by the environment
+        variable QVNC_GL_LISTEN as comma separated list. A "%1" is replaced
+        by the port of the server.
+
+        \param window Window mirrored by a server
+        \param address Address
+        \return true, when listening on address has been started
+
+        \sa startServer(), serverPort()
+     */
+    VNC_EXPORT bool addListener( const QWindow* window, const QString& address );
+
+    /*!
+        \brief Measure the latency between input and response
+
+        A click is injected into the center of rect every interval ms - through
+        the same path as the input of the viewers. The time until the content of rect
+        has changed in a grabbed frame and until this update has been sent to a viewer
+        is reported to "vnceglfs.latency.info". rect should cover an item, that toggles
+        its appearance, when being clicked. Measuring requires a connected viewer.
+
+        The probe can also be set by the environment variable
+        QVNC_GL_LATENCY_PROBE="x,y,w,h[,interval]"
+
+        \param window Window mirrored by a server
+        \param rect Probe rectangle in frame buffer coordinates, an empty rect disables the probe
+        \param interval Interval in ms
+     */
+    VNC_EXPORT void setLatencyProbe( const QWindow* window,
+        const QRect& rect, int interval = 1000 );
+
     /*!
         \return List of all windows, where a VNC server is running
      */
     VNC_EXPORT QList< QWindow* > windows();
+
+    /*!
+        \brief Record the grabbed frames of a window
+
+        The frames are appended with timestamps to fileName, each of them being
+        compressed individually. Recordings can be replayed by startReplay()
+        to reproduce/benchmark the situation, where they have been captured.
+
+        The default value can be initialized by the environment variable
+        QVNC_GL_RECORD. A "%1" in the file name is replaced by the port.
+
+        \param window Window mirrored by a server
+        \param fileName File, where to append the frames
+        \return true, when the file could be opened
+
+        \sa stopRecording(), startReplay()
+     */
+    VNC_EXPORT bool startRecording( const QWindow* window, const QString& fileName );
+
+    /*!
+        \brief Stop recording the frames of a window
+        \sa startRecording()
+     */
+    VNC_EXPORT void stopRecording( const QWindow* window );
+
+    /*!
+        \brief Replace the grabbed frames of a window by a recording
+
+        The frames of the recording are fed into the server in the same
+        intervals as they have been recorded - or as fast as possible,
+        when maxSpeed is set.
+
+        The default value can be initialized by the environment variables
+        QVNC_GL_REPLAY and QVNC_GL_REPLAY_MAXSPEED. A "%1" in the file name is
+        replaced by the port.
+
+        \param window Window mirrored by a server
+        \param fileName Recording created by startRecording()
+        \param maxSpeed Ignore the timestamps of the recording
+        \return true, when the file contains a valid recording
+
+        \sa stopReplay(), startRecording()
+     */
+    VNC_EXPORT bool startReplay( const QWindow* window,
+        const QString& fileName, bool maxSpeed = false );
+
+    /*!
+        \brief Stop replaying a recording and continue with grabbing the window
+        \sa startReplay()
+     */
+    VNC_EXPORT void stopReplay( const QWindow* window );
 }
 
 #endif
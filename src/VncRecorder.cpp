@@ -0,0 +1,429 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncRecorder.h"
+#include "VncServer.h"
+#include "VncThreadPolicy.h"
+
+#include <qimage.h>
+#include <qendian.h>
+#include <qloggingcategory.h>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY( logRecording, "vnceglfs.recording" )
+
+namespace
+{
+    /*
+        File layout ( little endian ):
+
+            "VNCREC" + 2 bytes version
+
+            frame:
+                qint64 timestamp ( ms )
+                qint32 width, height, format, bytesPerLine
+                quint32 size of the compressed pixels
+                compressed pixels ( qCompress )
+     */
+
+    const char fileMagic[] = "VNCREC\x00\x01";
+    const int fileMagicSize = 8;
+
+    const int frameHeaderSize = 28;
+
+    // frames waiting for being compressed, before dropping frames
+    const int maxPendingFrames = 3;
+
+    // the server grabs into 32 bit formats only
+    bool isValidFormat( qint32 format )
+    {
+        switch( format )
+        {
+            case QImage::Format_RGB32:
+            case QImage::Format_ARGB32:
+            case QImage::Format_ARGB32_Premultiplied:
+            case QImage::Format_RGBX8888:
+            case QImage::Format_RGBA8888:
+            case QImage::Format_RGBA8888_Premultiplied:
+                return true;
+
+            default:
+                return false;
+        }
+    }
+
+    class FrameHeader
+    {
+      public:
+        void write( uchar* data ) const
+        {
+            qToLittleEndian< qint64 >( timestamp, data );
+            qToLittleEndian< qint32 >( width, data + 8 );
+            qToLittleEndian< qint32 >( height, data + 12 );
+            qToLittleEndian< qint32 >( format, data + 16 );
+            qToLittleEndian< qint32 >( bytesPerLine, data + 20 );
+            qToLittleEndian< quint32 >( size, data + 24 );
+        }
+
+        void read( const uchar* data )
+        {
+            timestamp = qFromLittleEndian< qint64 >( data );
+            width = qFromLittleEndian< qint32 >( data + 8 );
+            height = qFromLittleEndian< qint32 >( data + 12 );
+            format = qFromLittleEndian< qint32 >( data + 16 );
+            bytesPerLine = qFromLittleEndian< qint32 >( data + 20 );
+            size = qFromLittleEndian< quint32 >( data + 24 );
+        }
+
+        qint64 timestamp = 0;
+
+        qint32 width = 0;
+        qint32 height = 0;
+        qint32 format = 0;
+        qint32 bytesPerLine = 0;
+
+        quint32 size = 0;
+    };
+
+    class Writer final : public QObject
+    {
+        Q_OBJECT
+
+      public:
+        Writer( QAtomicInt* pendingFrames )
+            : m_pendingFrames( pendingFrames )
+        {
+        }
+
+        bool open( const QString& fileName )
+        {
+            m_file.setFileName( fileName );
+
+            if ( !m_file.open( QIODevice::WriteOnly | QIODevice::Append ) )
+                return false;
+
+            if ( m_file.size() == 0 )
+                m_file.write( fileMagic, fileMagicSize );
+
+            return true;
+        }
+
+        bool isOpen() const
+        {
+            return m_file.isOpen();
+        }
+
+      public Q_SLOTS:
+        void writeFrame( const QImage& image, qint64 timestamp )
+        {
+            m_pendingFrames->deref();
+
+            if ( !m_file.isOpen() || image.isNull() )
+                return;
+
+            /*
+                Level 1 is good enough for UIs, where most of
+                the frame is flat colored. Anything higher costs a lot
+                more CPU for a few percent of file size.
+             */
+            const auto data = qCompress( image.constBits(),
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+                static_cast< int >( image.sizeInBytes() ), 1 );
+#else
+                image.byteCount(), 1 );
+#endif
+
+            FrameHeader header;
+            header.timestamp = timestamp;
+            header.width = image.width();
+            header.height = image.height();
+            header.format = image.format();
+            header.bytesPerLine = image.bytesPerLine();
+            header.size = data.size();
+
+            uchar buffer[ frameHeaderSize ];
+            header.write( buffer );
+
+            m_file.write( reinterpret_cast< const char* >( buffer ), frameHeaderSize );
+            m_file.write( data );
+        }
+
+        void close()
+        {
+            m_file.close();
+            thread()->quit();
+        }
+
+      private:
+        QAtomicInt* m_pendingFrames;
+        QFile m_file;
+    };
+}
+
+VncRecorder::VncRecorder()
+{
+    // the thread is restarted for each recording
+    VncThreadPolicy::attach( &m_thread, Vnc::WorkerThreads );
+}
+
+VncRecorder::~VncRecorder()
+{
+    close();
+}
+
+bool VncRecorder::open( const QString& fileName )
+{
+    close();
+
+    auto writer = new Writer( &m_pendingFrames );
+    if ( !writer->open( fileName ) )
+    {
+        qCWarning( logRecording ) << "Can't open" << fileName;
+
+        delete writer;
+        return false;
+    }
+
+    writer->moveToThread( &m_thread );
+
+    m_thread.setObjectName( QStringLiteral( "VncRecorder" ) );
+    m_thread.start( QThread::LowPriority );
+
+    m_pendingFrames.storeRelease( 0 );
+    m_droppedFrames = 0;
+
+    QMutexLocker locker( &m_mutex );
+    m_writer = writer;
+
+    qCDebug( logRecording ) << "Recording to" << fileName;
+
+    return true;
+}
+
+void VncRecorder::close()
+{
+    QObject* writer;
+
+    {
+        // no more frames from the render thread, while draining the queue
+        QMutexLocker locker( &m_mutex );
+
+        writer = m_writer;
+        m_writer = nullptr;
+    }
+
+    if ( writer == nullptr )
+        return;
+
+    // the pending frames are written before the thread quits
+    QMetaObject::invokeMethod( writer, "close", Qt::QueuedConnection );
+    m_thread.wait();
+
+    delete writer;
+
+    if ( m_droppedFrames > 0 )
+    {
+        qCWarning( logRecording ) << "Recording closed,"
+            << m_droppedFrames << "frames have been dropped";
+    }
+}
+
+bool VncRecorder::isOpen() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_writer != nullptr;
+}
+
+void VncRecorder::record( const QImage& image, qint64 timestamp )
+{
+    QMutexLocker locker( &m_mutex );
+
+    if ( m_writer == nullptr )
+        return;
+
+    /*
+        Each frame is recorded completely. So when compressing is slower
+        than grabbing we can simply drop frames instead of queuing
+        them without limit.
+     */
+    if ( m_pendingFrames.loadAcquire() >= maxPendingFrames )
+    {
+        m_droppedFrames++;
+        return;
+    }
+
+    m_pendingFrames.ref();
+
+    /*
+        The image is implicitely shared and the server always assigns
+        a new image for the next frame. So no deep copy is needed.
+     */
+    QMetaObject::invokeMethod( m_writer, "writeFrame",
+        Qt::QueuedConnection, Q_ARG( QImage, image ), Q_ARG( qint64, timestamp ) );
+}
+
+VncReplayer::VncReplayer( VncServer* server )
+    : QObject( server )
+    , m_server( server )
+{
+    m_timer.setSingleShot( true );
+    connect( &m_timer, &QTimer::timeout, this, &VncReplayer::replayNextFrame );
+}
+
+VncReplayer::~VncReplayer()
+{
+}
+
+bool VncReplayer::open( const QString& fileName )
+{
+    stop();
+
+    m_offsets.clear();
+    m_data = nullptr;
+
+    if ( m_file.isOpen() )
+        m_file.close();
+
+    m_file.setFileName( fileName );
+    if ( !m_file.open( QIODevice::ReadOnly ) )
+    {
+        qCWarning( logRecording ) << "Can't open" << fileName;
+        return false;
+    }
+
+    // recordings easily have several GB, so we never read them into memory
+    const auto fileSize = m_file.size();
+    m_data = m_file.map( 0, fileSize );
+
+    if ( m_data == nullptr || fileSize < fileMagicSize
+        || memcmp( m_data, fileMagic, fileMagicSize ) != 0 )
+    {
+        qCWarning( logRecording ) << "Invalid recording:" << fileName;
+
+        m_file.close();
+        m_data = nullptr;
+
+        return false;
+    }
+
+    for ( qint64 pos = fileMagicSize; pos + frameHeaderSize <= fileSize; )
+    {
+        FrameHeader header;
+        header.read( m_data + pos );
+
+        if ( pos + frameHeaderSize + header.size > fileSize )
+            break; // truncated recording
+
+        m_offsets += pos;
+        pos += frameHeaderSize + header.size;
+    }
+
+    qCDebug( logRecording ) << "Replaying" << fileName
+        << "#frames:" << m_offsets.count();
+
+    return !m_offsets.isEmpty();
+}
+
+void VncReplayer::start( bool maxSpeed )
+{
+    if ( m_offsets.isEmpty() )
+        return;
+
+    m_maxSpeed = maxSpeed;
+    m_index = 0;
+
+    m_clock.start();
+    m_timer.start( 0 );
+}
+
+void VncReplayer::stop()
+{
+    m_timer.stop();
+}
+
+bool VncReplayer::isActive() const
+{
+    return m_timer.isActive();
+}
+
+QImage VncReplayer::frame( int index ) const
+{
+    const auto data = m_data + m_offsets[ index ];
+
+    FrameHeader header;
+    header.read( data );
+
+    const auto pixels = qUncompress( data + frameHeaderSize, static_cast< int >( header.size ) );
+
+    if ( !isValidFormat( header.format ) || header.width <= 0 || header.height <= 0
+        || header.bytesPerLine < 4 * qint64( header.width ) )
+    {
+        return QImage();
+    }
+
+    const auto size = qint64( header.bytesPerLine ) * header.height;
+    if ( size > pixels.size() )
+        return QImage();
+
+    QImage image( header.width, header.height,
+        static_cast< QImage::Format >( header.format ) );
+
+    if ( image.isNull() )
+        return QImage();
+
+    if ( image.bytesPerLine() == header.bytesPerLine )
+    {
+        // pixels might contain trailing garbage
+        memcpy( image.bits(), pixels.constData(), static_cast< size_t >( size ) );
+    }
+    else
+    {
+        const auto bytes = qMin( image.bytesPerLine(), header.bytesPerLine );
+
+        for ( int i = 0; i < header.height; i++ )
+        {
+            memcpy( image.scanLine( i ),
+                pixels.constData() + i * header.bytesPerLine, bytes );
+        }
+    }
+
+    return image;
+}
+
+void VncReplayer::replayNextFrame()
+{
+    const auto image = frame( m_index );
+    if ( !image.isNull() )
+        m_server->setFrameBuffer( image );
+
+    if ( ++m_index >= m_offsets.count() )
+    {
+        qCDebug( logRecording ) << "Replay finished:"
+            << m_offsets.count() << "frames in" << m_clock.elapsed() << "ms";
+
+        Q_EMIT finished();
+        return;
+    }
+
+    int delay = 0;
+
+    if ( !m_maxSpeed )
+    {
+        FrameHeader first;
+        first.read( m_data + m_offsets[ 0 ] );
+
+        FrameHeader next;
+        next.read( m_data + m_offsets[ m_index ] );
+
+        const auto due = next.timestamp - first.timestamp;
+        delay = static_cast< int >( qMax( due - m_clock.elapsed(), qint64( 0 ) ) );
+    }
+
+    m_timer.start( delay );
+}
+
+#include "VncRecorder.moc"
+#include "moc_VncRecorder.cpp"
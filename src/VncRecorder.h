@@ -0,0 +1,88 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qobject.h>
+#include <qfile.h>
+#include <qthread.h>
+#include <qmutex.h>
+#include <qatomic.h>
+#include <qtimer.h>
+#include <qvector.h>
+#include <qelapsedtimer.h>
+
+class QImage;
+class VncServer;
+
+/*
+    A recording is an append-only file with a sequence of grabbed frames.
+    Each frame is compressed individually, so that a recording can
+    be cut or concatenated without having to decode it.
+ */
+class VncRecorder final
+{
+  public:
+    VncRecorder();
+    ~VncRecorder();
+
+    // open/close are called from the GUI thread
+    bool open( const QString& fileName );
+    void close();
+
+    bool isOpen() const;
+
+    // can be called from any thread
+    void record( const QImage&, qint64 timestamp );
+
+  private:
+    Q_DISABLE_COPY( VncRecorder )
+
+    QThread m_thread;
+
+    mutable QMutex m_mutex;
+    QObject* m_writer = nullptr;
+
+    QAtomicInt m_pendingFrames;
+    int m_droppedFrames = 0;
+};
+
+class VncReplayer final : public QObject
+{
+    Q_OBJECT
+
+  public:
+    VncReplayer( VncServer* );
+    ~VncReplayer() override;
+
+    bool open( const QString& fileName );
+
+    void start( bool maxSpeed );
+    void stop();
+
+    bool isActive() const;
+
+  Q_SIGNALS:
+    void finished();
+
+  private Q_SLOTS:
+    void replayNextFrame();
+
+  private:
+    QImage frame( int index ) const;
+
+    VncServer* m_server;
+
+    QFile m_file;
+    const uchar* m_data = nullptr;
+
+    QVector< qint64 > m_offsets;
+
+    int m_index = 0;
+    bool m_maxSpeed = false;
+
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+};
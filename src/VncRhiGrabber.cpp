@@ -0,0 +1,193 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncRhiGrabber.h"
+
+#include <qquickwindow.h>
+#include <qmutex.h>
+#include <qatomic.h>
+#include <qvector.h>
+#include <qloggingcategory.h>
+
+#include <rhi/qrhi.h>
+
+Q_LOGGING_CATEGORY( logRhi, "vnceglfs.rhi", QtCriticalMsg )
+
+/*
+    The results are owned by the state and are deleted with the next readback
+    or together with the state - never from their completion callbacks,
+    where the callback itself would be destroyed.
+ */
+class VncRhiGrabber::State
+{
+  public:
+    ~State()
+    {
+        qDeleteAll( m_results );
+    }
+
+    Callback callback() const
+    {
+        QMutexLocker locker( &m_mutex );
+        const auto cb = m_callback;
+
+        return cb;
+    }
+
+    void setCallback( const Callback& callback )
+    {
+        QMutexLocker locker( &m_mutex );
+        m_callback = callback;
+    }
+
+    QRhiReadbackResult* createResult()
+    {
+        auto result = new QRhiReadbackResult();
+
+        QMutexLocker locker( &m_mutex );
+        m_results += result;
+
+        return result;
+    }
+
+    void setCompleted( QRhiReadbackResult* result )
+    {
+        // the pixels are not needed anymore
+        result->data = QByteArray();
+
+        QMutexLocker locker( &m_mutex );
+        m_completed += result;
+    }
+
+    void releaseCompleted()
+    {
+        QMutexLocker locker( &m_mutex );
+
+        const auto& completed = m_completed;
+        for ( auto result : completed )
+        {
+            m_results.removeOne( result );
+            delete result;
+        }
+
+        m_completed.clear();
+    }
+
+    QAtomicInt pending;
+
+  private:
+    mutable QMutex m_mutex;
+    Callback m_callback;
+
+    QVector< QRhiReadbackResult* > m_results;
+    QVector< QRhiReadbackResult* > m_completed;
+};
+
+static QImage toImage( const QRhiReadbackResult& result, bool yUp )
+{
+    const auto size = result.pixelSize;
+
+    if ( size.isEmpty() || result.data.size() < size.width() * size.height() * 4 )
+        return QImage();
+
+    // BGRA8 is the byte order of QImage::Format_ARGB32 on little endian systems
+    const auto format = ( result.format == QRhiTexture::RGBA8 )
+        ? QImage::Format_RGBA8888 : QImage::Format_ARGB32;
+
+    const QImage image( reinterpret_cast< const uchar* >( result.data.constData() ),
+        size.width(), size.height(), size.width() * 4, format );
+
+    // the conversion is a deep copy, that survives the result
+    auto frame = image.convertToFormat( QImage::Format_RGB32 );
+
+    if ( yUp )
+        frame = std::move( frame ).mirrored();
+
+    return frame;
+}
+
+VncRhiGrabber::VncRhiGrabber( QWindow* window, const Callback& callback )
+    : m_window( qobject_cast< QQuickWindow* >( window ) )
+    , m_state( new State() )
+{
+    m_state->setCallback( callback );
+}
+
+VncRhiGrabber::~VncRhiGrabber()
+{
+    if ( isPending() )
+    {
+        /*
+            The results are still referenced by QRhi: better leaking the state
+            than having the readbacks written into freed memory.
+         */
+        qCWarning( logRhi ) << "Grabber deleted with pending readbacks";
+
+        m_state->setCallback( Callback() );
+        m_state.release();
+    }
+}
+
+bool VncRhiGrabber::readBack( const QRegion& damage )
+{
+    if ( m_window == nullptr )
+        return false;
+
+    auto rhi = m_window->rhi();
+    if ( rhi == nullptr || rhi->backend() == QRhi::OpenGLES2 )
+    {
+        // OpenGL is read back synchronously, with partial updates
+        return false;
+    }
+
+    // no swap chain, when being rendered by QQuickRenderControl
+    auto swapChain = m_window->swapChain();
+    if ( swapChain == nullptr )
+        return false;
+
+    auto commandBuffer = swapChain->currentFrameCommandBuffer();
+
+    auto batch = rhi->nextResourceUpdateBatch();
+    if ( commandBuffer == nullptr || batch == nullptr )
+        return false;
+
+    // results of previous frames, that are not referenced by QRhi anymore
+    m_state->releaseCompleted();
+
+    const bool yUp = rhi->isYUpInFramebuffer();
+    const auto state = m_state.get();
+
+    auto result = state->createResult();
+    result->completed = [result, state, damage, yUp]()
+    {
+        if ( const auto callback = state->callback() )
+        {
+            const auto image = toImage( *result, yUp );
+
+            if ( image.isNull() )
+                qCWarning( logRhi ) << "Invalid readback:" << result->pixelSize;
+            else
+                callback( image, damage );
+        }
+
+        state->setCompleted( result );
+        state->pending.deref();
+    };
+
+    // a default description is the current backbuffer of the swap chain
+    batch->readBackTexture( QRhiReadbackDescription(), result );
+
+    state->pending.ref();
+    commandBuffer->resourceUpdate( batch );
+
+    qCDebug( logRhi ) << "Readback scheduled:" << rhi->backendName();
+
+    return true;
+}
+
+bool VncRhiGrabber::isPending() const
+{
+    return m_state->pending.loadAcquire() > 0;
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qimage.h>
+#include <qregion.h>
+
+#include <functional>
+#include <memory>
+
+class QWindow;
+class QQuickWindow;
+
+/*
+    With Qt 6 the scene graph might render with Vulkan, Metal or Direct 3D,
+    where no OpenGL context is available for reading back the frame.
+
+    The grabber schedules a readback of the backbuffer of the swap chain
+    after the scene graph has recorded the frame. The result arrives without
+    blocking the render thread, when the GPU has finished the frame -
+    usually when one of the following frames is started.
+ */
+class VncRhiGrabber
+{
+  public:
+    using Callback = std::function< void( const QImage&, const QRegion& ) >;
+
+    // callback is called from the scene graph thread
+    VncRhiGrabber( QWindow*, const Callback& );
+    ~VncRhiGrabber();
+
+    /*
+        Called from the scene graph thread, after the frame has been recorded.
+        Returns false, when the window is rendered with OpenGL or
+        the backbuffer can't be read back.
+     */
+    bool readBack( const QRegion& damage );
+
+    /*
+        Readbacks, that have not been completed yet. The grabber
+        must not be deleted before they have been completed.
+     */
+    bool isPending() const;
+
+  private:
+    Q_DISABLE_COPY( VncRhiGrabber )
+
+    class State;
+
+    QQuickWindow* const m_window;
+    std::unique_ptr< State > m_state;
+};
@@ -0,0 +1,119 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncScaler.h"
+
+void VncScaler::setDivisor( int divisor )
+{
+    divisor = qBound( 1, divisor, 8 );
+
+    if ( divisor != m_divisor )
+    {
+        m_divisor = divisor;
+        m_image = QImage();
+    }
+}
+
+void VncScaler::clear()
+{
+    m_image = QImage();
+}
+
+QSize VncScaler::scaledSize( const QSize& size ) const
+{
+    return QSize( size.width() / m_divisor, size.height() / m_divisor );
+}
+
+QRect VncScaler::scaledRect( const QRect& rect ) const
+{
+    // all pixels, that are affected by the rectangle
+
+    const int x1 = rect.left() / m_divisor;
+    const int y1 = rect.top() / m_divisor;
+    const int x2 = ( rect.right() + m_divisor ) / m_divisor;
+    const int y2 = ( rect.bottom() + m_divisor ) / m_divisor;
+
+    return QRect( x1, y1, x2 - x1, y2 - y1 );
+}
+
+QPoint VncScaler::unscaledPos( const QPoint& pos ) const
+{
+    return pos * m_divisor;
+}
+
+QRect VncScaler::update( const QImage& source, const QRect& rect )
+{
+    Q_ASSERT( source.format() == QImage::Format_RGB32 );
+
+    const auto size = scaledSize( source.size() );
+
+    QRect dirtyRect;
+
+    if ( size != m_image.size() )
+    {
+        m_image = QImage( size, QImage::Format_RGB32 );
+        dirtyRect = m_image.rect();
+    }
+    else
+    {
+        dirtyRect = scaledRect( rect ) & m_image.rect();
+    }
+
+    for ( int y = dirtyRect.top(); y <= dirtyRect.bottom(); y++ )
+        scaleLine( source, y, dirtyRect.left(), dirtyRect.right() + 1 );
+
+    return dirtyRect;
+}
+
+void VncScaler::scaleLine( const QImage& source, int line, int x1, int x2 )
+{
+    /*
+        The channels are accumulated in separate arrays, so that
+        the compiler is able to vectorize the inner loops
+     */
+
+    const int d = m_divisor;
+    const int count = x2 - x1;
+
+    m_sums.fill( 0, 3 * count );
+
+    auto sumR = m_sums.data();
+    auto sumG = sumR + count;
+    auto sumB = sumG + count;
+
+    for ( int i = 0; i < d; i++ )
+    {
+        auto src = reinterpret_cast< const QRgb* >(
+            source.constScanLine( line * d + i ) ) + x1 * d;
+
+        for ( int x = 0; x < count; x++ )
+        {
+            quint32 r = 0, g = 0, b = 0;
+
+            for ( int j = 0; j < d; j++ )
+            {
+                const auto rgb = src[ x * d + j ];
+
+                r += qRed( rgb );
+                g += qGreen( rgb );
+                b += qBlue( rgb );
+            }
+
+            sumR[x] += r;
+            sumG[x] += g;
+            sumB[x] += b;
+        }
+    }
+
+    const quint32 n = d * d;
+
+    auto out = reinterpret_cast< QRgb* >( m_image.scanLine( line ) ) + x1;
+
+    for ( int x = 0; x < count; x++ )
+    {
+        out[x] = qRgb( ( sumR[x] + n / 2 ) / n,
+            ( sumG[x] + n / 2 ) / n, ( sumB[x] + n / 2 ) / n );
+    }
+}
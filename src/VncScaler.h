@@ -0,0 +1,56 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qimage.h>
+#include <qvector.h>
+
+/*
+    Downscaling the frame buffer by an integer divisor using a box filter.
+
+    Compared to bilinear filtering each pixel of the source contributes
+    to the result, what gives better results for texts and thin lines.
+    The scaled image is kept, so that only the dirty parts need to be updated.
+ */
+class VncScaler
+{
+  public:
+    void setDivisor( int );
+    int divisor() const;
+
+    QSize scaledSize( const QSize& ) const;
+    QRect scaledRect( const QRect& ) const;
+    QPoint unscaledPos( const QPoint& ) const;
+
+    /*
+        Updates the scaled image for a rectangle of the source
+        and returns the modified rectangle in scaled coordinates
+     */
+    QRect update( const QImage& source, const QRect& );
+
+    const QImage& image() const;
+
+    // the next update needs to scale the complete source
+    void clear();
+
+  private:
+    void scaleLine( const QImage& source, int line, int x1, int x2 );
+
+    int m_divisor = 1;
+
+    QImage m_image;
+    QVector< quint32 > m_sums;
+};
+
+inline int VncScaler::divisor() const
+{
+    return m_divisor;
+}
+
+inline const QImage& VncScaler::image() const
+{
+    return m_image;
+}
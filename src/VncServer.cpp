@@ -5,17 +5,53 @@
 
 #include "VncServer.h"
 #include "VncClient.h"
+#include "VncGrabBudget.h"
+#include "VncCpuGovernor.h"
+#include "VncThreadPolicy.h"
+#include "VncNamespace.h"
+#include "VncScaler.h"
+#include "VncYuvConverter.h"
+#include "VncListener.h"
+#include "VncFramePublisher.h"
+#include "VncFrameSubscriber.h"
+#include "RfbInputEventQueue.h"
+#include "RfbInputEventHandler.h"
+
+#ifdef VNC_QUICK_DAMAGE
+#include "VncDamageTracker.h"
+#endif
+
+#ifdef VNC_RHI
+#include "VncRhiGrabber.h"
+#endif
+
+#ifdef VNC_SOFTWARE
+#include "VncSoftwareGrabber.h"
+#endif
 
-#include <qtcpserver.h>
 #include <qopenglcontext.h>
 #include <qopenglfunctions.h>
+#include <qopenglextrafunctions.h>
 #include <qwindow.h>
+#include <qguiapplication.h>
 #include <qthread.h>
 #include <qelapsedtimer.h>
+#include <qregion.h>
 #include <qloggingcategory.h>
 
 #include <qpa/qplatformcursor.h>
 
+#include <cstring>
+
+#ifndef QT_NO_CURSOR
+#include <qcursor.h>
+#include <qbitmap.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 Q_LOGGING_CATEGORY( logGrab, "vnceglfs.grab", QtCriticalMsg )
 Q_LOGGING_CATEGORY( logConnection, "vnceglfs.connection" )
 
@@ -29,71 +65,346 @@ namespace
         But when having a cursor, it might be updated by an OpenGl shader,
         - like Qt::WaitCursor, that is rotating constantly.
 
-        We have to find out how to deal with this all, but for the moment
-        we simply go with a workaround, that acts like when having
-        static cursor images.
+        We simply go with the static cursor images of the shapes,
+        that are tracked from the window. Then the viewer can render
+        the cursor locally and moving the pointer does not need any
+        frame updates.
      */
     VncCursor createCursor( Qt::CursorShape shape )
     {
+        if ( shape == Qt::BlankCursor )
+        {
+            QImage image( 1, 1, QImage::Format_RGBA8888_Premultiplied );
+            image.fill( Qt::transparent );
+
+            return VncCursor( image, QPoint() );
+        }
+
         QPlatformCursorImage platformImage( nullptr, nullptr, 0, 0, 0, 0 );
         platformImage.set( shape );
 
-        return { *platformImage.image(), platformImage.hotspot() };
+        return VncCursor( *platformImage.image(), platformImage.hotspot() );
     }
 
-#if 0
-    VncCursor createCursor( const QCursor* cursor )
+    // a framebuffer, where the window is downscaled before reading it back
+    class ScaleTarget
+    {
+      public:
+        QSize size;
+
+        GLuint fbo = 0;
+        GLuint renderbuffer = 0;
+    };
+
+    void releaseScaleTarget( ScaleTarget& target )
+    {
+        auto functions = QOpenGLContext::currentContext()->extraFunctions();
+
+        if ( target.fbo )
+            functions->glDeleteFramebuffers( 1, &target.fbo );
+
+        if ( target.renderbuffer )
+            functions->glDeleteRenderbuffers( 1, &target.renderbuffer );
+
+        target = ScaleTarget();
+    }
+
+#ifndef QT_NO_CURSOR
+    inline QImage bitmapImage( const QCursor& cursor, bool mask )
+    {
+#if QT_VERSION >= QT_VERSION_CHECK( 6, 0, 0 )
+        return mask ? cursor.mask().toImage() : cursor.bitmap().toImage();
+#else
+        const auto bitmap = mask ? cursor.mask() : cursor.bitmap();
+        return bitmap ? bitmap->toImage() : QImage();
+#endif
+    }
+
+    /*
+        Cursors being created from a bitmap and a mask:
+        bitmap and mask set: black, only mask set: white, otherwise transparent.
+
+        Inverted pixels ( bitmap set, but no mask ) can't be done
+        with a cursor image and end up as transparent.
+     */
+    QImage monochromeCursorImage( const QCursor& cursor )
+    {
+        const auto bitmap = bitmapImage( cursor, false );
+        const auto mask = bitmapImage( cursor, true );
+
+        if ( bitmap.isNull() || mask.size() != bitmap.size() )
+            return QImage();
+
+        QImage image( bitmap.size(), QImage::Format_ARGB32 );
+
+        for ( int y = 0; y < image.height(); y++ )
+        {
+            auto line = reinterpret_cast< QRgb* >( image.scanLine( y ) );
+
+            for ( int x = 0; x < image.width(); x++ )
+            {
+                // color1 is black
+                const bool isSet = qGray( bitmap.pixel( x, y ) ) < 128;
+                const bool isMasked = qGray( mask.pixel( x, y ) ) < 128;
+
+                if ( !isMasked )
+                    line[x] = qRgba( 0, 0, 0, 0 );
+                else
+                    line[x] = isSet ? qRgb( 0, 0, 0 ) : qRgb( 255, 255, 255 );
+            }
+        }
+
+        return image;
+    }
+
+    VncCursor createCursor( const QCursor& cursor )
+    {
+        if ( cursor.shape() == Qt::BitmapCursor )
+        {
+            auto image = cursor.pixmap().toImage();
+            if ( image.isNull() )
+                image = monochromeCursorImage( cursor );
+
+            if ( !image.isNull() )
+                return VncCursor( image, cursor.hotSpot() );
+
+            return createCursor( Qt::ArrowCursor );
+        }
+
+        return createCursor( cursor.shape() );
+    }
+
+    // identifying the images of bitmap cursors
+    qint64 cursorKey( const QCursor& cursor )
     {
-        const auto shape = cursor ? cursor->shape() : Qt::ArrowCursor;
+        if ( cursor.shape() != Qt::BitmapCursor )
+            return 0;
 
-        if ( shape == Qt::BitmapCursor )
-            return { cursor->pixmap().toImage(), cursor->hotSpot() };
+        const auto pixmap = cursor.pixmap();
+        if ( !pixmap.isNull() )
+            return pixmap.cacheKey();
 
-        return createCursor( shape );
+#if QT_VERSION >= QT_VERSION_CHECK( 6, 0, 0 )
+        return cursor.bitmap().cacheKey();
+#else
+        return cursor.bitmap() ? cursor.bitmap()->cacheKey() : 0;
+#endif
     }
 #endif
 
-    class TcpServer final : public QTcpServer
+    class WindowGrabber final : public QObject
     {
         Q_OBJECT
 
       public:
-        TcpServer( QObject* parent )
-            : QTcpServer( parent )
+        WindowGrabber( QWindow* window, VncServer* server )
+            : QObject( server )
+#ifdef VNC_SOFTWARE
+            , softwareGrabber( window )
+#endif
+#ifdef VNC_RHI
+            , rhiGrabber( window,
+                [server, window]( const QImage& image, const QRegion& damage )
+                    { server->updateFrameBuffer( window, image, damage ); } )
+#endif
+            , m_window( window )
+#ifdef VNC_QUICK_DAMAGE
+            , m_damageTracker( window )
+#endif
         {
+            budget.setBudget( Vnc::grabBudget() );
+            budget.setLoadLimit( Vnc::grabLoadLimit() );
         }
 
-      Q_SIGNALS:
-        void connectionRequested( qintptr );
+        QWindow* window() const { return m_window; }
 
-      protected:
-        void incomingConnection( qintptr socketDescriptor ) override
+        void start()
+        {
+            // hidden windows are not rendered: started again, when being shown
+            if ( !m_window->isVisible() )
+                return;
+
+            if ( !m_connection )
+            {
+                /*
+                    afterRendering is from the scene graph thread, so we
+                    need a Qt::DirectConnection to avoid, that the image is
+                    already gone, when being scheduled from a Qt::QQueuedConnection !
+                 */
+
+                m_connection = QObject::connect( m_window, SIGNAL(afterRendering()),
+                    this, SLOT(grab()), Qt::DirectConnection );
+
+#ifdef VNC_QUICK_DAMAGE
+                m_damageTracker.start();
+#endif
+
+#ifdef VNC_SOFTWARE
+                // frames have been rendered without being tracked
+                softwareGrabber.invalidate();
+#endif
+
+                QMetaObject::invokeMethod( m_window, "update" );
+            }
+        }
+
+        void stop()
         {
-            /*
-                We do not want to use QTcpServer::nextPendingConnection to avoid
-                QTcpSocket being created in the wrong thread
-             */
-            Q_EMIT connectionRequested( socketDescriptor );
+            if ( m_connection )
+                QObject::disconnect( m_connection );
+
+#ifdef VNC_QUICK_DAMAGE
+            m_damageTracker.stop();
+#endif
+        }
+
+        /*
+            The OpenGL resources can only be released from the render thread,
+            so the grabber deletes itself after the next frame. When the window
+            is not rendered anymore they are released together with its context.
+         */
+        void release()
+        {
+            stop();
+
+            QObject::connect( m_window, SIGNAL(afterRendering()),
+                this, SLOT(releaseResources()), Qt::DirectConnection );
+
+            QObject::connect( m_window, &QObject::destroyed,
+                this, &QObject::deleteLater );
+
+            QMetaObject::invokeMethod( m_window, "update" );
+        }
+
+        // guarded by the frame buffer mutex of the server
+
+        QRect rect; // geometry inside the frame buffer
+        QImage image;
+
+        /*
+            One target for each scale level. The OpenGL resources are
+            released from the render thread, when a level is not requested
+            anymore or the window is removed from the server.
+         */
+        QMap< int, ScaleTarget > scaleTargets;
+        bool scaleFailed = false;
+
+        VncYuvConverter yuvConverter;
+        bool yuvFailed = false;
+
+        // detecting animations from the intervals between rendered frames
+        QElapsedTimer renderTimer;
+        int animationFrames = 0;
+
+        // a client is waiting for a frame
+        bool frameRequested = false;
+
+        // rendered frames, that have not been grabbed
+        bool framesSkipped = false;
+        QRegion skippedDamage;
+
+        VncGrabBudget budget;
+
+#ifdef VNC_SOFTWARE
+        // copying from the backing store of the software adaptation
+        VncSoftwareGrabber softwareGrabber;
+#endif
+
+#ifdef VNC_RHI
+        // asynchronous readbacks for Vulkan, Metal, Direct 3D
+        VncRhiGrabber rhiGrabber;
+#endif
+
+      private Q_SLOTS:
+        void grab()
+        {
+#ifdef VNC_QUICK_DAMAGE
+            QRegion damage = m_damageTracker.takeDamage();
+#else
+            QRegion damage( QRect( QPoint(), m_window->size() * m_window->devicePixelRatio() ) );
+#endif
+
+#ifdef VNC_SOFTWARE
+            // the software renderer knows exactly what has been painted
+            if ( softwareGrabber.isActive() )
+                damage = softwareGrabber.takeDamage();
+#endif
+
+            auto server = static_cast< VncServer* >( parent() );
+            server->updateFrameBuffer( m_window, damage );
+
+#ifdef VNC_RHI
+            if ( rhiGrabber.isPending() )
+            {
+                /*
+                    Readbacks are completed, when the GPU is done with the
+                    frame, what is detected when starting one of the next frames.
+                 */
+                QMetaObject::invokeMethod( m_window, "update", Qt::QueuedConnection );
+            }
+#endif
+        }
+
+        void releaseResources()
+        {
+#ifdef VNC_RHI
+            if ( rhiGrabber.isPending() )
+            {
+                // the results are completed, when starting one of the next frames
+                QMetaObject::invokeMethod( m_window, "update", Qt::QueuedConnection );
+                return;
+            }
+#endif
+
+            QObject::disconnect( m_window, SIGNAL(afterRendering()),
+                this, SLOT(releaseResources()) );
+
+            if ( QOpenGLContext::currentContext() )
+            {
+                for ( auto& target : scaleTargets )
+                    releaseScaleTarget( target );
+
+                yuvConverter.release();
+            }
+
+            scaleTargets.clear();
+
+            // the render thread is done with the grabber
+            deleteLater();
         }
+
+      private:
+        QWindow* const m_window;
+        QMetaObject::Connection m_connection;
+
+#ifdef VNC_QUICK_DAMAGE
+        VncDamageTracker m_damageTracker;
+#endif
     };
 
     class ClientThread : public QThread
     {
       public:
-        ClientThread( qintptr socketDescriptor, VncServer* server )
+        ClientThread( qintptr socketDescriptor,
+                VncListener::Transport transport, VncServer* server )
             : QThread( server )
             , m_socketDescriptor( socketDescriptor )
+            , m_transport( transport )
         {
+            setObjectName( QStringLiteral( "VncClient" ) );
         }
 
         ~ClientThread()
         {
         }
 
-        void markDirty()
+        // called from the thread of the frame hasher
+        void markDirty( const QRegion& region )
         {
+            QMutexLocker locker( &m_clientMutex );
+
             if ( m_client )
-                m_client->markDirty();
+                m_client->markDirty( region );
         }
 
         VncClient* client() const { return m_client; }
@@ -101,40 +412,98 @@ namespace
       protected:
         void run() override
         {
-            VncClient client( m_socketDescriptor, qobject_cast< VncServer* >( parent() ) );
+            VncThreadPolicy::apply( Vnc::IOThreads );
+
+            VncClient client( m_socketDescriptor, m_transport,
+                qobject_cast< VncServer* >( parent() ) );
             connect( &client, &VncClient::disconnected, this, &QThread::quit );
 
-            m_client = &client;
+            setClient( &client );
             QThread::run();
-            m_client = nullptr;
+            setClient( nullptr ); // before the client gets destroyed
         }
 
       private:
+        void setClient( VncClient* client )
+        {
+            QMutexLocker locker( &m_clientMutex );
+            m_client = client;
+        }
+
+        QMutex m_clientMutex;
         VncClient* m_client = nullptr;
         const qintptr m_socketDescriptor;
+        const VncListener::Transport m_transport;
     };
 }
 
+static inline WindowGrabber* findGrabber(
+    const QVector< QObject* >& grabbers, const QWindow* window )
+{
+    for ( auto grabber : grabbers )
+    {
+        auto windowGrabber = static_cast< WindowGrabber* >( grabber );
+        if ( windowGrabber->window() == window )
+            return windowGrabber;
+    }
+
+    return nullptr;
+}
+
 VncServer::VncServer( int port, QWindow* window )
-    : m_window( window )
+    : m_port( port )
     , m_cursor( createCursor( Qt::ArrowCursor ) )
+    , m_cursorShape( Qt::ArrowCursor )
 {
-    Q_ASSERT( window && window->inherits( "QQuickWindow" ) );
+    m_clock.start();
+
+    connect( &m_probeTimer, &QTimer::timeout, this, &VncServer::injectProbeInput );
+
+    /*
+        Setting an override cursor does not send any event to the windows,
+        so we need to poll for it, as long as there are viewers.
+     */
+    m_cursorTimer.setInterval( 100 );
+    connect( &m_cursorTimer, &QTimer::timeout,
+        this, [this]() { updateCursor( window() ); } );
 
-    m_window = window;
+    // the animation has stopped: reading back the stale parts as RGB
+    m_yuvTimer.setSingleShot( true );
+    m_yuvTimer.setInterval( 200 );
+
+    connect( &m_yuvTimer, &QTimer::timeout, this,
+        [this]()
+        {
+            for ( auto window : windows() )
+                QMetaObject::invokeMethod( window, "update" );
+        }
+    );
 
-    auto tcpServer = new TcpServer( this );
-    connect( tcpServer, &TcpServer::connectionRequested, this, &VncServer::addClient );
+    connect( &m_hasher, &VncFrameHasher::frameChanged,
+        this, &VncServer::markClientsDirty, Qt::DirectConnection );
 
-    m_tcpServer = tcpServer;
+    if ( window )
+        addWindow( window );
 
-    if( m_tcpServer->listen( QHostAddress::Any, port ) )
+    auto listener = new VncListener( VncListener::Tcp, this );
+    if( listener->listen( port ) )
         qCDebug( logConnection ) << "VncServer created on port" << port;
+
+    addListener( listener );
 }
 
 VncServer::~VncServer()
 {
-    m_window = nullptr;
+    {
+        QMutexLocker locker( &m_frameBufferMutex );
+
+        const auto& grabbers = m_grabbers;
+        for ( auto grabber : grabbers )
+            static_cast< WindowGrabber* >( grabber )->stop();
+
+        m_grabbers.clear();
+        m_publisher = nullptr;
+    }
 
     const auto& threads = m_threads; // qAsConst is deprecated in Qt6.7, std::as_const is C++17
     for ( auto thread : threads )
@@ -144,187 +513,1463 @@ VncServer::~VncServer()
     }
 }
 
-int VncServer::port() const
-{
-    return m_tcpServer->serverPort();
-}
-
-void VncServer::addClient( qintptr fd )
+void VncServer::addWindow( QWindow* window )
 {
-    auto thread = new ClientThread( fd, this );
-    m_threads += thread;
+    Q_ASSERT( window && window->inherits( "QQuickWindow" ) );
 
-    if ( m_window && !m_grabConnectionId )
-    {
-        /*
-            afterRendering is from the scene graph thread, so we
-            need a Qt::DirectConnection to avoid, that the image is
-            already gone, when being scheduled from a Qt::QQueuedConnection !
-         */
+    if ( window == nullptr || hasWindow( window ) )
+        return;
 
-        m_grabConnectionId = QObject::connect( m_window, SIGNAL(afterRendering()),
-            this, SLOT(updateFrameBuffer()), Qt::DirectConnection );
+    auto grabber = new WindowGrabber( window, this );
 
-        QMetaObject::invokeMethod( m_window, "update" );
+    {
+        QMutexLocker locker( &m_frameBufferMutex );
+        m_grabbers += grabber;
     }
 
-    qCDebug( logConnection ) << "New VNC client attached on port" << m_tcpServer->serverPort()
-        << "#clients" << m_threads.count();
+    connect( window, &QWindow::xChanged, this, &VncServer::updateLayout );
+    connect( window, &QWindow::yChanged, this, &VncServer::updateLayout );
+    connect( window, &QWindow::widthChanged, this, &VncServer::updateLayout );
+    connect( window, &QWindow::heightChanged, this, &VncServer::updateLayout );
+    connect( window, &QWindow::screenChanged, this, &VncServer::updateLayout );
 
-    connect( thread, &QThread::finished, this, &VncServer::removeClient );
-    thread->start();
-}
+    connect( window, &QObject::destroyed,
+        this, [this, window]() { removeGrabber( window, true ); } );
 
-void VncServer::removeClient()
-{
-    if ( auto thread = qobject_cast< QThread* >( sender() ) )
-    {
-        m_threads.removeOne( thread );
-        if ( m_threads.isEmpty() && m_grabConnectionId )
-            QObject::disconnect( m_grabConnectionId );
+    // the viewers stay connected, while the window is hidden
+    connect( window, &QWindow::visibleChanged,
+        this, [this, window]( bool on ) { updateGrabbing( window, on ); } );
 
-        thread->quit();
-        thread->wait( 100 );
+#ifndef QT_NO_CURSOR
+    if ( m_grabbers.count() == 1 )
+        updateCursor( window );
 
-        delete thread;
+    window->installEventFilter( this );
+#endif
 
-        qCDebug( logConnection ) << "VNC client detached on port" << m_tcpServer->serverPort()
-            << "#clients:" << m_threads.count();
-    }
-}
+    updateLayout();
 
-void VncServer::setTimerInterval( int ms )
-{
-    const auto& threads = m_threads;
-    for ( auto thread : threads )
-    {
-        auto client = static_cast< ClientThread* >( thread )->client();
-        client->setTimerInterval( ms );
-    }
+    if ( hasViewers() && m_replayer == nullptr )
+        grabber->start();
 }
 
-static inline bool isOpenGL12orBetter( const QOpenGLContext* context )
+void VncServer::removeWindow( const QWindow* window )
 {
-    if ( context->isOpenGLES() )
-        return false;
-
-    const auto fmt = context->format();
-    return ( fmt.majorVersion() >= 2 ) || ( fmt.minorVersion() >= 2 );
+    removeGrabber( window, false );
 }
 
-static void grabWindow( QImage& frameBuffer )
+void VncServer::removeGrabber( const QWindow* window, bool windowDestroyed )
 {
-    QElapsedTimer timer;
+    WindowGrabber* grabber;
 
-    if ( logGrab().isDebugEnabled() )
-        timer.start();
+    {
+        QMutexLocker locker( &m_frameBufferMutex );
 
-#if 0
-    const auto context = QOpenGLContext::currentContext();
+        grabber = findGrabber( m_grabbers, window );
+        if ( grabber == nullptr )
+            return;
 
-    if ( isOpenGL12orBetter( context ) )
-    {
-        #ifndef GL_BGRA
-            #define GL_BGRA 0x80E1
-        #endif
+        grabber->stop();
+        m_grabbers.removeOne( grabber );
+    }
 
-        #ifndef GL_UNSIGNED_INT_8_8_8_8_REV
-            #define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
-        #endif
+    auto w = grabber->window();
 
-        context->functions()->glReadPixels(
-            0, 0, frameBuffer.width(), frameBuffer.height(),
-            GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, frameBuffer.bits() );
+    w->disconnect( this );
+    w->removeEventFilter( this );
 
-        // OpenGL images are vertically flipped.
-        frameBuffer = std::move( frameBuffer ).mirrored( false, true );
+    if ( windowDestroyed )
+    {
+        /*
+            The scene graph thread might be waiting for the mutex
+            to grab the window right now. So we delete the grabber
+            later, when this can't happen anymore.
+         */
+        grabber->deleteLater();
     }
     else
     {
-        QImage image( frameBuffer.size(), QImage::Format_RGBX8888 );
-#if 0
-        image.fill( Qt::white ); // for debugging only
-#endif
+        // scale targets and YCbCr converter are released from the render thread
+        grabber->release();
+    }
 
-        context->functions()->glReadPixels(
-            0, 0, frameBuffer.width(), frameBuffer.height(),
-            GL_RGBA, GL_UNSIGNED_BYTE, image.bits() );
+    updateLayout();
+}
 
-        // inplace conversion/mirroring in one pass: TODO ...
-        if ( image.format() != frameBuffer.format() )
-        {
-#if QT_VERSION < QT_VERSION_CHECK( 5, 13, 0 )
-            image = image.convertToFormat( frameBuffer.format() );
-#else
-            image.convertTo( frameBuffer.format() );
-#endif
-        }
+bool VncServer::hasWindow( const QWindow* window ) const
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+    return findGrabber( m_grabbers, window ) != nullptr;
+}
 
-        // OpenGL images are vertically flipped.
-        frameBuffer = image.mirrored( false, true );
-    }
-#else
-    // avoiding native OpenGL calls
+QWindow* VncServer::window() const
+{
+    QMutexLocker locker( &m_frameBufferMutex );
 
-    extern QImage qt_gl_read_framebuffer(
-        const QSize&, bool alpha_format, bool include_alpha );
+    if ( m_grabbers.isEmpty() )
+        return nullptr;
 
-    const auto format = frameBuffer.format();
-    frameBuffer = qt_gl_read_framebuffer( frameBuffer.size(), false, false );
+    return static_cast< WindowGrabber* >( m_grabbers.first() )->window();
+}
 
-    if ( frameBuffer.format() != format )
-    {
-#if QT_VERSION < QT_VERSION_CHECK( 5, 13, 0 )
-        frameBuffer = frameBuffer.convertToFormat( format );
-#else
-        frameBuffer.convertTo( format );
-#endif
-    }
+QList< QWindow* > VncServer::windows() const
+{
+    QList< QWindow* > windows;
 
-#endif
+    QMutexLocker locker( &m_frameBufferMutex );
 
-    if ( logGrab().isDebugEnabled() )
-    {
-        qCDebug( logGrab ) << "grabWindow:" << timer.elapsed() << "ms";
-    }
+    for ( auto grabber : m_grabbers )
+        windows += static_cast< WindowGrabber* >( grabber )->window();
+
+    return windows;
 }
 
-void VncServer::updateFrameBuffer()
+void VncServer::updateLayout()
 {
+    /*
+        Windows are arranged according to their geometries, what
+        is the layout of the screens for EGLFS. When having one
+        window only, the position of the window is irrelevant.
+     */
+
+    QRect bounds;
+    for ( auto window : windows() )
+        bounds |= window->geometry();
+
+    QSize size;
+
     {
         QMutexLocker locker( &m_frameBufferMutex );
 
-        const auto size = m_window->size() * m_window->devicePixelRatio();
-        if ( size != m_frameBuffer.size() )
+        QRect layoutRect;
+
+        const auto& grabbers = m_grabbers;
+        for ( auto object : grabbers )
         {
-            /*
-                On EGLFS the window always matches the screen size.
+            auto grabber = static_cast< WindowGrabber* >( object );
+
+            const auto window = grabber->window();
+            const auto ratio = window->devicePixelRatio();
 
-                But when testing the implementation on X11 the window
-                might be resized manually later. Should be no problem,
-                as most clients indicate being capable of adjustments
-                of the framebuffer size. ( "DesktopSize" pseudo encoding )
-             */
+            QPoint pos;
+            if ( m_grabbers.count() > 1 )
+                pos = ( window->geometry().topLeft() - bounds.topLeft() ) * ratio;
 
-            m_frameBuffer = QImage( size, QImage::Format_RGB32 );
+            grabber->rect = QRect( pos, window->size() * ratio );
+            layoutRect |= grabber->rect;
         }
 
-        grabWindow( m_frameBuffer );
+        size = QSize( layoutRect.x() + layoutRect.width(),
+            layoutRect.y() + layoutRect.height() );
+
+        if ( size != m_frameBufferSize )
+        {
+            m_frameBufferSize = size;
+            m_frameBuffer = QImage();
+            m_scaledFrameBuffers.clear();
+            m_yuvFrame = RfbYuvImage();
+        }
     }
 
-    const QRect rect( 0, 0, m_frameBuffer.width(), m_frameBuffer.height() );
+    markClientsDirty( QRect( QPoint(), size ) );
 
-    const auto& threads = m_threads;
+    for ( auto window : windows() )
+        QMetaObject::invokeMethod( window, "update" );
+}
+
+QSize VncServer::frameBufferSize() const
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+    return m_frameBufferSize;
+}
+
+void VncServer::addScaleLevel( int divisor )
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+    m_scaleLevels[ divisor ]++;
+}
+
+void VncServer::removeScaleLevel( int divisor )
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    auto it = m_scaleLevels.find( divisor );
+    if ( it != m_scaleLevels.end() && --it.value() <= 0 )
+    {
+        m_scaleLevels.erase( it );
+
+        // not updated anymore
+        m_scaledFrameBuffers.remove( divisor );
+    }
+}
+
+QImage VncServer::scaledFrameBuffer( int divisor ) const
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+    const auto fb = m_scaledFrameBuffers.value( divisor );
+
+    return fb;
+}
+
+void VncServer::addYuvClient()
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+    m_yuvClients++;
+}
+
+void VncServer::removeYuvClient()
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+    m_yuvClients--;
+}
+
+RfbYuvImage VncServer::yuvFrame( QPoint& pos ) const
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    pos = m_yuvPos;
+
+    const auto frame = m_yuvFrame;
+    return frame;
+}
+
+QVector< QRect > VncServer::screenLayout() const
+{
+    QVector< QRect > layout;
+
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    layout.reserve( m_grabbers.count() );
+    for ( auto grabber : m_grabbers )
+        layout += static_cast< WindowGrabber* >( grabber )->rect;
+
+    if ( layout.isEmpty() && !m_frameBufferSize.isEmpty() )
+    {
+        // frames from a different source
+        layout += QRect( QPoint(), m_frameBufferSize );
+    }
+
+    return layout;
+}
+
+QWindow* VncServer::windowAt( const QPoint& pos, QPointF& windowPos ) const
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    for ( auto object : m_grabbers )
+    {
+        auto grabber = static_cast< WindowGrabber* >( object );
+
+        if ( grabber->rect.contains( pos ) )
+        {
+            const auto window = grabber->window();
+
+            windowPos = QPointF( pos - grabber->rect.topLeft() ) / window->devicePixelRatio();
+            return window;
+        }
+    }
+
+    return nullptr;
+}
+
+QWindow* VncServer::keyboardWindow() const
+{
+    const auto focusWindow = QGuiApplication::focusWindow();
+
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    if ( m_grabbers.isEmpty() )
+        return nullptr;
+
+    if ( auto grabber = findGrabber( m_grabbers, focusWindow ) )
+        return grabber->window();
+
+    return static_cast< WindowGrabber* >( m_grabbers.first() )->window();
+}
+
+int VncServer::port() const
+{
+    const auto port = listenerPort( VncListener::Tcp );
+
+    // publishing servers have no listeners, but keep the port of their path
+    return ( port >= 0 ) ? port : m_port;
+}
+
+int VncServer::webSocketPort() const
+{
+    return listenerPort( VncListener::WebSocket );
+}
+
+int VncServer::listenerPort( VncListener::Transport transport ) const
+{
+    for ( const auto listener : m_listeners )
+    {
+        if ( listener->transport() == transport && listener->isListening() )
+            return listener->port();
+    }
+
+    return -1;
+}
+
+bool VncServer::addListener( const QString& address )
+{
+    auto listener = VncListener::create( address, this );
+    if ( listener == nullptr )
+    {
+        qCWarning( logConnection ) << "Can't listen on" << address;
+        return false;
+    }
+
+    qCDebug( logConnection ) << "VncServer listening on" << listener->address();
+
+    addListener( listener );
+    return true;
+}
+
+void VncServer::addListener( VncListener* listener )
+{
+    connect( listener, &VncListener::connectionRequested,
+        this, [this, listener]( qintptr fd ) { addClient( fd, listener->transport() ); } );
+
+    m_listeners += listener;
+}
+
+void VncServer::addClient( qintptr fd, VncListener::Transport transport )
+{
+    if ( m_subscriber && frameBufferSize().isEmpty() )
+    {
+        // the application has not published any frame yet
+        qCWarning( logConnection ) << "Rejecting VNC client on port" << port()
+            << ": no frames from" << m_subscriber->path();
+
+#ifdef Q_OS_UNIX
+        ::close( int( fd ) );
+#endif
+        return;
+    }
+
+    auto thread = new ClientThread( fd, transport, this );
+
+    {
+        QMutexLocker locker( &m_threadsMutex );
+        m_threads += thread;
+    }
+
+#ifndef QT_NO_CURSOR
+    m_cursorTimer.start();
+#endif
+
+    if ( m_replayer == nullptr )
+        startGrabbing();
+
+    qCDebug( logConnection ) << "New VNC client attached on port" << port()
+        << transport << "#clients" << m_threads.count();
+
+    connect( thread, &QThread::finished, this, &VncServer::removeClient );
+    thread->start();
+}
+
+void VncServer::removeClient()
+{
+    if ( auto thread = qobject_cast< QThread* >( sender() ) )
+    {
+        {
+            // markClientsDirty might iterate over the threads right now
+            QMutexLocker locker( &m_threadsMutex );
+            m_threads.removeOne( thread );
+        }
+
+        if ( m_threads.isEmpty() )
+        {
+            m_cursorTimer.stop();
+            stopGrabbing();
+        }
+
+        thread->quit();
+        thread->wait( 100 );
+
+        delete thread;
+
+        qCDebug( logConnection ) << "VNC client detached on port" << port()
+            << "#clients:" << m_threads.count();
+    }
+}
+
+void VncServer::setGrabBudget( qreal ms, int loadLimit )
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    const auto& grabbers = m_grabbers;
+    for ( auto object : grabbers )
+    {
+        auto grabber = static_cast< WindowGrabber* >( object );
+
+        grabber->budget.setBudget( ms );
+        grabber->budget.setLoadLimit( loadLimit );
+    }
+}
+
+void VncServer::setTimerInterval( int ms )
+{
+    const auto& threads = m_threads;
+    for ( auto thread : threads )
+    {
+        auto client = static_cast< ClientThread* >( thread )->client();
+        client->setTimerInterval( ms );
+    }
+}
+
+static inline bool isOpenGL12orBetter( const QOpenGLContext* context )
+{
+    if ( context->isOpenGLES() )
+        return false;
+
+    const auto fmt = context->format();
+    return ( fmt.majorVersion() >= 2 ) || ( fmt.minorVersion() >= 2 );
+}
+
+static void grabWindow( QImage& frameBuffer )
+{
+#if 0
+    const auto context = QOpenGLContext::currentContext();
+
+    if ( isOpenGL12orBetter( context ) )
+    {
+        #ifndef GL_BGRA
+            #define GL_BGRA 0x80E1
+        #endif
+
+        #ifndef GL_UNSIGNED_INT_8_8_8_8_REV
+            #define GL_UNSIGNED_INT_8_8_8_8_REV 0x8367
+        #endif
+
+        context->functions()->glReadPixels(
+            0, 0, frameBuffer.width(), frameBuffer.height(),
+            GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, frameBuffer.bits() );
+
+        // OpenGL images are vertically flipped.
+        frameBuffer = std::move( frameBuffer ).mirrored( false, true );
+    }
+    else
+    {
+        QImage image( frameBuffer.size(), QImage::Format_RGBX8888 );
+#if 0
+        image.fill( Qt::white ); // for debugging only
+#endif
+
+        context->functions()->glReadPixels(
+            0, 0, frameBuffer.width(), frameBuffer.height(),
+            GL_RGBA, GL_UNSIGNED_BYTE, image.bits() );
+
+        // inplace conversion/mirroring in one pass: TODO ...
+        if ( image.format() != frameBuffer.format() )
+        {
+#if QT_VERSION < QT_VERSION_CHECK( 5, 13, 0 )
+            image = image.convertToFormat( frameBuffer.format() );
+#else
+            image.convertTo( frameBuffer.format() );
+#endif
+        }
+
+        // OpenGL images are vertically flipped.
+        frameBuffer = image.mirrored( false, true );
+    }
+#else
+    // avoiding native OpenGL calls
+
+    extern QImage qt_gl_read_framebuffer(
+        const QSize&, bool alpha_format, bool include_alpha );
+
+    const auto format = frameBuffer.format();
+    frameBuffer = qt_gl_read_framebuffer( frameBuffer.size(), false, false );
+
+    if ( frameBuffer.format() != format )
+    {
+#if QT_VERSION < QT_VERSION_CHECK( 5, 13, 0 )
+        frameBuffer = frameBuffer.convertToFormat( format );
+#else
+        frameBuffer.convertTo( format );
+#endif
+    }
+
+#endif
+}
+
+static void grabWindow( QImage& frameBuffer, const QRegion& region )
+{
+    /*
+        Updating the damaged parts of the previous frame only, so that
+        the readback costs depend on the size of the changes instead
+        of the size of the window.
+     */
+
+    QVector< QRect > rects;
+
+    if ( region.rectCount() > 8 )
+    {
+        // each glReadPixels call has its overhead
+        rects += region.boundingRect();
+    }
+    else
+    {
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 8, 0 )
+        for ( const auto& rect : region )
+            rects += rect;
+#else
+        rects = region.rects();
+#endif
+    }
+
+    qint64 area = 0;
+    for ( const auto& rect : rects )
+        area += qint64( rect.width() ) * rect.height();
+
+    if ( area == 0 )
+        return;
+
+    if ( area >= qint64( frameBuffer.width() ) * frameBuffer.height() * 3 / 4 )
+    {
+        // reading the complete frame in one call is faster
+        grabWindow( frameBuffer );
+        return;
+    }
+
+    auto functions = QOpenGLContext::currentContext()->functions();
+
+    QVector< quint32 > pixels;
+
+    for ( const auto& rect : rects )
+    {
+        pixels.resize( rect.width() * rect.height() );
+
+        // GL_RGBA/GL_UNSIGNED_BYTE is supported by all OpenGL ( ES ) implementations
+        functions->glReadPixels(
+            rect.x(), frameBuffer.height() - rect.y() - rect.height(),
+            rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels.data() );
+
+        for ( int row = 0; row < rect.height(); row++ )
+        {
+            // OpenGL images are vertically flipped.
+            const auto from = reinterpret_cast< const uchar* >(
+                pixels.constData() + ( rect.height() - 1 - row ) * rect.width() );
+
+            auto to = reinterpret_cast< QRgb* >(
+                frameBuffer.scanLine( rect.y() + row ) ) + rect.x();
+
+            for ( int x = 0; x < rect.width(); x++ )
+            {
+                const auto rgba = from + 4 * x;
+                to[x] = qRgb( rgba[0], rgba[1], rgba[2] );
+            }
+        }
+    }
+}
+
+#ifndef GL_READ_FRAMEBUFFER
+    #define GL_READ_FRAMEBUFFER 0x8CA8
+#endif
+
+#ifndef GL_DRAW_FRAMEBUFFER
+    #define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+
+#ifndef GL_READ_FRAMEBUFFER_BINDING
+    #define GL_READ_FRAMEBUFFER_BINDING 0x8CAA
+#endif
+
+#ifndef GL_DRAW_FRAMEBUFFER_BINDING
+    #define GL_DRAW_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+
+#ifndef GL_RGBA8
+    #define GL_RGBA8 0x8058
+#endif
+
+static inline bool canBlitScaled( const QOpenGLContext* context )
+{
+    if ( context == nullptr )
+        return false;
+
+    // glBlitFramebuffer is OpenGL ( ES ) 3.0, multisampled buffers can't be scaled
+    const auto fmt = context->format();
+    return ( fmt.majorVersion() >= 3 ) && ( fmt.samples() <= 1 );
+}
+
+static bool createScaleTarget( ScaleTarget& target, const QSize& size )
+{
+    auto functions = QOpenGLContext::currentContext()->extraFunctions();
+
+    GLint fbo = 0;
+    functions->glGetIntegerv( GL_FRAMEBUFFER_BINDING, &fbo );
+
+    functions->glGenRenderbuffers( 1, &target.renderbuffer );
+    functions->glBindRenderbuffer( GL_RENDERBUFFER, target.renderbuffer );
+    functions->glRenderbufferStorage( GL_RENDERBUFFER,
+        GL_RGBA8, size.width(), size.height() );
+
+    functions->glGenFramebuffers( 1, &target.fbo );
+    functions->glBindFramebuffer( GL_FRAMEBUFFER, target.fbo );
+    functions->glFramebufferRenderbuffer( GL_FRAMEBUFFER,
+        GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.renderbuffer );
+
+    const bool ok = functions->glCheckFramebufferStatus(
+        GL_FRAMEBUFFER ) == GL_FRAMEBUFFER_COMPLETE;
+
+    functions->glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+    functions->glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+    if ( !ok )
+    {
+        releaseScaleTarget( target );
+        return false;
+    }
+
+    target.size = size;
+    return true;
+}
+
+static void readScaled( const ScaleTarget& target, int divisor,
+    const QSize& windowSize, const QRegion& region, QImage& image )
+{
+    /*
+        With linear filtering a divisor of 2 gives the average of
+        2x2 pixels, what is the same as the box filter of VncScaler.
+     */
+    auto functions = QOpenGLContext::currentContext()->extraFunctions();
+
+    GLint readFbo = 0;
+    GLint drawFbo = 0;
+
+    functions->glGetIntegerv( GL_READ_FRAMEBUFFER_BINDING, &readFbo );
+    functions->glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &drawFbo );
+
+    // the damaged area only. OpenGL images are vertically flipped.
+    const auto r = region.boundingRect();
+    const int h = target.size.height();
+
+    functions->glBindFramebuffer( GL_DRAW_FRAMEBUFFER, target.fbo );
+    functions->glBlitFramebuffer(
+        r.left() * divisor, windowSize.height() - ( r.bottom() + 1 ) * divisor,
+        ( r.right() + 1 ) * divisor, windowSize.height() - r.top() * divisor,
+        r.left(), h - ( r.bottom() + 1 ), r.right() + 1, h - r.top(),
+        GL_COLOR_BUFFER_BIT, GL_LINEAR );
+
+    functions->glBindFramebuffer( GL_READ_FRAMEBUFFER, target.fbo );
+
+    if ( region == QRegion( image.rect() ) )
+        grabWindow( image );
+    else
+        grabWindow( image, region );
+
+    functions->glBindFramebuffer( GL_READ_FRAMEBUFFER, readFbo );
+    functions->glBindFramebuffer( GL_DRAW_FRAMEBUFFER, drawFbo );
+}
+
+static void copyImage( const QImage& from, const QRect& fromRect,
+    const QPoint& pos, QImage& to )
+{
+    const auto rect = fromRect.translated( pos ) & to.rect();
+    if ( rect.isEmpty() )
+        return;
+
+    // both images are QImage::Format_RGB32
+    const int bytes = rect.width() * 4;
+
+    for ( int y = rect.top(); y <= rect.bottom(); y++ )
+    {
+        const auto line = from.constScanLine( y - pos.y() ) + ( rect.x() - pos.x() ) * 4;
+        memcpy( to.scanLine( y ) + rect.x() * 4, line, bytes );
+    }
+}
+
+void VncServer::updateFrameBuffer( QWindow* window, const QRegion& damage )
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    auto grabber = findGrabber( m_grabbers, window );
+    if ( grabber == nullptr )
+        return;
+
+    {
+        // consecutive frames in short intervals: an animation is running
+        const bool animated = grabber->renderTimer.isValid()
+            && grabber->renderTimer.elapsed() < 100;
+
+        grabber->renderTimer.start();
+        grabber->animationFrames = animated ? grabber->animationFrames + 1 : 0;
+    }
+
+    const auto size = window->size() * window->devicePixelRatio();
+    if ( size != grabber->rect.size() )
+    {
+        /*
+            On EGLFS the window always matches the screen size.
+
+            But when testing the implementation on X11 the window
+            might be resized manually later. Should be no problem,
+            as most clients indicate being capable of adjustments
+            of the framebuffer size. ( "DesktopSize" pseudo encoding )
+
+            The layout is updated in the GUI thread, what
+            also triggers the next frame.
+         */
+
+        QMetaObject::invokeMethod( this, "updateLayout", Qt::QueuedConnection );
+        return;
+    }
+
+    // needs to be called for each frame to measure the frame rate
+    const bool grabAllowed = grabber->budget.isGrabAllowed();
+
+    if ( !( grabber->frameRequested && grabAllowed ) )
+    {
+        /*
+            Reading back the frame is expensive and pointless,
+            when no client is waiting for it. We keep the damage
+            and catch up, when the next frame is requested.
+
+            Frames might also be skipped to protect the frame rate
+            of the application.
+         */
+        grabber->framesSkipped = true;
+        grabber->skippedDamage += damage;
+
+        return;
+    }
+
+    grabber->frameRequested = false;
+
+    // reading back and composing the frame
+    const VncCpuTimer cpuTimer;
+
+    const auto windowRect = QRect( QPoint(), size );
+    auto pendingDamage = ( damage | grabber->skippedDamage ) & windowRect;
+
+    grabber->framesSkipped = false;
+    grabber->skippedDamage = QRegion();
+
+#ifdef VNC_SOFTWARE
+    if ( grabber->softwareGrabber.isActive() )
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        // without a previous image we don't know what has changed
+        const bool hasImage = ( size == grabber->image.size() );
+
+        if ( !hasImage )
+            grabber->image = QImage( size, QImage::Format_RGB32 );
+
+        const auto windowDamage = hasImage ? pendingDamage : QRegion( windowRect );
+
+        if ( !grabber->softwareGrabber.grab( grabber->image, windowDamage ) )
+        {
+            grabber->image = QImage();
+            return;
+        }
+
+        qCDebug( logGrab ) << "grabWindow( software ):"
+            << timer.elapsed() << "ms";
+
+        composeFrame( grabber, windowDamage, false );
+
+        // composing runs on the render thread as well
+        grabber->budget.addGrab( timer.nsecsElapsed() );
+        return;
+    }
+#endif
+
+#ifdef VNC_RHI
+    if ( grabber->rhiGrabber.readBack( pendingDamage ) )
+    {
+        // the frame arrives with one of the next frames
+        return;
+    }
+#endif
+
+    if ( QOpenGLContext::currentContext() == nullptr )
+    {
+        // f.e. Vulkan without having support for QRhi readbacks
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if ( grabYuv( grabber, pendingDamage ) )
+    {
+        const auto nsecs = timer.nsecsElapsed();
+        grabber->budget.addGrab( nsecs );
+
+        qCDebug( logGrab ) << "grabWindow( YCbCr ):" << nsecs / 1000000 << "ms";
+        return;
+    }
+
+    /*
+        What has not been read back as RGB during an animation. The fingerprints
+        of the RGB frames do not know about the JPEG frames in between.
+     */
+    const bool yuvStale = !m_yuvStaleRegion.isEmpty();
+    pendingDamage += m_yuvStaleRegion;
+
+    m_yuvStaleRegion = QRegion();
+    m_yuvFrame = RfbYuvImage();
+
+    // viewers with a reduced resolution: downscaled on the GPU
+    bool scaledComplete = false;
+    const auto scaledLevels = grabScaled( grabber, pendingDamage, scaledComplete );
+
+    const bool fullFrame = scaledLevels.isEmpty() || m_scaleLevels.contains( 1 )
+        || m_recorder.isOpen() || !m_latencyProbe.rect().isEmpty();
+
+    if ( !fullFrame )
+    {
+        /*
+            Nobody needs the frame in full resolution. As it is not
+            updated anymore it has to be read back completely,
+            when being needed again.
+         */
+        grabber->image = QImage();
+        m_frameBuffer = QImage();
+
+        qCDebug( logGrab ) << "grabWindow( scaled ):" << timer.elapsed() << "ms";
+
+        // the clients map the damage to their scale level
+        const auto dirtyRegion = scaledComplete ? QRegion( windowRect ) : pendingDamage;
+
+        // the levels are scaled from the same frame: checking one is enough
+        const auto scaledImage = m_scaledFrameBuffers.value( scaledLevels.first() );
+
+        m_hasher.checkFrame( VncFrameHasher::ScaledFrameBuffer,
+            scaledImage, dirtyRegion, scaledComplete || yuvStale );
+
+        grabber->budget.addGrab( timer.nsecsElapsed() );
+        return;
+    }
+
+    // without a previous image we don't know what has changed
+    const bool hasImage = ( size == grabber->image.size() );
+
+    auto windowDamage = hasImage ? pendingDamage : QRegion( windowRect );
+
+    if ( !hasImage )
+        grabber->image = QImage( size, QImage::Format_RGB32 );
+
+    if ( hasImage )
+        grabWindow( grabber->image, windowDamage );
+    else
+        grabWindow( grabber->image );
+
+    qCDebug( logGrab ) << "grabWindow:" << timer.elapsed() << "ms";
+
+    if ( scaledComplete )
+        windowDamage = windowRect;
+
+    composeFrame( grabber, windowDamage, scaledComplete || yuvStale );
+
+    /*
+        The budget is about the time the render thread is blocked:
+        composing the frame buffer is part of it.
+     */
+    grabber->budget.addGrab( timer.nsecsElapsed() );
+}
+
+void VncServer::updateFrameBuffer( QWindow* window,
+    const QImage& image, const QRegion& damage )
+{
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    auto grabber = findGrabber( m_grabbers, window );
+    if ( grabber == nullptr )
+        return;
+
+    if ( image.size() != grabber->rect.size() )
+    {
+        // the window has been resized, while the readback was in flight
+        return;
+    }
+
+    const VncCpuTimer cpuTimer;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const auto windowRect = QRect( QPoint(), image.size() );
+
+    // without a previous image we don't know what has changed
+    const bool hasImage = ( image.size() == grabber->image.size() );
+
+    grabber->image = image.convertToFormat( QImage::Format_RGB32 );
+
+    qCDebug( logGrab ) << "grabWindow( readback ):" << timer.elapsed() << "ms";
+
+    composeFrame( grabber, hasImage ? ( damage & windowRect ) : QRegion( windowRect ), false );
+
+    grabber->budget.addGrab( timer.nsecsElapsed() );
+}
+
+void VncServer::composeFrame( QObject* object, QRegion windowDamage, bool enforced )
+{
+    auto grabber = static_cast< WindowGrabber* >( object );
+
+    const auto rect = grabber->rect;
+    const auto windowRect = QRect( QPoint(), rect.size() );
+
+    // the clients might have received frames from a different source before
+    enforced = enforced || m_frameBuffer.isNull();
+
+    /*
+        The image of the grabber is owned by the render thread and updated
+        in place. It is never handed out, as detaching it would copy
+        the complete frame for each grab.
+     */
+
+    QRegion dirtyRegion;
+
+    if ( m_frameBuffer.isNull() )
+    {
+        m_frameBuffer = QImage( m_frameBufferSize, QImage::Format_RGB32 );
+
+        if ( rect != m_frameBuffer.rect() )
+            m_frameBuffer.fill( Qt::black );
+
+        m_spareFrameBuffer = QImage();
+        m_spareDamage = QRegion();
+
+        // the other windows might not be rendered again for a while
+        const auto& grabbers = m_grabbers;
+        for ( auto object : grabbers )
+        {
+            auto other = static_cast< WindowGrabber* >( object );
+            if ( other->image.size() == other->rect.size() )
+            {
+                copyImage( other->image, other->image.rect(),
+                    other->rect.topLeft(), m_frameBuffer );
+            }
+        }
+
+        windowDamage = windowRect;
+        dirtyRegion = m_frameBuffer.rect();
+    }
+    else
+    {
+        detachFrameBuffer();
+
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 8, 0 )
+        for ( const auto& damageRect : windowDamage )
+#else
+        for ( const auto& damageRect : windowDamage.rects() )
+#endif
+            copyImage( grabber->image, damageRect, rect.topLeft(), m_frameBuffer );
+    }
+
+    dirtyRegion += windowDamage.translated( rect.topLeft() );
+
+    // the spare buffer is behind by the parts of this frame
+    if ( !m_spareFrameBuffer.isNull() )
+        m_spareDamage += dirtyRegion;
+
+    if ( m_recorder.isOpen() )
+        m_recorder.record( m_frameBuffer, m_clock.elapsed() );
+
+    m_latencyProbe.checkFrame( m_frameBuffer, dirtyRegion );
+
+    if ( m_publisher )
+    {
+        // the viewers are handled by the vnceglfs-server processes
+        m_publisher->publish( m_frameBuffer, dirtyRegion );
+        return;
+    }
+
+    // the clients are marked dirty, when the frame has changed
+    m_hasher.checkFrame( VncFrameHasher::FrameBuffer, m_frameBuffer, dirtyRegion, enforced );
+}
+
+void VncServer::detachFrameBuffer()
+{
+    if ( m_frameBuffer.isDetached() )
+        return;
+
+    /*
+        The frame buffer is shared with clients, that are still encoding
+        a previous frame. Instead of detaching, what copies the complete
+        frame, we continue with the spare buffer, when it is not in use
+        anymore. It only needs the parts, that have changed since.
+     */
+
+    if ( m_spareFrameBuffer.size() == m_frameBuffer.size()
+        && m_spareFrameBuffer.isDetached() )
+    {
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 8, 0 )
+        for ( const auto& rect : m_spareDamage )
+#else
+        for ( const auto& rect : m_spareDamage.rects() )
+#endif
+            copyImage( m_frameBuffer, rect, QPoint(), m_spareFrameBuffer );
+
+        m_frameBuffer.swap( m_spareFrameBuffer );
+    }
+    else
+    {
+        // the previous frame becomes the spare buffer, when being released
+        m_spareFrameBuffer = m_frameBuffer;
+        m_frameBuffer = m_spareFrameBuffer.copy();
+    }
+
+    m_spareDamage = QRegion();
+}
+
+QVector< int > VncServer::grabScaled(
+    QObject* object, const QRegion& damage, bool& complete )
+{
+    auto grabber = static_cast< WindowGrabber* >( object );
+
+    QVector< int > levels;
+
+    /*
+        Composing downscaled windows would need positions, that are
+        multiples of the divisor: limited to the single window case.
+        The vnceglfs-server processes are scaling on their own.
+     */
+    const bool supported = ( m_grabbers.count() == 1 ) && ( m_publisher == nullptr )
+        && !grabber->scaleFailed && canBlitScaled( QOpenGLContext::currentContext() );
+
+    if ( supported )
+    {
+        for ( auto it = m_scaleLevels.constBegin(); it != m_scaleLevels.constEnd(); ++it )
+        {
+            const int divisor = it.key();
+            if ( divisor <= 1 )
+                continue;
+
+            VncScaler scaler;
+            scaler.setDivisor( divisor );
+
+            const auto size = scaler.scaledSize( grabber->rect.size() );
+            if ( size.isEmpty() )
+                continue;
+
+            auto& target = grabber->scaleTargets[ divisor ];
+            if ( target.size != size )
+            {
+                releaseScaleTarget( target );
+
+                if ( !createScaleTarget( target, size ) )
+                {
+                    qCWarning( logGrab ) << "Can't downscale on the GPU, falling back to the CPU";
+
+                    grabber->scaleFailed = true;
+
+                    // all clients are served from the full frame instead
+                    levels.clear();
+                    break;
+                }
+            }
+
+            auto& image = m_scaledFrameBuffers[ divisor ];
+
+            QRegion region;
+
+            if ( image.size() == size )
+            {
+#if QT_VERSION >= QT_VERSION_CHECK( 5, 8, 0 )
+                for ( const auto& rect : damage )
+#else
+                for ( const auto& rect : damage.rects() )
+#endif
+                    region += scaler.scaledRect( rect ) & image.rect();
+            }
+            else
+            {
+                image = QImage( size, QImage::Format_RGB32 );
+                region = image.rect();
+
+                complete = true;
+            }
+
+            if ( !region.isEmpty() )
+                readScaled( target, divisor, grabber->rect.size(), region, image );
+
+            levels += divisor;
+        }
+    }
+
+    // levels, that are not requested anymore
+
+    for ( auto it = grabber->scaleTargets.begin(); it != grabber->scaleTargets.end(); )
+    {
+        if ( levels.contains( it.key() ) )
+        {
+            ++it;
+        }
+        else
+        {
+            releaseScaleTarget( it.value() );
+            it = grabber->scaleTargets.erase( it );
+        }
+    }
+
+    for ( auto it = m_scaledFrameBuffers.begin(); it != m_scaledFrameBuffers.end(); )
+    {
+        if ( levels.contains( it.key() ) )
+            ++it;
+        else
+            it = m_scaledFrameBuffers.erase( it );
+    }
+
+    return levels;
+}
+
+bool VncServer::grabYuv( QObject* object, const QRegion& damage )
+{
+    auto grabber = static_cast< WindowGrabber* >( object );
+
+    /*
+        Tight needs RGB for its lossless rectangles, so the planes
+        are only an option for the animated parts of a single window,
+        when all viewers are receiving JPEG anyway. Each client
+        registers exactly one scale level.
+     */
+    int clientCount = 0;
+    for ( auto it = m_scaleLevels.constBegin(); it != m_scaleLevels.constEnd(); ++it )
+        clientCount += it.value();
+
+    const bool supported = ( clientCount > 0 ) && ( m_yuvClients == clientCount )
+        && ( m_grabbers.count() == 1 ) && ( m_publisher == nullptr )
+        && !m_recorder.isOpen() && m_latencyProbe.rect().isEmpty()
+        && !grabber->yuvFailed && VncYuvConverter::isSupported( QOpenGLContext::currentContext() );
+
+    if ( !supported || grabber->animationFrames < 3 )
+        return false;
+
+    const auto size = grabber->rect.size();
+
+    // the stale parts are merged from the RGB frames, when the animation stops
+    if ( grabber->image.size() != size || m_frameBuffer.size() != size )
+        return false;
+
+    const auto bounds = ( damage | m_yuvStaleRegion ).boundingRect();
+    if ( bounds.isEmpty() )
+        return false;
+
+    // aligned to the 16x16 blocks of JPEG with 4:2:0
+    const int x1 = bounds.left() & ~15;
+    const int y1 = bounds.top() & ~15;
+    const int x2 = qMin( ( bounds.right() + 16 ) & ~15, size.width() );
+    const int y2 = qMin( ( bounds.bottom() + 16 ) & ~15, size.height() );
+
+    const QRect rect( x1, y1, x2 - x1, y2 - y1 );
+
+    if ( ( rect.width() % 8 ) || ( rect.height() % 2 ) )
+        return false;
+
+    RfbYuvImage yuv;
+
+    if ( !grabber->yuvConverter.convert( size, rect, yuv ) )
+    {
+        qCWarning( logGrab ) << "Can't convert to YCbCr on the GPU, reading back RGB";
+
+        grabber->yuvFailed = true;
+        return false;
+    }
+
+    m_yuvStaleRegion = rect;
+    m_yuvFrame = yuv;
+    m_yuvPos = rect.topLeft();
+
+    /*
+        The luma plane is good enough to detect unchanged frames. The
+        image shares the data of the plane and keeps it alive.
+     */
+    auto plane = new QByteArray( yuv.y );
+
+    const QImage luma( reinterpret_cast< const uchar* >( plane->constData() ),
+        rect.width(), rect.height(), rect.width(), QImage::Format_Grayscale8,
+        []( void* data ) { delete static_cast< QByteArray* >( data ); }, plane );
+
+    m_hasher.checkFrame( VncFrameHasher::YuvFrame, luma, rect, false );
+
+    // the timer lives in the GUI thread
+    QMetaObject::invokeMethod( &m_yuvTimer, "start", Qt::QueuedConnection );
+
+    return true;
+}
+
+void VncServer::setLatencyProbe( const QRect& rect, int interval )
+{
+    m_latencyProbe.setRect( rect );
+
+    if ( rect.isEmpty() )
+        m_probeTimer.stop();
+    else
+        m_probeTimer.start( qMax( interval, 100 ) );
+}
+
+void VncServer::injectProbeInput()
+{
+    if ( m_threads.isEmpty() )
+        return; // nobody to send the response to
+
+    QPointF pos;
+
+    auto window = windowAt( m_latencyProbe.rect().center(), pos );
+    if ( window == nullptr )
+        return;
+
+    if ( !m_latencyProbe.startMeasurement( frameBuffer() ) )
+        return;
+
+    // the same path as the input of the viewers
+    RfbInputEventQueue queue;
+    queue.addPointerEvent( window, pos, Rfb::ButtonLeft );
+    queue.addPointerEvent( window, pos, 0 );
+    queue.flush();
+}
+
+void VncServer::frameSent( const QRegion& region )
+{
+    m_latencyProbe.checkSent( region );
+}
+
+void VncServer::requestFrame()
+{
+    if ( m_subscriber )
+    {
+        m_subscriber->requestFrame();
+        return;
+    }
+
+    QMutexLocker locker( &m_frameBufferMutex );
+
+    const auto& grabbers = m_grabbers;
+    for ( auto object : grabbers )
+    {
+        auto grabber = static_cast< WindowGrabber* >( object );
+        grabber->frameRequested = true;
+
+        if ( grabber->framesSkipped )
+        {
+            // the last rendered frame has not been grabbed: catching up
+            grabber->framesSkipped = false;
+
+            QMetaObject::invokeMethod( grabber->window(), "update", Qt::QueuedConnection );
+        }
+    }
+}
+
+void VncServer::setFrameBuffer( const QImage& image )
+{
+    setFrameBuffer( image, image.rect() );
+}
+
+void VncServer::setFrameBuffer( const QImage& image, const QRegion& damage )
+{
+    {
+        QMutexLocker locker( &m_frameBufferMutex );
+
+        m_frameBuffer = image.convertToFormat( QImage::Format_RGB32 );
+        m_spareFrameBuffer = QImage();
+        m_scaledFrameBuffers.clear();
+        m_yuvFrame = RfbYuvImage();
+
+        // after a resize the damage of the previous frame is meaningless
+        const bool resized = ( m_frameBuffer.size() != m_frameBufferSize );
+        m_frameBufferSize = m_frameBuffer.size();
+
+        if ( m_publisher )
+        {
+            m_publisher->publish( m_frameBuffer,
+                resized ? QRegion( m_frameBuffer.rect() ) : damage );
+        }
+    }
+
+    markClientsDirty( damage );
+}
+
+bool VncServer::startPublishing( const QString& path )
+{
+    if ( m_publisher || m_subscriber )
+        return false;
+
+    auto publisher = new VncFramePublisher( this );
+    if ( !publisher->listen( path ) )
+    {
+        qCWarning( logConnection ) << "Can't publish frames on" << path;
+
+        delete publisher;
+        return false;
+    }
+
+    // the viewers are connecting to the vnceglfs-server processes
+    qDeleteAll( m_listeners );
+    m_listeners.clear();
+
+    connect( publisher, &VncFramePublisher::readerCountChanged, this,
+        [this]( int count )
+        {
+            if ( m_replayer == nullptr )
+            {
+                if ( count > 0 )
+                    startGrabbing();
+                else
+                    stopGrabbing();
+            }
+        }
+    );
+
+    {
+        QMutexLocker locker( &m_frameBufferMutex );
+        m_publisher = publisher;
+    }
+
+    qCDebug( logConnection ) << "VncServer publishing frames on" << publisher->path();
+    return true;
+}
+
+bool VncServer::subscribe( const QString& path )
+{
+    if ( m_subscriber || m_publisher || !windows().isEmpty() )
+        return false;
+
+    m_subscriber = new VncFrameSubscriber( this );
+    m_subscriber->subscribe( path );
+
+    return true;
+}
+
+bool VncServer::isSubscribed() const
+{
+    return m_subscriber != nullptr;
+}
+
+void VncServer::forwardPointerEvent( const QPoint& pos, quint8 buttonMask )
+{
+    if ( m_subscriber )
+        m_subscriber->sendPointerEvent( pos, buttonMask );
+}
+
+void VncServer::forwardKeyEvent( quint32 key, bool down )
+{
+    if ( m_subscriber )
+        m_subscriber->sendKeyEvent( key, down );
+}
+
+void VncServer::markClientsDirty( const QRegion& region )
+{
+    // called from the GUI thread and the thread of the frame hasher
+    QMutexLocker locker( &m_threadsMutex );
+
+    const auto& threads = m_threads;
     for ( auto thread : threads )
     {
         auto clientThread = static_cast< ClientThread* >( thread );
-        clientThread->markDirty();
+        clientThread->markDirty( region );
     }
 }
 
-QWindow* VncServer::window() const
+bool VncServer::startRecording( const QString& fileName )
+{
+    /*
+        Recording happens in the render thread, while the server
+        is living in the GUI thread. The recorder is thread-safe, so that
+        the grabbing is not blocked while writing the pending frames.
+     */
+    return m_recorder.open( fileName );
+}
+
+void VncServer::stopRecording()
+{
+    m_recorder.close();
+}
+
+bool VncServer::startReplay( const QString& fileName, bool maxSpeed )
+{
+    stopReplay();
+
+    auto replayer = new VncReplayer( this );
+    if ( !replayer->open( fileName ) )
+    {
+        delete replayer;
+        return false;
+    }
+
+    stopGrabbing();
+
+    // continuing with grabbing the window, when the recording is over
+    connect( replayer, &VncReplayer::finished,
+        this, &VncServer::stopReplay, Qt::QueuedConnection );
+
+    m_replayer = replayer;
+    m_replayer->start( maxSpeed );
+
+    return true;
+}
+
+void VncServer::stopReplay()
+{
+    if ( m_replayer == nullptr )
+        return;
+
+    delete m_replayer;
+    m_replayer = nullptr;
+
+    {
+        // the grabbed frames might update parts of the frame buffer only
+        QMutexLocker locker( &m_frameBufferMutex );
+        m_frameBuffer = QImage();
+        m_scaledFrameBuffers.clear();
+        m_yuvFrame = RfbYuvImage();
+    }
+
+    updateLayout();
+
+    if ( hasViewers() )
+        startGrabbing();
+}
+
+void VncServer::startGrabbing()
+{
+    const auto& grabbers = m_grabbers;
+    for ( auto grabber : grabbers )
+        static_cast< WindowGrabber* >( grabber )->start();
+}
+
+void VncServer::updateGrabbing( const QWindow* window, bool visible )
+{
+    WindowGrabber* grabber;
+
+    {
+        QMutexLocker locker( &m_frameBufferMutex );
+        grabber = findGrabber( m_grabbers, window );
+    }
+
+    if ( grabber == nullptr )
+        return;
+
+    if ( visible )
+    {
+        if ( hasViewers() && m_replayer == nullptr )
+            grabber->start();
+    }
+    else
+    {
+        grabber->stop();
+    }
+}
+
+void VncServer::stopGrabbing()
 {
-    return m_window;
+    const auto& grabbers = m_grabbers;
+    for ( auto grabber : grabbers )
+        static_cast< WindowGrabber* >( grabber )->stop();
+}
+
+bool VncServer::hasViewers() const
+{
+    if ( m_publisher && m_publisher->readerCount() > 0 )
+        return true;
+
+    return !m_threads.isEmpty();
 }
 
 QImage VncServer::frameBuffer() const
@@ -337,7 +1982,54 @@ QImage VncServer::frameBuffer() const
 
 VncCursor VncServer::cursor() const
 {
-    return m_cursor;
+    QMutexLocker locker( &m_cursorMutex );
+    const auto cursor = m_cursor;
+
+    return cursor;
+}
+
+void VncServer::updateCursor( QWindow* window )
+{
+#ifndef QT_NO_CURSOR
+    if ( window == nullptr )
+        return;
+
+    // f.e. a busy cursor during some operation
+    const auto overrideCursor = QGuiApplication::overrideCursor();
+    const auto cursor = overrideCursor ? *overrideCursor : window->cursor();
+
+    /*
+        The images are converted only, when the shape has changed.
+        The clients detect the change from the cacheKey of the image
+        and send it once.
+     */
+    const auto key = cursorKey( cursor );
+
+    if ( cursor.shape() == m_cursorShape && key == m_cursorKey )
+        return;
+
+    m_cursorShape = cursor.shape();
+    m_cursorKey = key;
+
+    const auto vncCursor = createCursor( cursor );
+
+    QMutexLocker locker( &m_cursorMutex );
+    m_cursor = vncCursor;
+#else
+    Q_UNUSED( window )
+#endif
+}
+
+bool VncServer::eventFilter( QObject* object, QEvent* event )
+{
+    if ( event->type() == QEvent::CursorChange )
+    {
+        auto window = qobject_cast< QWindow* >( object );
+        if ( window && hasWindow( window ) )
+            updateCursor( window );
+    }
+
+    return QObject::eventFilter( object, event );
 }
 
 #include "VncServer.moc"
@@ -8,15 +8,35 @@
 #include <qobject.h>
 #include <qimage.h>
 #include <qvector.h>
+#include <qlist.h>
+#include <qmap.h>
 #include <qmutex.h>
-#include <qpointer.h>
+#include <qelapsedtimer.h>
+#include <qtimer.h>
+
+#include "VncRecorder.h"
+#include "VncFrameHasher.h"
+#include "VncListener.h"
+#include "VncLatencyProbe.h"
+#include "RfbEncoder.h"
 
 class QWindow;
-class QTcpServer;
+class QRegion;
+class VncFramePublisher;
+class VncFrameSubscriber;
 
 class VncCursor
 {
   public:
+    VncCursor() = default;
+
+    VncCursor( const QImage& cursorImage, const QPoint& cursorHotspot )
+        : image( cursorImage.convertToFormat( QImage::Format_RGBA8888_Premultiplied ) )
+        , hotspot( cursorHotspot )
+    {
+    }
+
+    // premultiplied RGBA, what is the format of the CursorWithAlpha encoding
     QImage image;
     QPoint hotspot;
 };
@@ -26,34 +46,199 @@ class VncServer final : public QObject
     Q_OBJECT
 
   public:
+    // window might be nullptr for a server, that subscribes to frames
     VncServer( int port, QWindow* );
     ~VncServer() override;
 
+    /*
+        A server might mirror several windows - f.e. one window
+        for each screen - composed into one frame buffer
+     */
+    void addWindow( QWindow* );
+    void removeWindow( const QWindow* );
+    bool hasWindow( const QWindow* ) const;
+
+    QWindow* window() const;
+    QList< QWindow* > windows() const;
+
     QImage frameBuffer() const;
+    QSize frameBufferSize() const;
+
+    /*
+        The clients announce the divisor, they want to receive the frames with.
+        When possible the window is downscaled on the GPU for each requested
+        divisor, so that only the scaled frame needs to be read back.
+        Can be called from any thread.
+     */
+    void addScaleLevel( int divisor );
+    void removeScaleLevel( int divisor );
+
+    // a null image, when the frame has not been downscaled on the GPU
+    QImage scaledFrameBuffer( int divisor ) const;
+
+    /*
+        Clients, that send JPEG and can take the YCbCr planes of the converter
+        as they are. When all clients are capable, animated parts of the
+        window are converted on the GPU instead of being read back as RGB.
+        Can be called from any thread.
+     */
+    void addYuvClient();
+    void removeYuvClient();
+
+    // a null image, when the last frame has been read back as RGB
+    RfbYuvImage yuvFrame( QPoint& pos ) const;
+
+    // geometries of the windows inside of the frame buffer
+    QVector< QRect > screenLayout() const;
+
+    QWindow* windowAt( const QPoint&, QPointF& windowPos ) const;
+    QWindow* keyboardWindow() const;
+
     VncCursor cursor() const;
 
-    QWindow* window() const;
     int port() const;
+    int webSocketPort() const; // -1, when not listening
+
+    /*
+        Accepting connections on further addresses: "tcp:<port>",
+        "ws:<port>", "unix:<path>", "vsock:<port>". F.e. browser based
+        viewers like noVNC connect via WebSocket.
+     */
+    bool addListener( const QString& address );
 
     void setTimerInterval( int ms );
+    void setGrabBudget( qreal ms, int loadLimit );
+
+    /*
+        Called from the client threads, when a client is waiting for
+        a frame. Windows are grabbed on demand only.
+     */
+    void requestFrame();
+
+    // replacing the grabbed frames, f.e. when replaying a recording
+    void setFrameBuffer( const QImage& );
+    void setFrameBuffer( const QImage&, const QRegion& damage );
+
+    /*
+        Out of process mode: the grabbed frames are published for
+        vnceglfs-server processes connecting to path, that are handling
+        the viewers. The server stops accepting viewers on its own.
+     */
+    bool startPublishing( const QString& path );
+
+    /*
+        The counterpart of startPublishing in the vnceglfs-server process:
+        a server without windows, that mirrors the published frames and
+        forwards the input of its viewers.
+     */
+    bool subscribe( const QString& path );
+    bool isSubscribed() const;
+
+    // called from the client threads of a subscribed server
+    void forwardPointerEvent( const QPoint& pos, quint8 buttonMask );
+    void forwardKeyEvent( quint32 key, bool down );
+
+    bool startRecording( const QString& fileName );
+    void stopRecording();
+
+    bool startReplay( const QString& fileName, bool maxSpeed );
+    void stopReplay();
+
+    /*
+        Injecting a click into the center of rect every interval ms
+        and measuring how long it takes until the response has been
+        sent. An empty rect disables the measurement.
+     */
+    void setLatencyProbe( const QRect& rect, int interval );
+
+    // called from the client threads, after region has been sent
+    void frameSent( const QRegion& region );
+
+    /*
+        Called from the scene graph thread of the window. damage is
+        in window coordinates and limits what has to be copied and sent
+     */
+    void updateFrameBuffer( QWindow*, const QRegion& damage );
+
+    /*
+        Called from the scene graph thread, when an asynchronous
+        readback of the window has been completed.
+     */
+    void updateFrameBuffer( QWindow*, const QImage&, const QRegion& damage );
+
+  protected:
+    bool eventFilter( QObject*, QEvent* ) override;
 
   private Q_SLOTS:
-    void updateFrameBuffer();
+    void updateLayout();
 
   private:
-    void addClient( qintptr fd );
+    void addListener( VncListener* );
+    int listenerPort( VncListener::Transport ) const;
+
+    void addClient( qintptr fd, VncListener::Transport );
     void removeClient();
 
-    QTcpServer* m_tcpServer = nullptr;
+    void startGrabbing();
+    void stopGrabbing();
+    void updateGrabbing( const QWindow*, bool visible );
+    void removeGrabber( const QWindow*, bool windowDestroyed );
+    bool hasViewers() const;
+
+    void injectProbeInput();
+
+    void updateCursor( QWindow* );
+    void markClientsDirty( const QRegion& );
 
-    QPointer< QWindow > m_window;
+    QVector< int > grabScaled( QObject* grabber, const QRegion& damage, bool& complete );
+    bool grabYuv( QObject* grabber, const QRegion& damage );
+
+    void composeFrame( QObject* grabber, QRegion windowDamage, bool enforced );
+    void detachFrameBuffer();
+
+    const int m_port; // the port, the server has been created for
+    QVector< VncListener* > m_listeners;
+
+    QVector< QObject* > m_grabbers; // one for each window
+
+    // modified in the GUI thread only
+    mutable QMutex m_threadsMutex;
     QVector< QThread* > m_threads;
 
     mutable QMutex m_frameBufferMutex;
     QImage m_frameBuffer;
 
+    // double buffering, when the frame buffer is still in use by the clients
+    QImage m_spareFrameBuffer;
+    QRegion m_spareDamage;
+    QSize m_frameBufferSize;
+
+    QMap< int, int > m_scaleLevels; // divisor -> number of clients
+    QMap< int, QImage > m_scaledFrameBuffers;
+
+    int m_yuvClients = 0;
+    RfbYuvImage m_yuvFrame;
+    QPoint m_yuvPos;
+
+    // parts of the RGB frame buffer, that have not been updated in YCbCr mode
+    QRegion m_yuvStaleRegion;
+    QTimer m_yuvTimer;
+
+    mutable QMutex m_cursorMutex;
     VncCursor m_cursor;
+    Qt::CursorShape m_cursorShape;
+    qint64 m_cursorKey = 0;
+    QTimer m_cursorTimer;
 
-    QMetaObject::Connection m_grabConnectionId;
-};
+    VncFrameHasher m_hasher;
 
+    QElapsedTimer m_clock;
+
+    VncLatencyProbe m_latencyProbe;
+    QTimer m_probeTimer;
+    VncRecorder m_recorder;
+    VncReplayer* m_replayer = nullptr;
+
+    VncFramePublisher* m_publisher = nullptr;
+    VncFrameSubscriber* m_subscriber = nullptr;
+};
@@ -0,0 +1,150 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncSoftwareGrabber.h"
+
+#include <qquickwindow.h>
+#include <qsgrendererinterface.h>
+#include <qimage.h>
+
+#include <private/qquickwindow_p.h>
+#include <private/qsgsoftwarerenderer_p.h>
+
+#include <cstring>
+
+static inline QSGSoftwareRenderer* softwareRenderer( QQuickWindow* window )
+{
+    auto rendererInterface = window->rendererInterface();
+
+    if ( rendererInterface == nullptr
+        || rendererInterface->graphicsApi() != QSGRendererInterface::Software )
+    {
+        return nullptr;
+    }
+
+    return static_cast< QSGSoftwareRenderer* >( QQuickWindowPrivate::get( window )->renderer );
+}
+
+VncSoftwareGrabber::VncSoftwareGrabber( QWindow* window )
+    : m_window( static_cast< QQuickWindow* >( window ) )
+    , m_invalidated( 1 )
+{
+    Q_ASSERT( window && window->inherits( "QQuickWindow" ) );
+}
+
+VncSoftwareGrabber::~VncSoftwareGrabber()
+{
+}
+
+void VncSoftwareGrabber::invalidate()
+{
+    m_invalidated.storeRelease( 1 );
+}
+
+bool VncSoftwareGrabber::isActive() const
+{
+    return backingStoreImage() != nullptr;
+}
+
+const QImage* VncSoftwareGrabber::backingStoreImage() const
+{
+    auto renderer = softwareRenderer( m_window );
+    if ( renderer == nullptr )
+        return nullptr;
+
+    // the paint device of the backing store, that has been used for the last frame
+    auto device = renderer->currentPaintDevice();
+    if ( device == nullptr || device->devType() != QInternal::Image )
+        return nullptr;
+
+    return static_cast< const QImage* >( device );
+}
+
+QRegion VncSoftwareGrabber::takeDamage()
+{
+    const QRect windowRect( QPoint(), m_window->size() * m_window->devicePixelRatio() );
+
+    if ( m_invalidated.fetchAndStoreAcquire( 0 ) )
+        return windowRect;
+
+    auto renderer = softwareRenderer( m_window );
+    if ( renderer == nullptr )
+        return windowRect;
+
+    // the flush region is in logical coordinates
+    const auto flushRegion = renderer->flushRegion();
+
+    const auto ratio = m_window->devicePixelRatio();
+    if ( ratio == 1.0 )
+        return flushRegion & windowRect;
+
+    QRegion damage;
+
+    for ( const auto& rect : flushRegion )
+    {
+        const QRectF r( rect.x() * ratio, rect.y() * ratio,
+            rect.width() * ratio, rect.height() * ratio );
+
+        damage += r.toAlignedRect();
+    }
+
+    return damage & windowRect;
+}
+
+bool VncSoftwareGrabber::grab( QImage& image, const QRegion& region ) const
+{
+    const auto source = backingStoreImage();
+    if ( source == nullptr || source->size() != image.size() )
+        return false;
+
+    // the image of the grabber is never handed out by the server
+    Q_ASSERT( image.isDetached() );
+
+    const auto format = source->format();
+
+    // the opaque formats of the backing stores are layout compatible to RGB32
+    const bool isRGB32 = ( format == QImage::Format_RGB32 )
+        || ( format == QImage::Format_ARGB32 )
+        || ( format == QImage::Format_ARGB32_Premultiplied );
+
+    for ( const auto& rect : region )
+    {
+        const auto r = rect & image.rect();
+        if ( r.isEmpty() )
+            continue;
+
+        if ( isRGB32 )
+        {
+            const int bytes = r.width() * 4;
+
+            for ( int y = r.top(); y <= r.bottom(); y++ )
+            {
+                auto to = reinterpret_cast< QRgb* >( image.scanLine( y ) ) + r.x();
+
+                memcpy( to, source->constScanLine( y ) + r.x() * 4, bytes );
+
+                if ( format != QImage::Format_RGB32 )
+                {
+                    // RGB32 expects an opaque alpha channel
+                    for ( int x = 0; x < r.width(); x++ )
+                        to[x] |= 0xff000000;
+                }
+            }
+        }
+        else
+        {
+            // f.e. RGB16 on linuxfb
+            const auto converted = source->copy( r ).convertToFormat( QImage::Format_RGB32 );
+
+            for ( int y = 0; y < r.height(); y++ )
+            {
+                memcpy( image.scanLine( r.y() + y ) + r.x() * 4,
+                    converted.constScanLine( y ), r.width() * 4 );
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,57 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qregion.h>
+#include <qatomic.h>
+
+class QWindow;
+class QQuickWindow;
+class QImage;
+
+/*
+    Devices without GPU run Qt/Quick with the software adaptation, where
+    the scene graph paints into the image of a backing store. Then the
+    frame can be taken from there instead of reading back from OpenGL.
+
+    The renderer also knows exactly which parts have been painted, so the
+    damage of each frame is available without tracking the items.
+
+    The backing store is painted again for the next frame, so the damaged
+    parts need to be copied - but nothing else.
+ */
+class VncSoftwareGrabber
+{
+  public:
+    VncSoftwareGrabber( QWindow* );
+    ~VncSoftwareGrabber();
+
+    // the next damage will be the complete window
+    void invalidate();
+
+    // the following methods are called from the scene graph thread after rendering
+
+    // true, when the window is rendered by the software adaptation
+    bool isActive() const;
+
+    // the region, that has been painted for the last frame
+    QRegion takeDamage();
+
+    /*
+        Copying region of the backing store into image, that has the size
+        of the window. image is updated in place and must not be shared,
+        otherwise writing into it would copy the complete frame first.
+     */
+    bool grab( QImage& image, const QRegion& region ) const;
+
+  private:
+    Q_DISABLE_COPY( VncSoftwareGrabber )
+
+    const QImage* backingStoreImage() const;
+
+    QQuickWindow* const m_window;
+    QAtomicInt m_invalidated;
+};
@@ -0,0 +1,369 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncThreadPolicy.h"
+
+#include <qthread.h>
+#include <qglobalstatic.h>
+#include <qloggingcategory.h>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+Q_LOGGING_CATEGORY( logThreads, "vnceglfs.threads", QtWarningMsg )
+
+// export QT_LOGGING_RULES="vnceglfs.threads.info=true"
+
+namespace
+{
+    const char* roleName( Vnc::ThreadRole role )
+    {
+        switch( role )
+        {
+            case Vnc::IOThreads:
+                return "io";
+
+            case Vnc::EncodeThreads:
+                return "encode";
+
+            default:
+                return "worker";
+        }
+    }
+
+    const char* schedulingName( Vnc::ThreadScheduling scheduling )
+    {
+        switch( scheduling )
+        {
+            case Vnc::BatchScheduling:
+                return "batch";
+
+            case Vnc::IdleScheduling:
+                return "idle";
+
+            default:
+                return "normal";
+        }
+    }
+
+    // "0-3,6"
+    QByteArray cpuList( QList< int > cpus )
+    {
+        std::sort( cpus.begin(), cpus.end() );
+
+        QByteArray list;
+
+        for ( int i = 0; i < cpus.count(); )
+        {
+            int j = i;
+            while ( j + 1 < cpus.count() && cpus[j + 1] == cpus[j] + 1 )
+                j++;
+
+            if ( !list.isEmpty() )
+                list += ',';
+
+            list += QByteArray::number( cpus[i] );
+            if ( j > i )
+                list += '-' + QByteArray::number( cpus[j] );
+
+            i = j + 1;
+        }
+
+        return list.isEmpty() ? QByteArray( "all" ) : list;
+    }
+
+#ifdef Q_OS_LINUX
+
+    QByteArray errorString( int error )
+    {
+        return QByteArray( ::strerror( error ) );
+    }
+
+    int nativePolicy( Vnc::ThreadScheduling scheduling )
+    {
+        switch( scheduling )
+        {
+            case Vnc::BatchScheduling:
+                return SCHED_BATCH;
+
+            case Vnc::IdleScheduling:
+                return SCHED_IDLE;
+
+            default:
+                return SCHED_OTHER;
+        }
+    }
+
+    Vnc::ThreadScheduling toScheduling( int policy )
+    {
+        switch( policy )
+        {
+            case SCHED_BATCH:
+                return Vnc::BatchScheduling;
+
+            case SCHED_IDLE:
+                return Vnc::IdleScheduling;
+
+            default:
+                return Vnc::NormalScheduling;
+        }
+    }
+
+    inline id_t threadId()
+    {
+        // on Linux the nice value is an attribute of the thread
+        return static_cast< id_t >( ::syscall( SYS_gettid ) );
+    }
+
+#endif
+}
+
+Q_GLOBAL_STATIC( VncThreadPolicy, threadPolicy )
+
+VncThreadPolicy::VncThreadPolicy()
+{
+}
+
+VncThreadPolicy* VncThreadPolicy::instance()
+{
+    return threadPolicy;
+}
+
+void VncThreadPolicy::setAffinity( Vnc::ThreadRole role, const QList< int >& cpus )
+{
+    QList< int > validCpus;
+
+    for ( const auto cpu : cpus )
+    {
+        if ( cpu >= 0 && !validCpus.contains( cpu ) )
+            validCpus += cpu;
+    }
+
+    QMutexLocker locker( &m_mutex );
+    m_settings[ role ].cpus = validCpus;
+}
+
+QList< int > VncThreadPolicy::affinity( Vnc::ThreadRole role ) const
+{
+    return settings( role ).cpus;
+}
+
+void VncThreadPolicy::setScheduling( Vnc::ThreadRole role,
+    Vnc::ThreadScheduling scheduling, int nice )
+{
+    QMutexLocker locker( &m_mutex );
+
+    auto& settings = m_settings[ role ];
+    settings.scheduling = scheduling;
+    settings.nice = qBound( -20, nice, 19 );
+}
+
+Vnc::ThreadScheduling VncThreadPolicy::scheduling( Vnc::ThreadRole role ) const
+{
+    return settings( role ).scheduling;
+}
+
+int VncThreadPolicy::niceness( Vnc::ThreadRole role ) const
+{
+    return settings( role ).nice;
+}
+
+VncThreadPolicy::Settings VncThreadPolicy::settings( Vnc::ThreadRole role ) const
+{
+    QMutexLocker locker( &m_mutex );
+    const auto settings = m_settings[ role ];
+
+    return settings;
+}
+
+bool VncThreadPolicy::setSpecification(
+    Vnc::ThreadRole role, const QByteArray& specification )
+{
+    QList< int > cpus;
+    auto scheduling = Vnc::NormalScheduling;
+    int nice = 0;
+
+    const auto tokens = specification.split( ',' );
+    for ( const auto& value : tokens )
+    {
+        const auto token = value.trimmed().toLower();
+
+        bool ok = true;
+
+        if ( token == "normal" )
+        {
+            scheduling = Vnc::NormalScheduling;
+        }
+        else if ( token == "batch" )
+        {
+            scheduling = Vnc::BatchScheduling;
+        }
+        else if ( token == "idle" )
+        {
+            scheduling = Vnc::IdleScheduling;
+        }
+        else if ( token.startsWith( "nice=" ) )
+        {
+            nice = token.mid( 5 ).toInt( &ok );
+        }
+        else
+        {
+            const auto range = token.split( '-' );
+
+            const int from = range[0].toInt( &ok );
+            int to = from;
+
+            if ( ok && range.count() == 2 )
+                to = range[1].toInt( &ok );
+
+            ok = ok && ( range.count() <= 2 ) && ( from >= 0 ) && ( from <= to );
+
+            for ( int cpu = from; ok && cpu <= to; cpu++ )
+                cpus += cpu;
+        }
+
+        if ( !ok )
+        {
+            qCWarning( logThreads ) << "Invalid specification for the"
+                << roleName( role ) << "threads:" << specification;
+
+            return false;
+        }
+    }
+
+    setAffinity( role, cpus );
+    setScheduling( role, scheduling, nice );
+
+    return true;
+}
+
+void VncThreadPolicy::attach( QThread* thread, Vnc::ThreadRole role )
+{
+    // started is emitted from the thread itself, before run() is called
+    QObject::connect( thread, &QThread::started,
+        [role]() { VncThreadPolicy::apply( role ); } );
+}
+
+void VncThreadPolicy::apply( Vnc::ThreadRole role )
+{
+    const auto settings = instance()->settings( role );
+
+    if ( settings.cpus.isEmpty() && settings.nice == 0
+        && settings.scheduling == Vnc::NormalScheduling )
+    {
+        return;
+    }
+
+    const auto name = QThread::currentThread()->objectName();
+
+#ifdef Q_OS_LINUX
+    const auto thread = ::pthread_self();
+    struct sched_param param;
+
+    if ( !settings.cpus.isEmpty() )
+    {
+        cpu_set_t cpuSet;
+        CPU_ZERO( &cpuSet );
+
+        for ( const auto cpu : settings.cpus )
+        {
+            if ( cpu < CPU_SETSIZE )
+                CPU_SET( cpu, &cpuSet );
+        }
+
+        const int error = ::pthread_setaffinity_np( thread, sizeof( cpuSet ), &cpuSet );
+        if ( error != 0 )
+        {
+            qCWarning( logThreads ) << name << "can't be pinned to"
+                << cpuList( settings.cpus ) << ":" << errorString( error );
+        }
+    }
+
+    if ( settings.scheduling != Vnc::NormalScheduling )
+    {
+        // the static priority of the non realtime policies is always 0
+        param.sched_priority = 0;
+
+        const int error = ::pthread_setschedparam(
+            thread, nativePolicy( settings.scheduling ), &param );
+
+        if ( error != 0 )
+        {
+            qCWarning( logThreads ) << name << "can't be scheduled by"
+                << schedulingName( settings.scheduling ) << ":" << errorString( error );
+        }
+    }
+
+    if ( settings.nice != 0 )
+    {
+        // lowering the nice value needs CAP_SYS_NICE
+        if ( ::setpriority( PRIO_PROCESS, threadId(), settings.nice ) != 0 )
+        {
+            qCWarning( logThreads ) << name << "can't be niced to"
+                << settings.nice << ":" << errorString( errno );
+        }
+    }
+
+    // verifying the effective setup
+
+    QList< int > cpus;
+
+    cpu_set_t cpuSet;
+    CPU_ZERO( &cpuSet );
+
+    if ( ::pthread_getaffinity_np( thread, sizeof( cpuSet ), &cpuSet ) == 0 )
+    {
+        for ( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+        {
+            if ( CPU_ISSET( cpu, &cpuSet ) )
+                cpus += cpu;
+        }
+    }
+
+    int policy = SCHED_OTHER;
+    ::pthread_getschedparam( thread, &policy, &param );
+
+    errno = 0;
+    const int nice = ::getpriority( PRIO_PROCESS, threadId() );
+
+    const auto scheduling = toScheduling( policy & ~SCHED_RESET_ON_FORK );
+
+    // the kernel drops offline CPUs from the mask
+    bool verified = std::all_of( cpus.cbegin(), cpus.cend(),
+        [&settings]( int cpu ) { return settings.cpus.isEmpty() || settings.cpus.contains( cpu ); } );
+
+    verified = verified && ( scheduling == settings.scheduling );
+
+    // the nice value is ignored by SCHED_IDLE
+    if ( settings.nice != 0 && settings.scheduling != Vnc::IdleScheduling )
+        verified = verified && ( errno == 0 ) && ( nice == settings.nice );
+
+    if ( verified )
+    {
+        qCInfo( logThreads ).nospace() << name << "(" << roleName( role ) << "): cpus "
+            << cpuList( cpus ) << ", running on " << ::sched_getcpu()
+            << ", " << schedulingName( scheduling ) << ", nice " << nice;
+    }
+    else
+    {
+        qCWarning( logThreads ).nospace() << name << "(" << roleName( role )
+            << "): requested cpus " << cpuList( settings.cpus ) << ", "
+            << schedulingName( settings.scheduling ) << ", nice " << settings.nice
+            << " - effective cpus " << cpuList( cpus ) << ", "
+            << schedulingName( scheduling ) << ", nice " << nice;
+    }
+#else
+    qCWarning( logThreads ) << name << "- thread policies are not supported on this platform";
+#endif
+}
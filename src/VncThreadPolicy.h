@@ -0,0 +1,65 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include "VncNamespace.h"
+
+#include <qlist.h>
+#include <qmutex.h>
+
+class QThread;
+class QByteArray;
+
+/*
+    On SoCs with big and little cores the threads of the server should not
+    compete with the render thread of the application. The threads can be
+    pinned to a set of CPUs and run with a lower priority - f.e. with
+    SCHED_IDLE on the little cores.
+
+    The settings are applied by the threads themselves, when being started.
+    Afterwards the effective setup is read back and reported to the
+    "vnceglfs.threads" logging category. ( Linux only )
+ */
+class VncThreadPolicy
+{
+  public:
+    VncThreadPolicy();
+
+    static VncThreadPolicy* instance();
+
+    void setAffinity( Vnc::ThreadRole, const QList< int >& cpus );
+    QList< int > affinity( Vnc::ThreadRole ) const;
+
+    void setScheduling( Vnc::ThreadRole, Vnc::ThreadScheduling, int nice );
+    Vnc::ThreadScheduling scheduling( Vnc::ThreadRole ) const;
+    int niceness( Vnc::ThreadRole ) const;
+
+    /*
+        "cpus,policy,nice=n": f.e. "4-7,idle" or "2,3,batch,nice=10"
+        Returns false, when the specification is invalid.
+     */
+    bool setSpecification( Vnc::ThreadRole, const QByteArray& );
+
+    // called from the thread itself
+    static void apply( Vnc::ThreadRole );
+
+    // applying the policy, whenever the thread gets started
+    static void attach( QThread*, Vnc::ThreadRole );
+
+  private:
+    class Settings
+    {
+      public:
+        QList< int > cpus;
+        Vnc::ThreadScheduling scheduling = Vnc::NormalScheduling;
+        int nice = 0;
+    };
+
+    Settings settings( Vnc::ThreadRole ) const;
+
+    mutable QMutex m_mutex;
+    Settings m_settings[ Vnc::WorkerThreads + 1 ];
+};
@@ -0,0 +1,423 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#include "VncYuvConverter.h"
+#include "RfbEncoder.h"
+
+#include <qopenglcontext.h>
+#include <qopenglfunctions.h>
+#include <qrect.h>
+#include <qloggingcategory.h>
+
+Q_LOGGING_CATEGORY( logYuv, "vnceglfs.yuv", QtCriticalMsg )
+
+namespace
+{
+    const char vertexShader[] =
+        "attribute vec2 vertex;\n"
+        "void main()\n"
+        "{\n"
+        "    gl_Position = vec4( vertex, 0.0, 1.0 );\n"
+        "}\n";
+
+    const char fragmentHeader[] =
+        "#ifdef GL_ES\n"
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+        "precision highp float;\n"
+        "#else\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "#endif\n"
+        "uniform sampler2D source;\n"
+        "uniform vec2 texelSize;\n"
+        "uniform float height;\n";
+
+    /*
+        4 luma values of a row of the rectangle for each target pixel.
+        Rows are counting from the top, while the texture is bottom up.
+     */
+    const char lumaShader[] =
+        "vec3 pixel( float x, float y )\n"
+        "{\n"
+        "    return texture2D( source, vec2( x + 0.5, height - y - 0.5 ) * texelSize ).rgb;\n"
+        "}\n"
+        "float luma( vec3 c )\n"
+        "{\n"
+        "    return dot( c, vec3( 0.299, 0.587, 0.114 ) );\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "    float x = floor( gl_FragCoord.x ) * 4.0;\n"
+        "    float y = floor( gl_FragCoord.y );\n"
+        "    gl_FragColor = vec4( luma( pixel( x, y ) ), luma( pixel( x + 1.0, y ) ),\n"
+        "        luma( pixel( x + 2.0, y ) ), luma( pixel( x + 3.0, y ) ) );\n"
+        "}\n";
+
+    /*
+        Sampling the center of 2x2 pixels gives their average with
+        linear filtering. The first half of the rows are Cb, the second Cr.
+     */
+    const char chromaShader[] =
+        "uniform float chromaHeight;\n"
+        "vec3 block( float x, float y )\n"
+        "{\n"
+        "    return texture2D( source, vec2( 2.0 * x + 1.0, height - 2.0 * y - 1.0 ) * texelSize ).rgb;\n"
+        "}\n"
+        "float chroma( vec3 c, float isCr )\n"
+        "{\n"
+        "    float cb = dot( c, vec3( -0.168736, -0.331264, 0.5 ) );\n"
+        "    float cr = dot( c, vec3( 0.5, -0.418688, -0.081312 ) );\n"
+        "    return mix( cb, cr, isCr ) + 128.0 / 255.0;\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "    float x = floor( gl_FragCoord.x ) * 4.0;\n"
+        "    float row = floor( gl_FragCoord.y );\n"
+        "    float isCr = step( chromaHeight, row );\n"
+        "    float y = row - isCr * chromaHeight;\n"
+        "    gl_FragColor = vec4( chroma( block( x, y ), isCr ), chroma( block( x + 1.0, y ), isCr ),\n"
+        "        chroma( block( x + 2.0, y ), isCr ), chroma( block( x + 3.0, y ), isCr ) );\n"
+        "}\n";
+
+    GLuint compileShader( QOpenGLFunctions* functions,
+        GLenum type, const QByteArray& source )
+    {
+        const auto shader = functions->glCreateShader( type );
+
+        const char* data = source.constData();
+        functions->glShaderSource( shader, 1, &data, nullptr );
+        functions->glCompileShader( shader );
+
+        GLint ok = 0;
+        functions->glGetShaderiv( shader, GL_COMPILE_STATUS, &ok );
+
+        if ( !ok )
+        {
+            char log[ 512 ];
+            functions->glGetShaderInfoLog( shader, sizeof( log ), nullptr, log );
+
+            qCWarning( logYuv ) << "Compiling shader failed:" << log;
+
+            functions->glDeleteShader( shader );
+            return 0;
+        }
+
+        return shader;
+    }
+
+    GLuint linkProgram( QOpenGLFunctions* functions, const QByteArray& fragmentSource )
+    {
+        const auto vertex = compileShader( functions, GL_VERTEX_SHADER, vertexShader );
+        const auto fragment = compileShader( functions, GL_FRAGMENT_SHADER, fragmentSource );
+
+        GLuint program = 0;
+
+        if ( vertex && fragment )
+        {
+            program = functions->glCreateProgram();
+
+            functions->glAttachShader( program, vertex );
+            functions->glAttachShader( program, fragment );
+            functions->glBindAttribLocation( program, 0, "vertex" );
+            functions->glLinkProgram( program );
+
+            GLint ok = 0;
+            functions->glGetProgramiv( program, GL_LINK_STATUS, &ok );
+
+            if ( !ok )
+            {
+                qCWarning( logYuv ) << "Linking shader program failed";
+
+                functions->glDeleteProgram( program );
+                program = 0;
+            }
+        }
+
+        // flagged for deletion, when the program is gone
+        functions->glDeleteShader( vertex );
+        functions->glDeleteShader( fragment );
+
+        return program;
+    }
+
+    GLuint createTexture( QOpenGLFunctions* functions,
+        GLenum format, int width, int height )
+    {
+        GLuint texture = 0;
+
+        functions->glGenTextures( 1, &texture );
+        functions->glBindTexture( GL_TEXTURE_2D, texture );
+
+        functions->glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+        functions->glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+        functions->glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        functions->glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+        functions->glTexImage2D( GL_TEXTURE_2D, 0, format,
+            width, height, 0, format, GL_UNSIGNED_BYTE, nullptr );
+
+        return texture;
+    }
+
+    /*
+        The scene graph relies on the state of the context, so
+        we restore what is modified by the conversion.
+     */
+    class StateGuard
+    {
+      public:
+        StateGuard( QOpenGLFunctions* functions )
+            : m_functions( functions )
+        {
+            functions->glGetIntegerv( GL_VIEWPORT, m_viewport );
+            functions->glGetIntegerv( GL_FRAMEBUFFER_BINDING, &m_framebuffer );
+            functions->glGetIntegerv( GL_CURRENT_PROGRAM, &m_program );
+            functions->glGetIntegerv( GL_ACTIVE_TEXTURE, &m_activeTexture );
+            functions->glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &m_arrayBuffer );
+
+            functions->glActiveTexture( GL_TEXTURE0 );
+            functions->glGetIntegerv( GL_TEXTURE_BINDING_2D, &m_texture );
+
+            functions->glGetVertexAttribiv( 0,
+                GL_VERTEX_ATTRIB_ARRAY_ENABLED, &m_attributeEnabled );
+
+            for ( int i = 0; i < capCount; i++ )
+            {
+                m_enabled[i] = functions->glIsEnabled( caps[i] );
+                functions->glDisable( caps[i] );
+            }
+        }
+
+        ~StateGuard()
+        {
+            auto functions = m_functions;
+
+            for ( int i = 0; i < capCount; i++ )
+            {
+                if ( m_enabled[i] )
+                    functions->glEnable( caps[i] );
+            }
+
+            if ( !m_attributeEnabled )
+                functions->glDisableVertexAttribArray( 0 );
+
+            functions->glBindTexture( GL_TEXTURE_2D, m_texture );
+            functions->glActiveTexture( m_activeTexture );
+            functions->glBindBuffer( GL_ARRAY_BUFFER, m_arrayBuffer );
+            functions->glUseProgram( m_program );
+            functions->glBindFramebuffer( GL_FRAMEBUFFER, m_framebuffer );
+            functions->glViewport( m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3] );
+        }
+
+      private:
+        static constexpr int capCount = 5;
+        const GLenum caps[ capCount ] =
+            { GL_BLEND, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_SCISSOR_TEST, GL_CULL_FACE };
+
+        QOpenGLFunctions* m_functions;
+
+        GLint m_viewport[4];
+        GLint m_framebuffer = 0;
+        GLint m_program = 0;
+        GLint m_activeTexture = 0;
+        GLint m_arrayBuffer = 0;
+        GLint m_texture = 0;
+        GLint m_attributeEnabled = 0;
+
+        GLboolean m_enabled[ capCount ];
+    };
+}
+
+VncYuvConverter::VncYuvConverter()
+{
+    m_programs[0] = m_programs[1] = 0;
+    m_targets[0] = m_targets[1] = 0;
+    m_framebuffers[0] = m_framebuffers[1] = 0;
+}
+
+VncYuvConverter::~VncYuvConverter()
+{
+}
+
+bool VncYuvConverter::isSupported( const QOpenGLContext* context )
+{
+    if ( context == nullptr )
+        return false;
+
+    auto functions = context->functions();
+
+    return functions->hasOpenGLFeature( QOpenGLFunctions::Shaders )
+        && functions->hasOpenGLFeature( QOpenGLFunctions::Framebuffers )
+        && functions->hasOpenGLFeature( QOpenGLFunctions::NPOTTextures );
+}
+
+bool VncYuvConverter::init()
+{
+    auto functions = QOpenGLContext::currentContext()->functions();
+
+    const QByteArray header( fragmentHeader );
+
+    m_programs[0] = linkProgram( functions, header + lumaShader );
+    m_programs[1] = linkProgram( functions, header + chromaShader );
+
+    if ( m_programs[0] == 0 || m_programs[1] == 0 )
+    {
+        release();
+        return false;
+    }
+
+    for ( int i = 0; i < 2; i++ )
+    {
+        m_texelSize[i] = functions->glGetUniformLocation( m_programs[i], "texelSize" );
+        m_height[i] = functions->glGetUniformLocation( m_programs[i], "height" );
+
+        functions->glUseProgram( m_programs[i] );
+        functions->glUniform1i( functions->glGetUniformLocation( m_programs[i], "source" ), 0 );
+    }
+
+    m_chromaHeight = functions->glGetUniformLocation( m_programs[1], "chromaHeight" );
+
+    const GLfloat vertices[] = { -1.0, -1.0, 1.0, -1.0, -1.0, 1.0, 1.0, 1.0 };
+
+    functions->glGenBuffers( 1, &m_vertexBuffer );
+    functions->glBindBuffer( GL_ARRAY_BUFFER, m_vertexBuffer );
+    functions->glBufferData( GL_ARRAY_BUFFER, sizeof( vertices ), vertices, GL_STATIC_DRAW );
+
+    m_initialized = true;
+    return true;
+}
+
+bool VncYuvConverter::resize( const QSize& size )
+{
+    auto functions = QOpenGLContext::currentContext()->functions();
+
+    functions->glDeleteTextures( 1, &m_source );
+    functions->glDeleteTextures( 2, m_targets );
+    functions->glDeleteFramebuffers( 2, m_framebuffers );
+
+    m_size = QSize();
+
+    // GL_RGB: copying from a framebuffer without alpha into GL_RGBA fails with OpenGL ES
+    m_source = createTexture( functions, GL_RGB, size.width(), size.height() );
+
+    // luma: 4 samples per pixel, chroma: 4 samples per pixel, Cb + Cr rows
+    m_targets[0] = createTexture( functions, GL_RGBA, size.width() / 4, size.height() );
+    m_targets[1] = createTexture( functions, GL_RGBA, size.width() / 8, size.height() );
+
+    functions->glGenFramebuffers( 2, m_framebuffers );
+
+    bool ok = true;
+
+    for ( int i = 0; i < 2; i++ )
+    {
+        functions->glBindFramebuffer( GL_FRAMEBUFFER, m_framebuffers[i] );
+        functions->glFramebufferTexture2D( GL_FRAMEBUFFER,
+            GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_targets[i], 0 );
+
+        if ( functions->glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+            ok = false;
+    }
+
+    if ( ok )
+        m_size = size;
+
+    return ok;
+}
+
+bool VncYuvConverter::convert( const QSize& windowSize, const QRect& rect, RfbYuvImage& image )
+{
+    const int w = rect.width();
+    const int h = rect.height();
+
+    if ( w <= 0 || h <= 0 || ( w % 8 ) || ( h % 2 ) )
+        return false;
+
+    if ( !m_initialized && !init() )
+        return false;
+
+    auto functions = QOpenGLContext::currentContext()->functions();
+
+    const StateGuard guard( functions );
+
+    if ( m_size != windowSize && !resize( windowSize ) )
+        return false;
+
+    // the rectangle of the window goes to the origin of the source texture
+    functions->glBindTexture( GL_TEXTURE_2D, m_source );
+    functions->glCopyTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0,
+        rect.x(), windowSize.height() - rect.y() - h, w, h );
+
+    functions->glBindBuffer( GL_ARRAY_BUFFER, m_vertexBuffer );
+    functions->glEnableVertexAttribArray( 0 );
+    functions->glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, nullptr );
+
+    const auto texelWidth = 1.0f / m_size.width();
+    const auto texelHeight = 1.0f / m_size.height();
+
+    image.size = QSize( w, h );
+
+    image.y.resize( w * h );
+    image.cb.resize( w * h / 4 );
+    image.cr.resize( w * h / 4 );
+
+    for ( int i = 0; i < 2; i++ )
+    {
+        const int targetWidth = ( i == 0 ) ? w / 4 : w / 8;
+
+        functions->glBindFramebuffer( GL_FRAMEBUFFER, m_framebuffers[i] );
+        functions->glViewport( 0, 0, targetWidth, h );
+
+        functions->glUseProgram( m_programs[i] );
+        functions->glUniform2f( m_texelSize[i], texelWidth, texelHeight );
+        functions->glUniform1f( m_height[i], h );
+
+        if ( i == 1 )
+            functions->glUniform1f( m_chromaHeight, h / 2 );
+
+        functions->glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+
+        // the rows of the targets are top down
+        if ( i == 0 )
+        {
+            functions->glReadPixels( 0, 0, targetWidth, h,
+                GL_RGBA, GL_UNSIGNED_BYTE, image.y.data() );
+        }
+        else
+        {
+            functions->glReadPixels( 0, 0, targetWidth, h / 2,
+                GL_RGBA, GL_UNSIGNED_BYTE, image.cb.data() );
+
+            functions->glReadPixels( 0, h / 2, targetWidth, h / 2,
+                GL_RGBA, GL_UNSIGNED_BYTE, image.cr.data() );
+        }
+    }
+
+    return true;
+}
+
+void VncYuvConverter::release()
+{
+    auto functions = QOpenGLContext::currentContext()->functions();
+
+    for ( int i = 0; i < 2; i++ )
+    {
+        if ( m_programs[i] )
+            functions->glDeleteProgram( m_programs[i] );
+
+        m_programs[i] = 0;
+    }
+
+    functions->glDeleteBuffers( 1, &m_vertexBuffer );
+    functions->glDeleteTextures( 1, &m_source );
+    functions->glDeleteTextures( 2, m_targets );
+    functions->glDeleteFramebuffers( 2, m_framebuffers );
+
+    m_vertexBuffer = m_source = 0;
+    m_targets[0] = m_targets[1] = 0;
+    m_framebuffers[0] = m_framebuffers[1] = 0;
+
+    m_size = QSize();
+    m_initialized = false;
+}
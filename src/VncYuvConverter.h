@@ -0,0 +1,68 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+#pragma once
+
+#include <qopengl.h>
+#include <qsize.h>
+
+class QOpenGLContext;
+class QRect;
+class RfbYuvImage;
+
+/*
+    JPEG works with YCbCr 4:2:0, what usually means reading back
+    32 bits per pixel and converting/subsampling on the CPU.
+
+    The converter renders the Y and CbCr planes with a shader pass into
+    offscreen targets, so that only 12 bits per pixel need to be read back,
+    that can be passed to libjpeg without any further conversion.
+    4 samples are packed into one RGBA pixel, as GL_RGBA/GL_UNSIGNED_BYTE
+    is the only format, that can be read back with all OpenGL ( ES ) versions.
+
+    All methods have to be called from the render thread with a current
+    context. OpenGL resources, that have not been released explicitly,
+    are released together with the context.
+ */
+class VncYuvConverter
+{
+  public:
+    VncYuvConverter();
+    ~VncYuvConverter();
+
+    // OpenGL ( ES ) 2.0 with framebuffer objects and shaders
+    static bool isSupported( const QOpenGLContext* );
+
+    /*
+        Converts rect of the currently bound framebuffer, that has
+        the size of the window. The width of rect has to be a
+        multiple of 8, the height a multiple of 2.
+     */
+    bool convert( const QSize& windowSize, const QRect& rect, RfbYuvImage& );
+
+    void release();
+
+  private:
+    Q_DISABLE_COPY( VncYuvConverter )
+
+    bool init();
+    bool resize( const QSize& );
+
+    GLuint m_programs[2];
+
+    GLint m_texelSize[2];
+    GLint m_height[2];
+    GLint m_chromaHeight;
+
+    GLuint m_vertexBuffer = 0;
+
+    GLuint m_source = 0;     // a copy of the window
+    GLuint m_targets[2];     // luma, chroma
+    GLuint m_framebuffers[2];
+
+    QSize m_size;
+
+    bool m_initialized = false;
+};
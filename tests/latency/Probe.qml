@@ -0,0 +1,56 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+import QtQuick 2.0
+
+/*
+    The probe at ( 20, 20, 100, 100 ) toggles its color, when being clicked.
+    The rotating rectangle keeps the scene graph busy like an application,
+    that is running an animation.
+ */
+Rectangle
+{
+    width: 640
+    height: 480
+
+    color: "lightsteelblue"
+
+    Rectangle
+    {
+        id: probe
+
+        x: 20
+        y: 20
+        width: 100
+        height: 100
+
+        property bool toggled: false
+        color: toggled ? "crimson" : "darkgreen"
+
+        MouseArea
+        {
+            anchors.fill: parent
+            onPressed: probe.toggled = !probe.toggled
+        }
+    }
+
+    Rectangle
+    {
+        x: 320
+        y: 140
+        width: 200
+        height: 200
+
+        color: "orange"
+
+        RotationAnimation on rotation
+        {
+            from: 0
+            to: 360
+            duration: 2000
+            loops: Animation.Infinite
+        }
+    }
+}
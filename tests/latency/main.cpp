@@ -0,0 +1,389 @@
+/******************************************************************************
+ * VncEGLFS - Copyright (C) 2022 Uwe Rathmann
+ *            SPDX-License-Identifier: BSD-3-Clause
+ *****************************************************************************/
+
+/*
+    Tracking the latency between input and response in CI: a QML scene is
+    shown on the offscreen platform with a VNC server, that is measuring
+    the latency of the probe from $QVNC_GL_LATENCY_PROBE. A minimal viewer
+    keeps requesting frames, until the probe has reported the requested
+    number of times.
+
+        vnceglfs-latency [--reports 3] [--timeout 60] [--max-p95 <ms>] [scene.qml]
+
+    The exit code is 0, when all reports have been received in time and
+    the p95 of the latency until the socket does not exceed --max-p95.
+ */
+
+#include <VncNamespace.h>
+
+#include <qguiapplication.h>
+#include <qquickview.h>
+#include <qcommandlineparser.h>
+#include <qtcpsocket.h>
+#include <qtimer.h>
+#include <qmutex.h>
+#include <qendian.h>
+#include <qregularexpression.h>
+#include <qloggingcategory.h>
+#include <qdebug.h>
+
+namespace
+{
+    QMutex reportMutex;
+    QList< qreal > reportedP95;
+
+    QtMessageHandler defaultHandler = nullptr;
+
+    void messageHandler( QtMsgType type,
+        const QMessageLogContext& context, const QString& message )
+    {
+        // called from the thread, where the probe has received the last sample
+        if ( qstrcmp( context.category, "vnceglfs.latency" ) == 0
+            && message.startsWith( QStringLiteral( "input to socket:" ) ) )
+        {
+            const QRegularExpression regExp( QStringLiteral( "p95: ([0-9.]+)" ) );
+
+            const auto match = regExp.match( message );
+            if ( match.hasMatch() )
+            {
+                QMutexLocker locker( &reportMutex );
+                reportedP95 += match.captured( 1 ).toDouble();
+            }
+        }
+
+        defaultHandler( type, context, message );
+    }
+
+    /*
+        Speaking just enough RFB to keep the server sending: Raw encoding only,
+        so that the updates can be skipped without decoding them
+     */
+    class Viewer
+    {
+      public:
+        Viewer()
+        {
+            QObject::connect( &m_socket, &QTcpSocket::readyRead,
+                [this] { processData(); } );
+        }
+
+        void connectToServer( int port )
+        {
+            m_socket.connectToHost( QStringLiteral( "127.0.0.1" ), port );
+        }
+
+        bool isFailed() const { return m_failed; }
+
+      private:
+        enum State
+        {
+            Protocol,
+            Security,
+            ServerInit,
+            Connected
+        };
+
+        void processData()
+        {
+            m_buffer += m_socket.readAll();
+
+            while ( !m_failed )
+            {
+                const int size = processMessage();
+                if ( size <= 0 )
+                    break;
+
+                m_buffer.remove( 0, size );
+            }
+        }
+
+        int processMessage()
+        {
+            switch( m_state )
+            {
+                case Protocol:
+                {
+                    if ( m_buffer.size() < 12 )
+                        return 0;
+
+                    m_socket.write( "RFB 003.003\n", 12 );
+                    m_state = Security;
+
+                    return 12;
+                }
+                case Security:
+                {
+                    if ( m_buffer.size() < 4 )
+                        return 0;
+
+                    if ( uint32( 0 ) != 1 )
+                    {
+                        fail( "authentication is not supported, unset the password" );
+                        return 0;
+                    }
+
+                    m_socket.putChar( 1 ); // ClientInit: shared
+                    m_state = ServerInit;
+
+                    return 4;
+                }
+                case ServerInit:
+                {
+                    if ( m_buffer.size() < 24 )
+                        return 0;
+
+                    const int size = 24 + int( uint32( 20 ) );
+                    if ( m_buffer.size() < size )
+                        return 0;
+
+                    m_width = uint16( 0 );
+                    m_height = uint16( 2 );
+                    m_bytesPerPixel = quint8( m_buffer[4] ) / 8;
+
+                    sendEncodings();
+                    requestUpdate( false );
+
+                    m_state = Connected;
+                    return size;
+                }
+                case Connected:
+                {
+                    return processServerMessage();
+                }
+            }
+
+            return 0;
+        }
+
+        int processServerMessage()
+        {
+            if ( m_buffer.isEmpty() )
+                return 0;
+
+            switch( quint8( m_buffer[0] ) )
+            {
+                case 0: // FramebufferUpdate
+                {
+                    if ( m_buffer.size() < 4 )
+                        return 0;
+
+                    const int count = uint16( 2 );
+
+                    qint64 size = 4;
+                    for ( int i = 0; i < count; i++ )
+                    {
+                        if ( m_buffer.size() < size + 12 )
+                            return 0;
+
+                        const qint64 w = uint16( size + 4 );
+                        const qint64 h = uint16( size + 6 );
+                        const auto encoding = qint32( uint32( size + 8 ) );
+
+                        size += 12;
+
+                        if ( encoding == 0 ) // Raw
+                            size += w * h * m_bytesPerPixel;
+                        else if ( encoding != -223 ) // DesktopSize
+                        {
+                            fail( "unexpected encoding" );
+                            return 0;
+                        }
+                    }
+
+                    if ( m_buffer.size() < size )
+                        return 0;
+
+                    requestUpdate( true );
+                    return int( size );
+                }
+                case 1: // SetColourMapEntries
+                {
+                    if ( m_buffer.size() < 6 )
+                        return 0;
+
+                    const int size = 6 + 6 * uint16( 4 );
+                    return ( m_buffer.size() < size ) ? 0 : size;
+                }
+                case 2: // Bell
+                {
+                    return 1;
+                }
+                case 3: // ServerCutText
+                {
+                    if ( m_buffer.size() < 8 )
+                        return 0;
+
+                    const int size = 8 + int( uint32( 4 ) );
+                    return ( m_buffer.size() < size ) ? 0 : size;
+                }
+                default:
+                {
+                    fail( "unexpected message" );
+                    return 0;
+                }
+            }
+        }
+
+        void sendEncodings()
+        {
+            char message[8] = { 2, 0, 0, 1, 0, 0, 0, 0 }; // Raw
+            m_socket.write( message, sizeof( message ) );
+        }
+
+        void requestUpdate( bool incremental )
+        {
+            char message[10] = { 3, char( incremental ), 0, 0, 0, 0 };
+
+            qToBigEndian( m_width, reinterpret_cast< uchar* >( message + 6 ) );
+            qToBigEndian( m_height, reinterpret_cast< uchar* >( message + 8 ) );
+
+            m_socket.write( message, sizeof( message ) );
+        }
+
+        quint16 uint16( qint64 pos ) const
+        {
+            return qFromBigEndian< quint16 >(
+                reinterpret_cast< const uchar* >( m_buffer.constData() + pos ) );
+        }
+
+        quint32 uint32( qint64 pos ) const
+        {
+            return qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( m_buffer.constData() + pos ) );
+        }
+
+        void fail( const char* message )
+        {
+            qWarning() << "Viewer:" << message;
+
+            m_failed = true;
+            m_socket.abort();
+        }
+
+        QTcpSocket m_socket;
+        QByteArray m_buffer;
+
+        State m_state = Protocol;
+        bool m_failed = false;
+
+        quint16 m_width = 0;
+        quint16 m_height = 0;
+        int m_bytesPerPixel = 4;
+    };
+}
+
+int main( int argc, char* argv[] )
+{
+    if ( !qEnvironmentVariableIsSet( "QT_QPA_PLATFORM" ) )
+        qputenv( "QT_QPA_PLATFORM", "offscreen" );
+
+    if ( !qEnvironmentVariableIsSet( "QVNC_GL_LATENCY_PROBE" ) )
+    {
+        // the probe item of Probe.qml, clicked every 100ms
+        qputenv( "QVNC_GL_LATENCY_PROBE", "20,20,100,100,100" );
+    }
+
+    defaultHandler = qInstallMessageHandler( messageHandler );
+    QLoggingCategory::setFilterRules( QStringLiteral( "vnceglfs.latency.info=true" ) );
+
+    QGuiApplication app( argc, argv );
+    app.setApplicationName( QStringLiteral( "vnceglfs-latency" ) );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        QStringLiteral( "Latency between input and response of a VNC server" ) );
+    parser.addHelpOption();
+
+    QCommandLineOption reportsOption( QStringLiteral( "reports" ),
+        QStringLiteral( "Number of reports of the probe, default: 3" ),
+        QStringLiteral( "count" ), QStringLiteral( "3" ) );
+
+    QCommandLineOption timeoutOption( QStringLiteral( "timeout" ),
+        QStringLiteral( "Seconds until giving up, default: 60" ),
+        QStringLiteral( "seconds" ), QStringLiteral( "60" ) );
+
+    QCommandLineOption maxP95Option( QStringLiteral( "max-p95" ),
+        QStringLiteral( "Upper limit for the p95 of input to socket in ms, default: none" ),
+        QStringLiteral( "ms" ), QStringLiteral( "-1" ) );
+
+    parser.addOption( reportsOption );
+    parser.addOption( timeoutOption );
+    parser.addOption( maxP95Option );
+
+    parser.addPositionalArgument( QStringLiteral( "scene" ),
+        QStringLiteral( "QML file with the probe item, default: Probe.qml" ) );
+
+    parser.process( app );
+
+    const int reports = parser.value( reportsOption ).toInt();
+    const qreal maxP95 = parser.value( maxP95Option ).toDouble();
+
+    const auto args = parser.positionalArguments();
+    const auto scene = args.isEmpty() ? QStringLiteral( VNC_LATENCY_SCENE ) : args.first();
+
+    QQuickView view;
+    view.setResizeMode( QQuickView::SizeRootObjectToView );
+    view.setSource( QUrl::fromLocalFile( scene ) );
+
+    if ( view.status() != QQuickView::Ready )
+        return 1;
+
+    view.resize( 640, 480 );
+    view.show();
+
+    if ( !Vnc::startServer( &view ) )
+    {
+        qWarning() << "Can't start the VNC server";
+        return 1;
+    }
+
+    Viewer viewer;
+    viewer.connectToServer( Vnc::serverPort( &view ) );
+
+    QTimer pollTimer;
+    QObject::connect( &pollTimer, &QTimer::timeout,
+        [&]
+        {
+            QList< qreal > p95;
+
+            {
+                QMutexLocker locker( &reportMutex );
+                p95 = reportedP95;
+            }
+
+            if ( viewer.isFailed() )
+            {
+                app.exit( 1 );
+                return;
+            }
+
+            if ( p95.count() < reports )
+                return;
+
+            int exitCode = 0;
+
+            for ( const auto value : p95 )
+            {
+                if ( maxP95 >= 0.0 && value > maxP95 )
+                {
+                    qWarning() << "p95 of" << value << "ms exceeds" << maxP95 << "ms";
+                    exitCode = 1;
+                }
+            }
+
+            app.exit( exitCode );
+        } );
+
+    pollTimer.start( 100 );
+
+    QTimer::singleShot( parser.value( timeoutOption ).toInt() * 1000, &app,
+        [&]
+        {
+            qWarning() << "Timeout: the latency probe has not reported";
+            app.exit( 1 );
+        } );
+
+    return app.exec();
+}